@@ -10,12 +10,68 @@
 // note, this is overritten by the IRC_USER environment variable
 #define DEFAULT_BOT_NAME "fake-insobot"
 
-// minimum milliseconds between messages
+// minimum milliseconds between messages to the same channel, after a burst of up to CMD_RATE_BURST messages
 #define CMD_RATE_LIMIT_MS 1500
+#define CMD_RATE_BURST 1
 
-// number of backed-up commands to keep
+// same as above, for channels where the bot is a moderator (twitch USERSTATE / +o)
+#define CMD_MOD_RATE_LIMIT_MS 300
+#define CMD_MOD_RATE_BURST 3
+
+// limit for everything sent on a connection, defaults to twitch's 20 messages per 30 seconds.
+// messages to channels where the bot is a moderator only count against the second one, twitch's 100 per 30 seconds.
+// these are only used for servers whose name ends with CMD_GLOBAL_RATE_SERVER, or every server if it's undefined.
+#define CMD_GLOBAL_RATE_SERVER "twitch.tv"
+#define CMD_GLOBAL_RATE_LIMIT_MS 1500
+#define CMD_GLOBAL_RATE_BURST 20
+#define CMD_GLOBAL_MOD_RATE_LIMIT_MS 300
+#define CMD_GLOBAL_MOD_RATE_BURST 100
+
+// limit for channels joined / parted, counted per channel rather than per line, since JOIN / PART are batched
+// into comma-separated lines. defaults to twitch's 20 joins per 10 seconds.
+#define CMD_JOIN_RATE_LIMIT_MS 500
+#define CMD_JOIN_RATE_BURST 20
+
+// if defined, messages queued up for the same channel are merged into one line (up to the max length) with this
+// separator between them, to get more through the rate limit when busy.
+//#define CMD_COALESCE_SEP " | "
+
+// number of backed-up commands to keep per channel (and again for moderation commands)
 #define CMD_QUEUE_MAX 32
 
+// number of worker threads used for modules' run_async jobs
+#define ASYNC_NUM_THREADS 4
+
+// milliseconds between on_tick calls, only while a loaded module has an on_tick
+#define TICK_INTERVAL_MS 250
+
+// seconds without anything from the server before we PING it, and before we give up and reconnect
+#define PING_IDLE_SECS 60
+#define PING_TIMEOUT_SECS 90
+
+// milliseconds to wait after a connection drops before reconnecting it
+#define IRC_RECONNECT_MS 10000
+
+// milliseconds after a module calls save_me before its data is written, so a burst of changes is saved once.
+// a module's data won't be written more than once per SAVE_MIN_INTERVAL_MS. Everything is saved on exit regardless.
+#define SAVE_DELAY_MS 2000
+#define SAVE_MIN_INTERVAL_MS 10000
+
+// a module's journal (see IRCCoreCtx.journal) is compacted into its data file by saving it once the journal is at
+// least JOURNAL_COMPACT_MIN bytes, and JOURNAL_COMPACT_PERCENT % of the data file's size.
+#define JOURNAL_COMPACT_MIN 4096
+#define JOURNAL_COMPACT_PERCENT 50
+
+// bytes of shared memory per peer for IPC with other instances (a power of 2), messages can be up to half of this.
+// IPC_RETRY_MS is how soon to try again when a peer hasn't read enough to make room yet, and a peer that gets more
+// than IPC_BACKLOG_MAX bytes behind is dropped.
+#define IPC_RING_SIZE (1 << 20)
+#define IPC_RETRY_MS 50
+#define IPC_BACKLOG_MAX (IPC_RING_SIZE * 4)
+
+// number of module callback timings kept for tracing, SIGUSR2 or "trace" on stdin writes them to a JSON file
+#define TRACE_NUM_SPANS 16384
+
 // URL to the schedule webpage if you're using mod_schedule / mod_twitter
 #define SCHEDULE_URL ""
 
@@ -42,7 +42,7 @@ bool  inso_ht_tick (inso_ht*);
 
 #endif
 
-#define INSO_HT_VERSION 2
+#define INSO_HT_VERSION 3
 
 // Implementation
 
@@ -148,7 +148,9 @@ void* inso_ht_get(inso_ht* ht, size_t hash, inso_ht_cmp_fn cmp, void* param){
 bool inso_ht_del(inso_ht* ht, size_t hash, inso_ht_cmp_fn cmp, void* param){
 	assert(ht);
 	assert(ht->memory);
-	inso_ht_tick(ht);
+
+	// finish any rehash first, so only the probe chains in the main table need fixing up.
+	while(inso_ht_tick(ht));
 
 	intptr_t index;
 	if(inso_htpriv_get_i(ht, &index, hash, cmp, param)){
@@ -238,43 +240,28 @@ static inline bool inso_htpriv_get_i(inso_ht* ht, intptr_t* idx, size_t hash, in
 }
 
 static inline void inso_htpriv_del_i(inso_ht* ht, intptr_t idx){
+	assert(idx >= 0);
 
-	if(idx < 0){
-		memset(ht->prev_memory - (idx+1), 0, ht->elem_size);
-		return;
-	}
-
-	memset(ht->memory + idx * ht->elem_size, 0, ht->elem_size);
-	INSO_HT_DBG("ht_del: starting. idx=%zu, cap=%zu\n", idx, ht->capacity);
+	// backward shift: move later entries of the probe chain into the hole if it's not before their home slot.
+	const size_t mask = ht->capacity - 1;
+	size_t hole = idx;
 
 	for(size_t count = 1; count < ht->capacity; ++count){
-		size_t i  = (idx + count) & (ht->capacity - 1);
+		size_t i  = (idx + count) & mask;
 		void* ptr = ht->memory + i * ht->elem_size;
 
-		if(inso_htpriv_empty(ht, ptr)){
-			INSO_HT_DBG("ending\n");
-			return;
-		}
-
-		size_t hash = ht->hash_fn(ptr);
-		size_t idx2 = hash & (ht->capacity - 1);
+		if(inso_htpriv_empty(ht, ptr)) break;
 
-		INSO_HT_DBG("hash=%zu, idx2=%zu, ", hash, idx2);
+		size_t home = ht->hash_fn(ptr) & mask;
 
-		if(idx2 <= (size_t)idx){
-			INSO_HT_DBG("swapping.");
-			memcpy(
-				ht->memory + idx  * ht->elem_size,
-				ht->memory + idx2 * ht->elem_size,
-				ht->elem_size
-			);
-			memset(ht->memory + idx2 * ht->elem_size, 0, ht->elem_size);
-			idx = i;
+		if(((i - home) & mask) >= ((i - hole) & mask)){
+			memcpy(ht->memory + hole * ht->elem_size, ptr, ht->elem_size);
+			hole = i;
 		}
-		INSO_HT_DBG("\n");
 	}
 
-	assert(!"ht_del: not found and no empty slots? wtf");
+	memset(ht->memory + hole * ht->elem_size, 0, ht->elem_size);
+	ht->used--;
 }
 
 static inline size_t inso_htpriv_align(size_t i){
@@ -0,0 +1,79 @@
+#ifndef INSO_HTTP_H_
+#define INSO_HTTP_H_
+#include <stdbool.h>
+#include "module.h"
+
+// Non-blocking HTTP requests run by the core's shared curl multi handle (IRCCoreCtx.http_request)
+// The response body is collected into a null-terminated stretchy buffer which is freed after the callback.
+
+typedef struct inso_http_req inso_http_req;
+
+// status is the HTTP response code, or -(CURLcode) if the request failed / was cancelled.
+typedef void (*inso_http_cb)(inso_http_req* req, long status, char* data);
+
+struct inso_http_req {
+	void*        curl;    // CURL*, set up like inso_curl_reset. Set any extra options before inso_http_send.
+	void*        headers; // struct curl_slist*, add to it with inso_http_header. Freed automatically.
+	char*        data;
+	inso_http_cb cb;
+	void*        arg;     // for use by the callback
+};
+
+inso_http_req* inso_http_new    (const char* url, inso_http_cb cb, void* arg);
+void           inso_http_header (inso_http_req* req, const char* header);
+void           inso_http_send   (const IRCCoreCtx* ctx, inso_http_req* req);
+
+#endif
+
+// implementation
+
+#ifdef INSO_IMPL
+#undef INSO_IMPL
+#include <stdlib.h>
+#include <curl/curl.h>
+#include "stb_sb.h"
+#include "inso_utils.h"
+
+inso_http_req* inso_http_new(const char* url, inso_http_cb cb, void* arg){
+	inso_http_req* req = calloc(1, sizeof(*req));
+	assert(req);
+
+	req->curl = inso_curl_init(url, &req->data);
+	req->cb   = cb;
+	req->arg  = arg;
+
+	return req;
+}
+
+void inso_http_header(inso_http_req* req, const char* header){
+	req->headers = curl_slist_append(req->headers, header);
+	curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, req->headers);
+}
+
+static void inso_httppriv_done(void* curl, int result, void* arg){
+	inso_http_req* req = arg;
+
+	sb_push(req->data, 0);
+
+	long status = 0;
+	if(result == CURLE_OK){
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	} else {
+		status = -result;
+	}
+
+	if(req->cb){
+		req->cb(req, status, req->data);
+	}
+
+	curl_easy_cleanup(curl);
+	curl_slist_free_all(req->headers);
+	sb_free(req->data);
+	free(req);
+}
+
+void inso_http_send(const IRCCoreCtx* ctx, inso_http_req* req){
+	ctx->http_request(req->curl, &inso_httppriv_done, req);
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -119,6 +120,16 @@ static inline void snprintf_chain(char** bufp, size_t* sizep, const char* fmt, .
 	va_end(v);
 }
 
+// FNV-1a ignoring ASCII case, for hashing nicks / channel names. len 0 means up to the NUL.
+static inline uint32_t inso_hash_nocase(const char* str, size_t len){
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; len ? i < len : str[i]; ++i){
+		hash ^= tolower((uint8_t)str[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
 static inline bool inso_in_chan(const IRCCoreCtx* ctx, const char* chan){
 	const char** list = ctx->get_channels();
 	while(*list){
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <inttypes.h>
 #include <string.h>
 #include <locale.h>
 #include <ctype.h>
@@ -17,6 +18,7 @@
 #include <dlfcn.h>
 #include <link.h>
 #include <execinfo.h>
+#include <pthread.h>
 
 #include <sys/time.h>
 #include <sys/stat.h>
@@ -27,6 +29,13 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/file.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 
 #include <libircclient.h>
 #include <libirc_rfcnumeric.h>
@@ -36,6 +45,7 @@
 #include "module.h"
 #include "stb_sb.h"
 #include "inso_utils.h"
+#include "inso_ht.h"
 
 #ifndef LIBIRC_OPTION_SSL_NO_VERIFY
 	#define LIBIRC_OPTION_SSL_NO_VERIFY (1 << 3)
@@ -56,9 +66,25 @@ _Static_assert(sizeof(void (*)()) == sizeof(void*), "uh oh");
 typedef struct Module_ {
 	char* lib_path;
 	void* lib_handle;
+	int   lib_fd; // memfd the instance was loaded from (see util_module_dlopen_copy), or -1
 	IRCModuleCtx* ctx;
 	size_t ctx_size;
+	void* old_handle; // previous instance, kept loaded during a reload until the new one adopts its state
+	int   old_lib_fd;
+	IRCModuleCtx* old_ctx;
+	size_t old_ctx_size;
 	bool needs_reload, data_modified;
+	pid_t save_pid;   // background save child (IRC_MOD_FORK_SAVE), 0 if none running
+	int   save_fd;    // pidfd for save_pid, -1 if we couldn't get one
+	bool  save_again; // on_save was requested while save_pid was still running
+	int64_t save_due_ms;  // when save_me was called, the module is written out at this time. -1 = not dirty
+	int64_t last_save_ms;
+	int   journal_fd;      // -1 until the module first calls ctx->journal
+	char* journal_buf;     // records not written yet, flushed once per trip around the main loop
+	off_t journal_size;
+	bool  journal_rotated; // <name>.journal.old exists and can be removed once a save succeeds
+	uint16_t trace_name;
+	uint64_t trace_ns, trace_calls; // total time spent in the module's callbacks (including nested calls)
 } Module;
 
 typedef struct INotifyWatch {
@@ -74,23 +100,230 @@ typedef struct INotifyData_ {
 typedef struct IRCCmd_ {
 	size_t id;
 	int cmd;
+	int conn; // index into irc_conns
 	char *chan, *data;
+	bool filtered; // on_filter already ran on it while coalescing
 } IRCCmd;
 
+// one connection to an IRC server, channels are spread over these (see util_conn_pick)
+typedef struct IRCConn_ {
+	int            id;
+	irc_session_t* session;
+	const char    *serv, *port;
+	int            fd;
+	uint32_t       fd_events;
+	int64_t        active_ms;  // last time the socket had something to read
+	bool           ping_sent;
+	bool           registered; // event_connect has happened, so we can send things
+	int64_t        retry_ms;   // when to (re)connect, while there's no session
+	bool           limited;    // the CMD_GLOBAL_* limits apply, see CMD_GLOBAL_RATE_SERVER
+	int64_t        tat;        // token bucket for everything sent on this connection
+	int64_t        mod_tat;    // and for everything, including messages to channels where we're a moderator
+	size_t         num_chans;
+	IRCCmd*        joins;      // JOIN / PART waiting to be sent, in batches (see util_conn_send_joins)
+	int64_t        join_tat;   // token bucket for those, per channel
+} IRCConn;
+
+typedef struct TraceSpan_ {
+	int64_t     start; // CLOCK_MONOTONIC ns
+	int64_t     dur;
+	const char* cb;    // name of the IRCModuleCtx field, a literal in the core
+	uint16_t    mod;   // indices into trace_strs
+	uint16_t    chan;
+} TraceSpan;
+
+typedef struct TraceStrKey_ {
+	uint32_t hash;
+	uint32_t idx;
+} TraceStrKey;
+
+typedef struct IRCTag_ {
+	char*    key;
+	char*    val;
+	uint32_t hash;
+	bool     unescaped;
+} IRCTag;
+
+typedef struct CmdRing_ {
+	IRCCmd   cmds[CMD_QUEUE_MAX];
+	uint32_t head, count;
+} CmdRing;
+
+enum { CMD_LANE_PRIO, CMD_LANE_NORMAL, CMD_LANE_COUNT };
+
+typedef struct CmdQueue_ {
+	char*   chan; // NULL for a connection's raw queue
+	int     conn; // which one, for those
+	CmdRing lanes[CMD_LANE_COUNT];
+	int64_t tat;  // when this queue's token bucket will be full again
+	size_t  dropped;
+	bool    is_mod;
+} CmdQueue;
+
+typedef struct CmdQueueKey_ {
+	uint32_t  hash;
+	CmdQueue* queue;
+} CmdQueueKey;
+
+// single producer / consumer byte ring in a memfd shared with one peer, head & tail only ever increase.
+typedef struct IPCRing_ {
+	uint32_t magic;
+	uint32_t size; // of data, a power of 2
+	uint64_t head __attribute__((aligned(64))); // written by the sender
+	uint64_t tail __attribute__((aligned(64))); // written by the receiver
+	char     data[] __attribute__((aligned(64)));
+} IPCRing;
+
+// records in an IPCRing are padded to IPC_REC_ALIGN, and a whole record never wraps around the end.
+typedef struct IPCRecord_ {
+	uint32_t len;      // of the name + data following this header
+	uint32_t hash;     // of the module name
+	uint32_t name_len; // IPC_REC_SKIP = padding up to the end of the ring
+	uint32_t reserved;
+} IPCRecord;
+
+#define IPC_REC_ALIGN 16
+#define IPC_REC_SKIP  UINT32_MAX
+#define IPC_REC_SIZE(len) ((sizeof(IPCRecord) + (len) + IPC_REC_ALIGN - 1) & ~(size_t)(IPC_REC_ALIGN - 1))
+#define IPC_RING_MAGIC 0x49425231 // "IBR1"
+
 typedef struct IPCAddress_ {
 	int id;
 	struct sockaddr_un addr;
+
+	// our ring for sending to this peer, used once they've sent us theirs (so we know they understand it)
+	IPCRing* tx;
+	int      tx_memfd, tx_evfd;
+	bool     tx_ok, tx_signal;
+	char*    tx_backlog; // records that didn't fit in tx yet
+
+	// their ring for sending to us
+	IPCRing* rx;
+	int      rx_evfd;
 } IPCAddress;
 
+typedef struct IPCRoute_ {
+	uint32_t hash;
+	uint32_t mod_idx;
+} IPCRoute;
+
+typedef struct AsyncJob_ {
+	const IRCModuleCtx* owner;
+	void (*work)(void* arg);
+	void (*done)(void* arg);
+	void* arg;
+	struct AsyncJob_* next;
+} AsyncJob;
+
+typedef struct AsyncPool_ {
+	pthread_t       threads[ASYNC_NUM_THREADS];
+	AsyncJob*       running[ASYNC_NUM_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t  todo_cond; // signalled when a job is queued or the pool is stopping
+	pthread_cond_t  done_cond; // signalled when a worker finishes a job
+	AsyncJob       *todo_head, *todo_tail;
+	AsyncJob       *done_head, *done_tail;
+	int             num_threads;
+	int             wake_fd;   // eventfd, readable when there are jobs in the done list
+	bool            quit;
+} AsyncPool;
+
+typedef struct HTTPReq_ {
+	CURL* curl;
+	const IRCModuleCtx* owner;
+	void (*cb)(void* curl, int result, void* arg);
+	void* arg;
+} HTTPReq;
+
+typedef struct Timer_ {
+	int64_t  deadline_ms; // CLOCK_MONOTONIC
+	uint32_t interval_ms; // 0 for one-shot timers
+	uint32_t gen;         // bumped when the slot is freed, so stale ids can't cancel whatever reuses it
+	int      heap_idx;    // position in timer_heap, or -1 if the slot is free
+	const IRCModuleCtx* owner;
+	void (*cb)(void* arg);
+	void* arg;
+} Timer;
+
+typedef struct CmdTarget_ {
+	uint32_t    hash, len;
+	const char* name; // the alias, not null-terminated
+	uint32_t    mod_idx, cmd_idx;
+} CmdTarget;
+
+typedef struct CmdAlias_ {
+	uint32_t    hash, len;
+	const char* name;
+	CmdTarget*  targets; // in module order, then cmd order
+	size_t      count;
+} CmdAlias;
+
+typedef struct Channel_ Channel;
+
+typedef struct Nick_ {
+	char*     name;
+	Channel** chans; // the channels this nick is in, it's freed when there are none left
+} Nick;
+
+typedef struct ChanMember_ {
+	Nick*    nick;
+	uint32_t idx; // into Channel.nicks & chan_nicks[Channel.idx]
+} ChanMember;
+
+struct Channel_ {
+	char*   name;
+	size_t  idx;     // into channels, chan_nicks & chan_list
+	inso_ht members; // of ChanMember
+	Nick**  nicks;
+	int     conn;      // index into irc_conns of the connection it's on, -1 if not decided yet
+	bool    joined;    // seen our own JOIN on conn since it last connected
+	bool    want_join; // join wanted while conn wasn't connected, done once it is
+	uint16_t trace_name; // index into trace_strs, 0 until it's first traced
+};
+
+typedef struct ChanKey_ {
+	uint32_t hash;
+	Channel* chan;
+} ChanKey;
+
+typedef struct NickKey_ {
+	uint32_t hash;
+	Nick*    nick;
+} NickKey;
+
+typedef struct MetaCache_ {
+	char*     chan;
+	uint32_t  known; // bit per IRC_CB_* id whose row of bits has been filled in
+	uint64_t* bits;  // META_CB_COUNT rows of meta_words, with a bit per index into irc_modules
+} MetaCache;
+
+typedef struct MetaCacheKey_ {
+	uint32_t   hash;
+	MetaCache* cache;
+} MetaCacheKey;
+
+typedef struct ModuleFD_ {
+	int fd;
+	const IRCModuleCtx* owner;
+} ModuleFD;
+
 enum { MOD_GET_SONAME, MOD_GET_CTXNAME };
 
 enum { IRC_CMD_JOIN, IRC_CMD_PART, IRC_CMD_MSG, IRC_CMD_RAW, IRC_CMD_MSG_SPLIT };
 
-static IRCCmd* cmd_queue;
-static uint32_t prev_cmd_ms;
-static size_t next_cmd_id;
+// what an fd in the epoll set belongs to, stored in the upper half of epoll_event.data.u64
+enum { EV_STDIN, EV_IPC, EV_INOTIFY, EV_ASYNC, EV_DEBUG, EV_TIMER, EV_IRC, EV_HTTP, EV_MODULE, EV_SAVE, EV_IPC_RING };
+
+static CmdQueue** cmd_queues;
+static inso_ht    cmd_queue_index; // of CmdQueueKey
+static size_t     cmd_queue_cursor;
+static size_t     cmds_queued;
+static size_t     cmds_dropped;
+static size_t     next_cmd_id;
 
-static irc_session_t* irc_ctx;
+static IRCConn* irc_conns;
+static IRCConn* irc_cur;        // connection the current event came from, NULL if it wasn't from IRC
+static IRCConn* irc_connecting; // set while modules' on_connect runs
 
 static Module* irc_modules;
 static Module** mod_call_stack;
@@ -100,35 +333,105 @@ static IRCModuleCtx** global_mod_list;
 static char* modules_include;
 static char* modules_exclude;
 
-static const char *user, *pass, *serv, *port;
+static const char *user, *pass;
 static char*  bot_nick;
 static size_t bot_host_len;
 
-static char**  channels;
-static char*** chan_nicks;
+static char**    channels;   // null terminated view of chan_list's names
+static char***   chan_nicks; // views of each channel's nick names
+static Channel** chan_list;
+static inso_ht   chan_index; // of ChanKey
+static inso_ht   nick_index; // of NickKey
 
 static INotifyData inotify;
 
-static struct timeval idle_tv;
-static bool ping_sent;
+// the replay harness has no main loop, server connection or ipc, so it doesn't use these.
+#ifdef INSOBOT_REPLAY
+	#define LIVE_ONLY __attribute__((unused))
+#else
+	#define LIVE_ONLY
+#endif
+
+static int      epoll_fd = -1;
+static int      timer_fd = -1;
+static int64_t  timer_armed_ms = -1;
+static int64_t  next_tick_ms;
+static bool     debug_fd_added LIVE_ONLY;
 
 static int         ipc_socket;
 static IPCAddress  ipc_self;
 static IPCAddress* ipc_peers;
+static inso_ht     ipc_routes; // of IPCRoute, module name hash -> index in irc_modules
+
+static const char ipc_ring_hello[] = "\0insobot-ring";
 
 static sig_atomic_t running = 1;
 
+// SIGINT / SIGUSR2 stay blocked except while waiting in epoll_pwait, so they can't slip in between checking
+// their flags & waiting.
+static sigset_t wait_sigmask, int_sigmask;
+
 static bool send_msg_called;
 
-static char   irc_tag_buf[512];
-static char** irc_tag_ptrs;
+static char*     irc_tag_buf;    // copy of the current message's tags, split up by util_tags_parse
+static IRCTag*    irc_tags;
+static uint16_t*  irc_tag_slots;  // index+1 into irc_tags, by the hash of the key
+static bool       irc_tags_parsed;
 static bool   have_tag_hack;
 
+// for core_get_msg_view, built from msg_view_src when first asked for. the buffers are reused for each message.
+static const char* msg_view_src;
+static bool        msg_view_built;
+static IRCMsgView  msg_view;
+static char*       msg_view_plain;
+static char*       msg_view_lower;
+static IRCMsgSpan* msg_view_words;
+static IRCMsgUrl*  msg_view_urls;
+
+static AsyncPool async_pool = {
+	.lock      = PTHREAD_MUTEX_INITIALIZER,
+	.todo_cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+	.wake_fd   = -1,
+};
+
+static CURLM*          http_multi;
+static CURLSH*         http_share;
+static pthread_mutex_t http_share_locks[CURL_LOCK_DATA_LAST];
+static HTTPReq*        http_reqs;
+static int64_t         http_timer_ms = -1; // CLOCK_MONOTONIC deadline for curl_multi_socket_action, or -1
+
+static Timer*    timers;     // slots, indexed by timer id
+static uint32_t* timer_heap; // min-heap of slots, ordered by deadline
+static uint32_t* timer_free; // unused slots
+
+static ModuleFD* mod_fds;
+
+static inso_ht    cmd_index;          // of CmdAlias
+static CmdTarget* cmd_targets;
+static uint8_t    cmd_first_chars[32]; // bitset of the first byte of every alias, lowercased
+
+#define META_CB_COUNT (IRC_CB_PM + 1)
+
+static inso_ht     meta_index; // of MetaCacheKey
+static MetaCache** meta_caches;
+static size_t      meta_words;
+static bool        meta_any;   // whether any module has on_meta at all
+static bool        meta_valid; // false while modules are being (re)loaded
+
+static TraceSpan trace_spans[TRACE_NUM_SPANS];
+static size_t    trace_count; // total recorded, only the last TRACE_NUM_SPANS are kept
+static char**    trace_strs;
+static inso_ht   trace_str_index; // of TraceStrKey
+static uint16_t  trace_chan;      // channel of the event being handled, if any
+static volatile sig_atomic_t trace_dump_requested;
+
 static int pipe_fds[2];
 static int debug_pipe[2];
 static const char* debug_chan;
 
 static char* insobot_path;
+static char* data_path; // with a trailing '/', data-replay/ instead of data/ in insobot-replay
 static const IRCCoreCtx core_ctx;
 
 #define IRC_CALLBACK_BASE(name, event_type) static void irc_##name ( \
@@ -144,16 +447,28 @@ static const IRCCoreCtx core_ctx;
 
 #define IRC_MOD_CALL(mod, ptr, args) ({                                       \
 	sb_push(mod_call_stack, mod);                                             \
+	const bool _traced = (mod)->ctx->ptr;                                     \
+	const int64_t _trace_start = _traced ? util_trace_now() : 0;              \
 	__auto_type ret = (mod)->ctx->ptr ?                                       \
 		__builtin_choose_expr(                                                \
 			__builtin_types_compatible_p(typeof((mod)->ctx->ptr args), void), \
 			((mod)->ctx->ptr args, (int)0),                                   \
 			(mod)->ctx->ptr args                                              \
 		) : 0;                                                                \
+	if(_traced) util_trace_add((mod), #ptr, _trace_start);                    \
 	sb_pop(mod_call_stack);                                                   \
 	ret;                                                                      \
 })
 
+// for module callbacks that aren't in IRCModuleCtx (timers, run_async done, http_request), traced as name.
+#define IRC_MOD_CALL_FN(mod, name, fn, args) ({                              \
+	sb_push(mod_call_stack, mod);                                            \
+	const int64_t _trace_start = util_trace_now();                           \
+	fn args;                                                                 \
+	util_trace_add((mod), name, _trace_start);                               \
+	sb_pop(mod_call_stack);                                                  \
+})
+
 #define IRC_MOD_CALL_ALL(ptr, args) \
 	sb_each(m, irc_modules){        \
 		IRC_MOD_CALL(m, ptr, args); \
@@ -163,7 +478,7 @@ static const IRCCoreCtx core_ctx;
 	sb_each(m, irc_modules){                              \
 		if(                                               \
 			(m->ctx->flags & IRC_MOD_GLOBAL) ||           \
-			util_check_perms(m->ctx->name, params[0], id) \
+			util_check_perms(m, params[0], id)            \
 		){                                                \
 			IRC_MOD_CALL(m, ptr, args);                   \
 		}                                                 \
@@ -177,6 +492,11 @@ static const IRCCoreCtx core_ctx;
 #define ABI_FILTER  24
 #define ABI_UNKNOWN 25
 #define ABI_HELP    27
+#define ABI_FD      28
+#define ABI_JOURNAL 29
+#define ABI_HANDOFF 31
+#define ABI_JOIN_BULK 32
+#define ABI_PREFILTER 33
 #define ABI_CHECK(m, abi) ((m)->ctx_size >= (sizeof(void*)*(abi)))
 
 /*********************************
@@ -187,8 +507,12 @@ IRC_STR_CALLBACK(on_join);
 IRC_STR_CALLBACK(on_part);
 
 static const char* core_get_datafile(void);
+static const IRCMsgView* core_get_msg_view(void);
+static void util_module_join_bulk(Module* m, const char* chan, const char** names, size_t count);
 static IPCAddress* util_ipc_add(const char* name);
 static void        util_ipc_del(const char* name);
+static void        util_ipc_hello(IPCAddress* p);
+static void        util_ipc_routes_build(void);
 static void        util_module_filter_update(void);
 static bool        util_module_filter_allowed(const char*);
 static void        core_join(const char* chan);
@@ -228,12 +552,14 @@ static void util_handle_sig(int n){
 		if(getenv("INSOBOT_DEBUG_CHAN") && size > 2){
 			backtrace_symbols_fd(buf + 2, 1, debug_pipe[1]);
 		}
+	} else if(n == SIGUSR2){
+		trace_dump_requested = 1;
 	} else {
 		running = 0;
 	}
 }
 
-static void util_multiprocess_init(void){
+static LIVE_ONLY void util_multiprocess_init(void){
 
 	if(getenv("INSOBOT_DEBUG_CHAN")){
 		if(pipe(debug_pipe) == -1){
@@ -257,6 +583,7 @@ restart:
 	// parent process -> will loop in util_log_proc, then either exit or goto restart.
 	if(pid != 0){
 		signal(SIGINT , SIG_IGN);
+		signal(SIGUSR2, SIG_IGN);
 		signal(SIGPIPE, &util_handle_sig);
 
 		close(pipe_fds[1]);
@@ -319,7 +646,128 @@ static inline const char* util_env_else(const char* env, const char* def){
 	return c ? c : def;
 }
 
-static bool util_check_perms(const char* mod, const char* chan, int id){
+// tracing.
+// every module callback made through IRC_MOD_CALL is recorded in a ring buffer of the last TRACE_NUM_SPANS, which
+// can be written out as chrome://tracing / perfetto JSON with SIGUSR2 or "trace" on stdin, to see what stalled.
+
+static int64_t util_trace_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+}
+
+static size_t util_trace_str_hash(const void* arg){
+	return ((const TraceStrKey*)arg)->hash;
+}
+
+static bool util_trace_str_cmp(const void* elem, void* param){
+	return strcmp(trace_strs[((const TraceStrKey*)elem)->idx], param) == 0;
+}
+
+// copies module & channel names, since they can be gone by the time the trace is written.
+static uint16_t util_trace_intern(const char* str){
+	if(!str || !*str) return 0;
+
+	if(!trace_strs){
+		inso_ht_init(&trace_str_index, 64, sizeof(TraceStrKey), &util_trace_str_hash);
+		sb_push(trace_strs, strdup(""));
+	}
+
+	uint32_t hash = inso_hash_nocase(str, 0);
+	TraceStrKey* key = inso_ht_get(&trace_str_index, hash, &util_trace_str_cmp, (void*)str);
+	if(key){
+		return key->idx;
+	}
+
+	if(sb_count(trace_strs) > UINT16_MAX){
+		return 0;
+	}
+
+	inso_ht_put(&trace_str_index, &(TraceStrKey){ hash, sb_count(trace_strs) });
+	sb_push(trace_strs, strdup(str));
+
+	return sb_count(trace_strs) - 1;
+}
+
+// only channels in the registry are traced, and their name is interned once.
+static void util_trace_set_chan(Channel* c){
+	if(c && !c->trace_name){
+		c->trace_name = util_trace_intern(c->name);
+	}
+	trace_chan = c ? c->trace_name : 0;
+}
+
+static void util_trace_add(Module* m, const char* cb, int64_t start){
+	TraceSpan* s = trace_spans + (trace_count++ % TRACE_NUM_SPANS);
+	*s = (TraceSpan){
+		.start = start,
+		.dur   = util_trace_now() - start,
+		.cb    = cb,
+		.mod   = m->trace_name,
+		.chan  = trace_chan,
+	};
+
+	m->trace_ns += s->dur;
+	m->trace_calls++;
+}
+
+static void util_trace_json_str(FILE* f, const char* str){
+	for(const char* p = str; *p; ++p){
+		if(*p == '"' || *p == '\\'){
+			fprintf(f, "\\%c", *p);
+		} else if((unsigned char)*p < 0x20){
+			fprintf(f, "\\u%04x", *p);
+		} else {
+			fputc(*p, f);
+		}
+	}
+}
+
+static void util_trace_dump(void){
+	char path[64];
+	snprintf(path, sizeof(path), "insobot-trace-%ld.json", (long)time(0));
+
+	FILE* f = fopen(path, "w");
+	if(!f){
+		perror("util_trace_dump: fopen");
+		return;
+	}
+
+	const size_t num = INSO_MIN(trace_count, (size_t)TRACE_NUM_SPANS);
+	const pid_t pid = getpid();
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+
+	for(size_t i = trace_count - num; i < trace_count; ++i){
+		const TraceSpan* s = trace_spans + (i % TRACE_NUM_SPANS);
+		const char* mod = trace_strs ? trace_strs[s->mod] : "";
+
+		fprintf(f, "%s\n{\"ph\":\"X\",\"pid\":%d,\"tid\":1,\"cat\":\"module\",\"name\":\"", i == trace_count - num ? "" : ",", pid);
+		util_trace_json_str(f, mod);
+		fprintf(f, ".%s\",\"ts\":%" PRId64 ".%03d,\"dur\":%" PRId64 ".%03d,\"args\":{\"module\":\"",
+		        s->cb, s->start / 1000, (int)(s->start % 1000), s->dur / 1000, (int)(s->dur % 1000));
+		util_trace_json_str(f, mod);
+		fprintf(f, "\",\"callback\":\"%s\",\"chan\":\"", s->cb);
+		util_trace_json_str(f, trace_strs ? trace_strs[s->chan] : "");
+		fputs("\"}}", f);
+	}
+
+	fputs("\n]}\n", f);
+	fclose(f);
+
+	printf("Wrote %zu trace spans to %s\n", num, path);
+}
+
+static void util_trace_free(void){
+	sb_each(s, trace_strs){
+		free(*s);
+	}
+	sb_free(trace_strs);
+	inso_ht_free(&trace_str_index);
+}
+
+
+static bool util_check_perms_uncached(const char* mod, const char* chan, int id){
 	bool ret = true;
 	sb_each(m, irc_modules){
 		if(!m->ctx->on_meta) continue;
@@ -328,48 +776,207 @@ static bool util_check_perms(const char* mod, const char* chan, int id){
 	return ret;
 }
 
-static void util_dispatch_cmds(Module* m, const char* chan, const char* name, const char* msg){
-	if(!m->ctx || !m->ctx->commands || !m->ctx->on_cmd) return;
+static size_t util_meta_hash(const void* arg){
+	return ((const MetaCacheKey*)arg)->hash;
+}
+
+static bool util_meta_cmp(const void* elem, void* param){
+	return strcmp(((const MetaCacheKey*)elem)->cache->chan, param) == 0;
+}
+
+static void util_meta_clear(void){
+	sb_each(c, meta_caches){
+		free((*c)->chan);
+		free((*c)->bits);
+		free(*c);
+	}
+	sb_free(meta_caches);
+	inso_ht_free(&meta_index);
+	meta_valid = false;
+}
 
-	for(const char** cmd_list = m->ctx->commands; *cmd_list; ++cmd_list){
-		const char *cmd = *cmd_list, *cmd_end;
+// called once the module list is settled, since the cached bits are indexed by position in irc_modules.
+static void util_meta_init(void){
+	util_meta_clear();
 
-		do {
-			cmd_end = strchrnul(cmd, ' ');
-			const size_t sz = cmd_end - cmd;
+	meta_any = false;
+	sb_each(m, irc_modules){
+		if(m->ctx->on_meta){
+			meta_any = true;
+			break;
+		}
+	}
 
-			if(strncasecmp(msg, cmd, sz) == 0 && (msg[sz] == ' ' || msg[sz] == '\0')){
-				IRC_MOD_CALL(m, on_cmd, (chan, name, msg + sz, cmd_list - m->ctx->commands));
-				break;
+	meta_words = (sb_count(irc_modules) + 63) / 64;
+	inso_ht_init(&meta_index, 64, sizeof(MetaCacheKey), &util_meta_hash);
+	meta_valid = true;
+}
+
+static MetaCache* util_meta_get(const char* chan){
+	uint32_t hash = inso_hash_nocase(chan, 0);
+
+	MetaCacheKey* key = inso_ht_get(&meta_index, hash, &util_meta_cmp, (void*)chan);
+	if(key){
+		return key->cache;
+	}
+
+	MetaCache* c = malloc(sizeof(*c));
+	assert(c);
+
+	c->chan  = strdup(chan);
+	c->known = 0;
+	c->bits  = calloc(META_CB_COUNT * meta_words, sizeof(uint64_t));
+	assert(c->bits);
+
+	sb_push(meta_caches, c);
+	inso_ht_put(&meta_index, &(MetaCacheKey){ hash, c });
+
+	return c;
+}
+
+// answers whether module m should get callback id for chan, asking the on_meta callbacks only the first time.
+static bool util_check_perms(Module* m, const char* chan, int id){
+	if(meta_valid && !meta_any){
+		return true;
+	}
+
+	if(!meta_valid || !chan || id < 0 || id >= META_CB_COUNT){
+		return util_check_perms_uncached(m->ctx->name, chan, id);
+	}
+
+	MetaCache* c = util_meta_get(chan);
+	uint64_t* row = c->bits + id * meta_words;
+
+	if(!(c->known & (1 << id))){
+		memset(row, 0, meta_words * sizeof(uint64_t));
+
+		for(size_t i = 0; i < sb_count(irc_modules); ++i){
+			if(util_check_perms_uncached(irc_modules[i].ctx->name, chan, id)){
+				row[i / 64] |= (UINT64_C(1) << (i % 64));
 			}
+		}
 
-			while(*cmd_end == ' ') ++cmd_end;
-			cmd = cmd_end;
-		} while(*cmd_end);
+		c->known |= (1 << id);
 	}
+
+	size_t idx = m - irc_modules;
+	return row[idx / 64] & (UINT64_C(1) << (idx % 64));
 }
 
-static void util_cmd_enqueue_id(int cmd, size_t id, const char* chan, const char* data){
-	if(sb_count(cmd_queue) > CMD_QUEUE_MAX)
-		return;
+static size_t util_cmd_alias_hash(const void* arg){
+	return ((const CmdAlias*)arg)->hash;
+}
 
-	IRCCmd c = {
-		.id   = id,
-		.cmd  = cmd,
-		.chan = chan ? strdup(chan) : NULL,
-		.data = data ? strdup(data) : NULL
-	};
+static bool util_cmd_alias_cmp(const void* elem, void* param){
+	const CmdAlias *a = elem, *b = param;
+	return a->len == b->len && strncasecmp(a->name, b->name, a->len) == 0;
+}
+
+static int util_cmd_target_sort(const void* _a, const void* _b){
+	const CmdTarget *a = _a, *b = _b;
 
-	sb_push(cmd_queue, c);
+	if(a->hash != b->hash) return a->hash < b->hash ? -1 : 1;
+	if(a->len  != b->len ) return a->len  < b->len  ? -1 : 1;
+
+	int cmp = strncasecmp(a->name, b->name, a->len);
+	if(cmp) return cmp;
+
+	if(a->mod_idx != b->mod_idx) return a->mod_idx < b->mod_idx ? -1 : 1;
+	return (a->cmd_idx > b->cmd_idx) - (a->cmd_idx < b->cmd_idx);
 }
 
-static size_t util_cmd_enqueue(int cmd, const char* chan, const char* data){
-	if(sb_count(cmd_queue) > CMD_QUEUE_MAX)
-		return 0;
+static void util_cmd_index_free(void){
+	inso_ht_free(&cmd_index);
+	sb_free(cmd_targets);
+	memset(cmd_first_chars, 0, sizeof(cmd_first_chars));
+}
 
-	size_t id = next_cmd_id++;
-	util_cmd_enqueue_id(cmd, id, chan, data);
-	return id;
+// maps every command alias of every loaded module to the (module, cmd) pairs it triggers.
+// the alias strings point into the modules' own memory, so this must be rebuilt whenever they're reloaded.
+static void util_cmd_index_build(void){
+	util_cmd_index_free();
+
+	for(size_t mod_idx = 0; mod_idx < sb_count(irc_modules); ++mod_idx){
+		const IRCModuleCtx* ctx = irc_modules[mod_idx].ctx;
+		if(!ctx || !ctx->commands || !ctx->on_cmd) continue;
+
+		for(const char** cmd_list = ctx->commands; *cmd_list; ++cmd_list){
+			const char *cmd = *cmd_list, *cmd_end;
+
+			do {
+				cmd_end = strchrnul(cmd, ' ');
+				const size_t sz = cmd_end - cmd;
+
+				if(sz){
+					CmdTarget t = {
+						.hash    = inso_hash_nocase(cmd, sz),
+						.len     = sz,
+						.name    = cmd,
+						.mod_idx = mod_idx,
+						.cmd_idx = cmd_list - ctx->commands,
+					};
+					sb_push(cmd_targets, t);
+
+					uint8_t c = tolower((uint8_t)*cmd);
+					cmd_first_chars[c / 8] |= (1 << (c % 8));
+				}
+
+				while(*cmd_end == ' ') ++cmd_end;
+				cmd = cmd_end;
+			} while(*cmd_end);
+		}
+	}
+
+	qsort(cmd_targets, sb_count(cmd_targets), sizeof(CmdTarget), &util_cmd_target_sort);
+
+	inso_ht_init(&cmd_index, INSO_MAX(sb_count(cmd_targets) * 2, (size_t)64), sizeof(CmdAlias), &util_cmd_alias_hash);
+
+	// the same alias twice in one cmd should still only call it once, so drop duplicates.
+	size_t out = 0;
+	for(size_t i = 0; i < sb_count(cmd_targets); ++i){
+		if(out && util_cmd_target_sort(cmd_targets + i, cmd_targets + out - 1) == 0) continue;
+		cmd_targets[out++] = cmd_targets[i];
+	}
+	stb__sbn(cmd_targets) = out;
+
+	// one entry per alias, pointing to the run of sorted targets that share it.
+	for(size_t i = 0; i < out; ){
+		CmdAlias alias = {
+			.hash    = cmd_targets[i].hash,
+			.len     = cmd_targets[i].len,
+			.name    = cmd_targets[i].name,
+			.targets = cmd_targets + i,
+		};
+
+		while(i < out && util_cmd_alias_cmp(&alias, &(CmdAlias){ .len = cmd_targets[i].len, .name = cmd_targets[i].name })){
+			++alias.count;
+			++i;
+		}
+
+		inso_ht_put(&cmd_index, &alias);
+	}
+
+	// finish any incremental rehashing now, so lookups never move entries around.
+	while(inso_ht_tick(&cmd_index));
+}
+
+static bool util_cmd_lookup(const char* msg, CmdAlias* out){
+	uint8_t c = tolower((uint8_t)*msg);
+	if(!cmd_index.memory || !(cmd_first_chars[c / 8] & (1 << (c % 8)))){
+		return false;
+	}
+
+	CmdAlias key = {
+		.name = msg,
+		.len  = strchrnul(msg, ' ') - msg,
+	};
+
+	CmdAlias* alias = inso_ht_get(&cmd_index, inso_hash_nocase(key.name, key.len), &util_cmd_alias_cmp, &key);
+	if(alias){
+		*out = *alias;
+	}
+
+	return alias;
 }
 
 static bool util_split_msg(char* dest, size_t dest_len, const char** src, size_t* src_len){
@@ -393,1285 +1000,4613 @@ static bool util_split_msg(char* dest, size_t dest_len, const char** src, size_t
 	return true;
 }
 
-static void util_process_pending_cmds(void){
+static int64_t util_ms_now(void){
 	struct timespec ts = {};
 	clock_gettime(CLOCK_MONOTONIC, &ts);
-	uint32_t cmd_ms = (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+	return (ts.tv_sec * INT64_C(1000)) + (ts.tv_nsec / 1000000);
+}
 
-	while(sb_count(cmd_queue) > 0 && (cmd_ms - prev_cmd_ms) > CMD_RATE_LIMIT_MS){
-		bool update_ms = true;
+static bool util_epoll_ctl(int op, int fd, int type, uint32_t events){
+	struct epoll_event ev = {
+		.events   = events,
+		.data.u64 = ((uint64_t)type << 32) | (uint32_t)fd,
+	};
 
-		IRCCmd cmd = cmd_queue[0];
-		switch(cmd.cmd){
+	if(epoll_ctl(epoll_fd, op, fd, &ev) == -1){
+		if(op != EPOLL_CTL_DEL){
+			fprintf(stderr, "epoll_ctl(%d, %d): %s\n", op, fd, strerror(errno));
+		}
+		return false;
+	}
 
-			case IRC_CMD_JOIN: {
-				irc_cmd_join(irc_ctx, cmd.chan, cmd.data);
-//				irc_on_join(irc_ctx, "join", cmd.data, (const char**)&cmd.chan, 1);
-			} break;
+	return true;
+}
 
-			case IRC_CMD_PART: {
-				irc_cmd_part(irc_ctx, cmd.chan);
-//				irc_on_part(irc_ctx, "part", cmd.data, (const char**)&cmd.chan, 1);
-			} break;
+// output scheduling.
+// each target (channel / PM nick) has its own queue & rate limit, plus there's one per connection for raw commands
+// that's only held back by the limit for the whole connection. Within a queue, moderation commands go first.
+// JOIN / PART skip the queues, they're kept per connection and sent packed into as few lines as possible.
+// the limits are token buckets stored as the time they'll next be full (GCRA), see the CMD_* values in config.h.
 
-			case IRC_CMD_MSG: {
-				size_t len = strlen(cmd.data);
-				IRC_MOD_CALL_ALL_ABI(on_filter, (cmd.id, cmd.chan, cmd.data, len), ABI_FILTER);
-				if(!*cmd.data){
-					update_ms = false;
-					break;
-				}
+static int64_t util_bucket_ready_ms(int64_t tat, int interval, int burst){
+	return tat - (int64_t)(burst - 1) * interval;
+}
 
-			} // fall-thru
+static void util_bucket_take(int64_t* tat, int interval, int64_t now){
+	*tat = INSO_MAX(*tat, now) + interval;
+}
 
-			case IRC_CMD_MSG_SPLIT: {
-				char tmp[512];
+// the connection-wide limit, moderator channels have a bigger allowance that everything else also counts towards.
+static int64_t util_conn_ready_ms(const IRCConn* c, bool is_mod){
+	if(!c->limited){
+		return 0;
+	}
 
-				const int max_msg_len = INSO_MAX(32, 512 - (int)(sizeof("PRIVMSG :\r\n  ") + strlen(cmd.chan) + bot_host_len));
-				const char* src = cmd.data;
-				size_t src_len = strlen(cmd.data);
+	int64_t ready = util_bucket_ready_ms(c->mod_tat, CMD_GLOBAL_MOD_RATE_LIMIT_MS, CMD_GLOBAL_MOD_RATE_BURST);
+	if(!is_mod){
+		ready = INSO_MAX(ready, util_bucket_ready_ms(c->tat, CMD_GLOBAL_RATE_LIMIT_MS, CMD_GLOBAL_RATE_BURST));
+	}
 
-				if(util_split_msg(tmp, max_msg_len, &src, &src_len)){
-					util_cmd_enqueue_id(IRC_CMD_MSG_SPLIT, cmd.id, cmd.chan, src);
-				}
+	return ready;
+}
 
-				printf("send: [%s] [%s]\n", cmd.chan, tmp);
-				irc_cmd_msg(irc_ctx, cmd.chan, tmp);
-				IRC_MOD_CALL_ALL(on_msg_out, (cmd.chan, tmp));
+static void util_conn_take(IRCConn* c, bool is_mod, int64_t now){
+	if(!c->limited) return;
 
-			} break;
+	util_bucket_take(&c->mod_tat, CMD_GLOBAL_MOD_RATE_LIMIT_MS, now);
+	if(!is_mod){
+		util_bucket_take(&c->tat, CMD_GLOBAL_RATE_LIMIT_MS, now);
+	}
+}
 
-			case IRC_CMD_RAW: {
-				size_t len = strlen(cmd.data);
-				IRC_MOD_CALL_ALL_ABI(on_filter, (cmd.id, NULL, cmd.data, len), ABI_FILTER);
-				if(*cmd.data){
-					irc_send_raw(irc_ctx, "%s", cmd.data);
-				} else {
-					update_ms = false;
-				}
-			} break;
-		}
+static size_t util_cmd_queue_hash(const void* arg){
+	return ((const CmdQueueKey*)arg)->hash;
+}
 
-		if(update_ms) {
-			prev_cmd_ms = cmd_ms;
-		}
+static bool util_cmd_queue_cmp(const void* elem, void* param){
+	return strcasecmp(((const CmdQueueKey*)elem)->queue->chan, param) == 0;
+}
 
-		if(cmd.chan) free(cmd.chan);
-		if(cmd.data) free(cmd.data);
-		sb_erase(cmd_queue, 0);
-	}
+static bool util_cmd_queue_is(const void* elem, void* param){
+	return ((const CmdQueueKey*)elem)->queue == param;
 }
 
-static void util_module_add(const char* name){
-	char path_buf[PATH_MAX];
-	const char* path = name;
+static void util_cmd_queues_init(void){
+	inso_ht_init(&cmd_queue_index, 64, sizeof(CmdQueueKey), &util_cmd_queue_hash);
 
-	if(!strchr(path, '/')){
-		if(snprintf(path_buf, PATH_MAX, "%s%s", inotify.module.path, name) >= PATH_MAX) return;
-		path = path_buf;
+	// the queues for commands not aimed at a channel come first, one per connection.
+	for(size_t i = 0; i < INSO_MAX(sb_count(irc_conns), 1u); ++i){
+		CmdQueue* q = calloc(1, sizeof(*q));
+		assert(q);
+		q->conn = i;
+		sb_push(cmd_queues, q);
 	}
+}
 
-	if(util_module_filter_allowed(path)){
-		Module m = {
-			.lib_path = strdup(path),
-			.needs_reload = true
-		};
+static Channel*    util_chan_find(const char* name);
+static IRCConn*    util_conn_get(int id);
 
-		sb_push(irc_modules, m);
-	} else {
-		printf("NOTE: Loading module '%s' cancelled due to filter.\n", basename(path));
+static void util_conn_clear_joins(IRCConn* c){
+	sb_each(cmd, c->joins){
+		free(cmd->chan);
+		free(cmd->data);
 	}
+	cmds_queued -= sb_count(c->joins);
+	sb_free(c->joins);
 }
 
-static bool util_inotify_check(void);
-
-static void util_module_save(Module* m){
-	if(!m->ctx || !m->ctx->on_save) return;
+static CmdQueue* util_cmd_queue_get(const char* chan, bool create){
+	if(!chan){
+		return cmd_queues[0];
+	}
 
-	sb_push(mod_call_stack, m);
+	uint32_t hash = inso_hash_nocase(chan, 0);
 
-	const char*  save_fname = core_get_datafile();
-	const size_t save_fsz   = strlen(save_fname);
-	const char   tmp_end[]  = ".XXXXXX";
-	char*        tmp_fname  = alloca(save_fsz + sizeof(tmp_end));
+	CmdQueueKey* key = inso_ht_get(&cmd_queue_index, hash, &util_cmd_queue_cmp, (void*)chan);
+	if(key){
+		return key->queue;
+	}
 
-	memcpy(tmp_fname, save_fname, save_fsz);
-	memcpy(tmp_fname + save_fsz, tmp_end, sizeof(tmp_end));
+	if(!create){
+		return NULL;
+	}
 
-	// lock the file for writing, then check for modification when we have the lock.
-	int orig_file = open(save_fname, O_RDONLY, 0644);
-	if(orig_file != -1) {
-		flock(orig_file, LOCK_EX);
+	CmdQueue* q = calloc(1, sizeof(*q));
+	assert(q);
+	q->chan = strdup(chan);
 
-		// don't check return value for full reload here
-		util_inotify_check();
+	sb_push(cmd_queues, q);
+	inso_ht_put(&cmd_queue_index, &(CmdQueueKey){ hash, q });
 
-		close(orig_file);
-	}
+	return q;
+}
 
-	// change the inotify data watch to something we don't care about to disable it temporarily
-	inotify.data.wd = inotify_add_watch(inotify.fd, inotify.data.path, IN_DELETE_SELF);
+// frees the queues of PM nicks & channels we're not in once they're empty and their rate limit has run out,
+// so they don't pile up & slow down util_cmd_queue_next. The per-connection ones at the start are kept.
+static void util_cmd_queues_gc(int64_t now){
+	for(size_t i = sb_count(cmd_queues); i-- > 0;){
+		CmdQueue* q = cmd_queues[i];
 
-	int tmp_fd = mkstemp(tmp_fname);
-	if(tmp_fd < 0){
-		fprintf(stderr, "Error saving file for %s: %s\n", m->ctx->name, strerror(errno));
-	} else {
+		if(!q->chan || q->lanes[CMD_LANE_PRIO].count || q->lanes[CMD_LANE_NORMAL].count) continue;
+		if(q->tat > now || util_chan_find(q->chan)) continue;
 
-		FILE* tmp_file = fdopen(tmp_fd, "wb");
-		bool saved = m->ctx->on_save(tmp_file);
-		fclose(tmp_file);
+		inso_ht_del(&cmd_queue_index, inso_hash_nocase(q->chan, 0), &util_cmd_queue_is, q);
+		sb_erase(cmd_queues, i);
+		free(q->chan);
+		free(q);
+	}
+}
 
-		if(saved && rename(tmp_fname, save_fname) < 0){
-			fprintf(stderr, "Error saving file for %s: %s\n", m->ctx->name, strerror(errno));
-		} else if(!saved){
-			unlink(tmp_fname);
+static void util_cmd_queues_free(void){
+	sb_each(q, cmd_queues){
+		for(int l = 0; l < CMD_LANE_COUNT; ++l){
+			CmdRing* r = (*q)->lanes + l;
+			for(uint32_t i = 0; i < r->count; ++i){
+				IRCCmd* c = r->cmds + ((r->head + i) % CMD_QUEUE_MAX);
+				free(c->chan);
+				free(c->data);
+			}
 		}
-
-		// allow other users to read the data files (e.g. CGI command list)
-		chmod(save_fname, 0644);
+		free((*q)->chan);
+		free(*q);
 	}
+	sb_free(cmd_queues);
+	inso_ht_free(&cmd_queue_index);
 
-	sb_pop(mod_call_stack);
-
-	inotify.data.wd = inotify_add_watch(inotify.fd, inotify.data.path, IN_CLOSE_WRITE | IN_MOVED_TO);
+	sb_each(c, irc_conns){
+		util_conn_clear_joins(c);
+	}
 }
 
-static Module* util_module_get(const char* name, int type){
-	sb_each(m, irc_modules){
-		const char* base_path = basename(m->lib_path);
+static int util_cmd_lane(int cmd, const char* data){
+	static const char* prio_msgs[] = { ".timeout ", ".ban ", ".unban ", ".delete ", ".clear", "/timeout ", "/ban " };
+	static const char* prio_raws[] = { "KICK ", "MODE " };
 
-		if(type == MOD_GET_CTXNAME && !m->ctx){ // can happen inside inotify loop
-			continue;
+	if(cmd == IRC_CMD_MSG && data){
+		for(size_t i = 0; i < ARRAY_SIZE(prio_msgs); ++i){
+			if(strncmp(data, prio_msgs[i], strlen(prio_msgs[i])) == 0) return CMD_LANE_PRIO;
 		}
+	} else if(cmd == IRC_CMD_RAW && data){
+		for(size_t i = 0; i < ARRAY_SIZE(prio_raws); ++i){
+			if(strncasecmp(data, prio_raws[i], strlen(prio_raws[i])) == 0) return CMD_LANE_PRIO;
+		}
+	}
 
-		const char* comparison
-			= (type == MOD_GET_CTXNAME)	? m->ctx->name
-			: (type == MOD_GET_SONAME)  ? base_path
-			: NULL;
+	return CMD_LANE_NORMAL;
+}
 
-		if(strcmp(name, comparison) == 0){
-			return m;
+// lane is -1 to pick one from the command, the rest of a split message passes the lane the message came from.
+static bool util_cmd_enqueue_id(int cmd, size_t id, const char* chan, const char* data, int lane){
+	// things for a channel go out on the connection that's in it, anything else on the one we're handling.
+	Channel* ch = chan ? util_chan_find(chan) : NULL;
+	int conn = (ch && ch->conn != -1) ? ch->conn : irc_cur ? irc_cur->id : 0;
+
+	// JOIN / PART have a chan but aren't sent to it, so aren't limited by it. They aren't dropped either.
+	if(cmd == IRC_CMD_JOIN || cmd == IRC_CMD_PART){
+		IRCConn* c = util_conn_get(conn);
+
+		// RFC 1459 limits channel names to 200 chars, longer ones wouldn't fit in a JOIN line.
+		if(!c || strlen(chan) > 200) return false;
+
+		// only the last pending one for the channel matters, JOIN PART JOIN must still end up joined.
+		for(size_t i = sb_count(c->joins); i-- > 0;){
+			if(strcasecmp(c->joins[i].chan, chan) == 0){
+				if(c->joins[i].cmd == cmd) return true;
+				break;
+			}
 		}
+
+		IRCCmd j = { .id = id, .cmd = cmd, .conn = conn, .chan = strdup(chan), .data = data ? strdup(data) : NULL };
+		sb_push(c->joins, j);
+		++cmds_queued;
+
+		return true;
 	}
-	return NULL;
+
+	const char* target = (cmd == IRC_CMD_MSG || cmd == IRC_CMD_MSG_SPLIT) ? chan : NULL;
+	CmdQueue* q = target ? util_cmd_queue_get(target, true) : cmd_queues[conn];
+	CmdRing* r = q->lanes + (lane == -1 ? util_cmd_lane(cmd, data) : lane);
+
+	if(r->count >= CMD_QUEUE_MAX){
+		++q->dropped;
+		++cmds_dropped;
+		return false;
+	}
+
+	IRCCmd c = {
+		.id   = id,
+		.cmd  = cmd,
+		.conn = conn,
+		.chan = chan ? strdup(chan) : NULL,
+		.data = data ? strdup(data) : NULL
+	};
+
+	// the rest of a split message goes in front, so it stays together.
+	if(cmd == IRC_CMD_MSG_SPLIT){
+		r->head = (r->head + CMD_QUEUE_MAX - 1) % CMD_QUEUE_MAX;
+		r->cmds[r->head] = c;
+	} else {
+		r->cmds[(r->head + r->count) % CMD_QUEUE_MAX] = c;
+	}
+	++r->count;
+	++cmds_queued;
+
+	return true;
 }
 
-static int util_mod_sort(const void* a, const void* b){
-	return ((Module*)b)->ctx->priority - ((Module*)a)->ctx->priority;
+static size_t util_cmd_enqueue(int cmd, const char* chan, const char* data){
+	size_t id = next_cmd_id++;
+	return util_cmd_enqueue_id(cmd, id, chan, data, -1) ? id : 0;
 }
 
-static void util_reload_modules(void){
+static int util_cmd_queue_interval(const CmdQueue* q){
+	return q->is_mod ? CMD_MOD_RATE_LIMIT_MS : CMD_RATE_LIMIT_MS;
+}
 
-	sb_each(m, irc_modules){
-		if(!m->needs_reload) continue;
+static int util_cmd_queue_burst(const CmdQueue* q){
+	return q->is_mod ? CMD_MOD_RATE_BURST : CMD_RATE_BURST;
+}
 
-		const char* mod_name = basename(m->lib_path);
+// when q can next send something, or -1 if it has nothing it can send
+static int64_t util_cmd_queue_ready_ms(const CmdQueue* q){
+	const CmdRing* r = q->lanes + (q->lanes[CMD_LANE_PRIO].count ? CMD_LANE_PRIO : CMD_LANE_NORMAL);
+	if(!r->count){
+		return -1;
+	}
 
-		if(m->lib_handle){
-			util_module_save(m);
-			IRC_MOD_CALL(m, on_quit, ());
-			dlclose(m->lib_handle);
-		}
+	// it waits until the connection it's for is up, and is limited by that connection's bucket too.
+	const IRCConn* c = util_conn_get(r->cmds[r->head].conn);
+	if(!c || !c->registered){
+		return -1;
+	}
 
-		if(!util_module_filter_allowed(mod_name)){
-			printf("Module '%s' is now filtered. Unloading.\n", mod_name);
-			free(m->lib_path);
-			sb_erase(irc_modules, m - irc_modules);
-			--m;
-			continue;
-		}
+	int64_t ready = util_conn_ready_ms(c, q->is_mod);
 
-		dlerror();
-		m->lib_handle = dlopen(m->lib_path, RTLD_LAZY | RTLD_LOCAL);
+	if(q->chan){
+		ready = INSO_MAX(ready, util_bucket_ready_ms(q->tat, util_cmd_queue_interval(q), util_cmd_queue_burst(q)));
+	}
 
-		printf("Loading module %-20s", mod_name);
+	return ready;
+}
 
-		const char* errmsg = dlerror();
-		if(!errmsg && m->lib_handle){
-			m->ctx = dlsym(m->lib_handle, "irc_mod_ctx");
-			errmsg = dlerror();
-		} else if(!errmsg && !m->lib_handle){
-			errmsg = "NULL lib handle.";
-		}
+// picks the next queue to send from: any ready queue with a moderation command, else the next ready one after
+// the queue that last sent, so one busy channel can't starve the rest.
+static CmdQueue* util_cmd_queue_next(int64_t now, int* lane, size_t* idx){
+	const size_t n = sb_count(cmd_queues);
+	CmdQueue* normal = NULL;
 
-		if(!errmsg){
-			const ElfW(Sym)* sym = NULL;
-			Dl_info unused;
-			if(dladdr1(m->ctx, &unused, (void**)&sym, RTLD_DL_SYMENT) == 0){
-				errmsg = "dladdr1 failed.";
-			} else if(sym->st_size < (sizeof(void*)*23)) {
+	for(size_t i = 0; i < n; ++i){
+		size_t j = (cmd_queue_cursor + i) % n;
+		CmdQueue* q = cmd_queues[j];
 
-				// NOTE: ABI Table for IRCModuleCtx:
-				//
-				//       | sizeof(void*) | last field |
-				//       +---------------+------------+
-				//       |      x23      | on_ipc     |
-				//       |      x24      | on_filter  |
-				//       |      x25      | on_unknown |
-				//       |      x27      | help_url   |
+		int64_t ready = util_cmd_queue_ready_ms(q);
+		if(ready == -1 || ready > now) continue;
 
-				errmsg = "version mismatch (wrong size irc_mod_ctx)";
-			} else {
-				m->ctx_size = sym->st_size;
-			}
+		if(q->lanes[CMD_LANE_PRIO].count){
+			*lane = CMD_LANE_PRIO;
+			*idx = j;
+			return q;
 		}
 
-		if(errmsg){
-			puts("");
-			fprintf(stderr, "** Error loading module %s:\n  %s\n", mod_name, errmsg);
-			if(m->lib_handle){
-				dlclose(m->lib_handle);
-				m->lib_handle = NULL;
-			}
-			free(m->lib_path);
-			sb_erase(irc_modules, m - irc_modules);
-			--m;
-		} else {
-			struct link_map* mod_info = m->lib_handle;
-			printf("[0x%zx]\n", (size_t)mod_info->l_addr);
+		if(!normal){
+			normal = q;
+			*idx = j;
 		}
 	}
 
-	qsort(irc_modules, sb_count(irc_modules), sizeof(*irc_modules), &util_mod_sort);
+	*lane = CMD_LANE_NORMAL;
+	return normal;
+}
 
-	sb_each(m, irc_modules){
-		if(!m->needs_reload) continue;
-		m->needs_reload = false;
+// when c can next send a JOIN / PART line, or -1 if it has none it can send
+static int64_t util_conn_joins_ready_ms(const IRCConn* c){
+	if(!sb_count(c->joins) || !c->registered){
+		return -1;
+	}
 
-		const char* mod_name = basename(m->lib_path);
-		printf("Init %s...\n", mod_name);
+	return INSO_MAX(
+		util_conn_ready_ms(c, false),
+		util_bucket_ready_ms(c->join_tat, CMD_JOIN_RATE_LIMIT_MS, CMD_JOIN_RATE_BURST)
+	);
+}
 
-		if(!IRC_MOD_CALL(m, on_init, (&core_ctx))){
-			printf("** Init failed for %s.\n", mod_name);
-			dlclose(m->lib_handle);
-			m->lib_handle = NULL;
-			free(m->lib_path);
-			sb_erase(irc_modules, m - irc_modules);
-			--m;
-			continue;
+// sends c's waiting JOIN / PARTs as "JOIN #a,#b,#c" lines, as many channels per line as fit & the join bucket has
+// tokens for. Consecutive ones of the same kind are packed together, so they're still sent in order.
+static void util_conn_send_joins(IRCConn* c, int64_t now){
+	int64_t ready;
+
+	while((ready = util_conn_joins_ready_ms(c)) != -1 && ready <= now){
+		const int cmd = c->joins[0].cmd;
+		const char* verb = cmd == IRC_CMD_JOIN ? "JOIN" : "PART";
+
+		char line[512];
+		size_t len = 0;
+		size_t n = 0;
+
+		// channel keys go after the list & would need to line up with it, so those are sent alone.
+		if(c->joins[0].data){
+			snprintf(line, sizeof(line), "%s %s", c->joins[0].chan, c->joins[0].data);
+			util_bucket_take(&c->join_tat, CMD_JOIN_RATE_LIMIT_MS, now);
+			n = 1;
 		}
 
-		if(irc_ctx && irc_is_connected(irc_ctx)){
-			IRC_MOD_CALL(m, on_connect, (serv));
+		for(; n < sb_count(c->joins) && !c->joins[0].data; ++n){
+			const IRCCmd* j = c->joins + n;
+			size_t chan_len = strlen(j->chan);
+
+			if(j->cmd != cmd || j->data) break;
+			if(len + chan_len + 1 > sizeof(line) - sizeof("JOIN \r\n")) break;
+			if(n && util_bucket_ready_ms(c->join_tat, CMD_JOIN_RATE_LIMIT_MS, CMD_JOIN_RATE_BURST) > now) break;
+
+			if(len) line[len++] = ',';
+			memcpy(line + len, j->chan, chan_len + 1);
+			len += chan_len;
+
+			util_bucket_take(&c->join_tat, CMD_JOIN_RATE_LIMIT_MS, now);
 		}
 
-		for(size_t i = 0; i < sb_count(channels) - 1; ++i){
-			const char** c = (const char**)channels + i;
+		printf("send: [%s %s]\n", verb, line);
+		irc_send_raw(c->session, "%s %s", verb, line);
+		util_conn_take(c, false, now);
 
-			IRC_MOD_CALL(m, on_join, (*c, bot_nick));
-			for(size_t j = 0; j < sb_count(chan_nicks[i]); ++j){
-				IRC_MOD_CALL(m, on_join, (*c, chan_nicks[i][j]));
-			}
+		for(size_t i = 0; i < n; ++i){
+			free(c->joins[i].chan);
+			free(c->joins[i].data);
 		}
+		memmove(c->joins, c->joins + n, (sb_count(c->joins) - n) * sizeof(*c->joins));
+		stb__sbn(c->joins) -= n;
+		cmds_queued -= n;
 	}
 }
 
-static void util_inotify_add(INotifyWatch* watch, const char* path, uint32_t flags){
+// when util_process_pending_cmds will next have something to send, or -1 if nothing is queued
+static int64_t util_cmd_next_ms(void){
+	int64_t next = -1;
 
-	if(access(path, W_OK) != 0){
-		printf("Creating dir [%s] for inotify.\n", path);
-		if(mkdir(path, 00750) == -1){
-			perror("Error creating dir");
+	sb_each(q, cmd_queues){
+		int64_t t = util_cmd_queue_ready_ms(*q);
+		if(t != -1 && (next == -1 || t < next)){
+			next = t;
 		}
 	}
 
-	watch->path = strdup(path);
-	watch->wd   = inotify_add_watch(inotify.fd, path, flags);
+	sb_each(c, irc_conns){
+		int64_t t = util_conn_joins_ready_ms(c);
+		if(t != -1 && (next == -1 || t < next)){
+			next = t;
+		}
+	}
+
+	return next;
 }
 
-static bool util_inotify_check(void){
-	struct inotify_event* ev;
-	char buff[sizeof(*ev) + NAME_MAX + 1];
-	bool reload = false;
-	bool updated_filter = false;
+static void util_cmd_set_mod(const char* chan, bool is_mod){
+	CmdQueue* q = util_cmd_queue_get(chan, true);
 
-	ssize_t num_read;
-	while((num_read = read(inotify.fd, buff, sizeof(buff))) > 0){
-		for(char* p = buff; (p - buff) < num_read; p += (sizeof(*ev) + ev->len)){
-			ev = (struct inotify_event*)p;
+	if(q->is_mod != is_mod){
+		printf("Using %s rate limit for %s\n", is_mod ? "moderator" : "normal", chan);
+		q->is_mod = is_mod;
+	}
+}
 
-			if(ev->wd == inotify.module.wd){
-				if(!updated_filter){
-					updated_filter = true;
-					util_module_filter_update();
+static int util_max_msg_len(const char* chan){
+	return INSO_MAX(32, 512 - (int)(sizeof("PRIVMSG :\r\n  ") + strlen(chan) + bot_host_len));
+}
+
+#ifdef CMD_COALESCE_SEP
+
+// twitch commands like .timeout / /w have to be sent as they are
+static bool util_cmd_is_command(const char* msg){
+	return *msg == '.' || *msg == '/';
+}
+
+// appends the plain messages following cmd in its queue to cmd's text, while it still fits in one line.
+// on_filter is run on each of them with their own id first, so modules see them as they would without this.
+static void util_cmd_coalesce(CmdRing* r, IRCCmd* cmd){
+	const size_t max_len = util_max_msg_len(cmd->chan);
+	const size_t sep_len = strlen(CMD_COALESCE_SEP);
+	size_t len = strlen(cmd->data);
+
+	if(util_cmd_is_command(cmd->data)) return;
+
+	while(r->count){
+		IRCCmd* next = r->cmds + r->head;
+		if(next->cmd != IRC_CMD_MSG || util_cmd_is_command(next->data)) break;
+
+		if(!next->filtered){
+			IRC_MOD_CALL_ALL_ABI(on_filter, (next->id, next->chan, next->data, strlen(next->data)), ABI_FILTER);
+			next->filtered = true;
+		}
+
+		size_t next_len = strlen(next->data);
+
+		if(next_len){
+			if(len + sep_len + next_len >= max_len) break;
+
+			cmd->data = realloc(cmd->data, len + sep_len + next_len + 1);
+			assert(cmd->data);
+
+			memcpy(cmd->data + len, CMD_COALESCE_SEP, sep_len);
+			memcpy(cmd->data + len + sep_len, next->data, next_len + 1);
+			len += sep_len + next_len;
+		}
+
+		free(next->chan);
+		free(next->data);
+		r->head = (r->head + 1) % CMD_QUEUE_MAX;
+		--r->count;
+		--cmds_queued;
+	}
+}
+
+#endif
+
+static void util_process_pending_cmds(void){
+	int64_t now = util_ms_now();
+	CmdQueue* q;
+	size_t idx;
+	int lane;
+
+	// joins first, nothing else can happen in a channel until we're in it.
+	sb_each(c, irc_conns){
+		util_conn_send_joins(c, now);
+	}
+
+	while((q = util_cmd_queue_next(now, &lane, &idx))){
+		bool update_ms = true;
+
+		CmdRing* r = q->lanes + lane;
+		IRCCmd cmd = r->cmds[r->head];
+		r->head = (r->head + 1) % CMD_QUEUE_MAX;
+		--r->count;
+		--cmds_queued;
+
+		IRCConn* conn = util_conn_get(cmd.conn);
+
+		util_trace_set_chan(cmd.chan ? util_chan_find(cmd.chan) : NULL);
+
+		switch(cmd.cmd){
+
+			case IRC_CMD_MSG: {
+				if(!cmd.filtered){
+					size_t len = strlen(cmd.data);
+					IRC_MOD_CALL_ALL_ABI(on_filter, (cmd.id, cmd.chan, cmd.data, len), ABI_FILTER);
 				}
 
-				Module* m = util_module_get(ev->name, MOD_GET_SONAME);
-				if(m){
-					m->needs_reload = true;
-				} else {
-					util_module_add(ev->name);
-					// XXX: Careful, this leaves some parts of the new irc_module null
-					//      if util_module_get is called later in the loop, it must check this
+				if(!*cmd.data){
+					update_ms = false;
+					break;
 				}
-				reload = true;
-			} else if(ev->wd == inotify.data.wd){
-				if(!memmem(ev->name, ev->len, ".data", 6)) continue;
-				fprintf(stderr, "%s was modified. %x\n", ev->name, ev->mask);
 
-				Module* m = util_module_get(strndupa(ev->name, strlen(ev->name) - 5), MOD_GET_CTXNAME);
-				if(m){
-					m->data_modified = true;
+#ifdef CMD_COALESCE_SEP
+				if(lane == CMD_LANE_NORMAL){
+					util_cmd_coalesce(r, &cmd);
 				}
-			} else if(ev->wd == inotify.ipc.wd){
-				struct sockaddr_un addr;
+#endif
+			} // fall-thru
 
-				assert(strlen(ev->name) + strlen(inotify.ipc.path) + 1 < sizeof(addr.sun_path));
+			case IRC_CMD_MSG_SPLIT: {
+				char tmp[512];
 
-				strcpy(addr.sun_path, inotify.ipc.path);
-				strcat(addr.sun_path, ev->name);
+				const int max_msg_len = util_max_msg_len(cmd.chan);
+				const char* src = cmd.data;
+				size_t src_len = strlen(cmd.data);
 
-				if(ev->mask & IN_DELETE){
-					util_ipc_del(addr.sun_path);
+				if(util_split_msg(tmp, max_msg_len, &src, &src_len)){
+					util_cmd_enqueue_id(IRC_CMD_MSG_SPLIT, cmd.id, cmd.chan, src, lane);
+				}
+
+				printf("send: [%s] [%s]\n", cmd.chan, tmp);
+				irc_cmd_msg(conn->session, cmd.chan, tmp);
+				IRC_MOD_CALL_ALL(on_msg_out, (cmd.chan, tmp));
+
+			} break;
+
+			case IRC_CMD_RAW: {
+				size_t len = strlen(cmd.data);
+				IRC_MOD_CALL_ALL_ABI(on_filter, (cmd.id, NULL, cmd.data, len), ABI_FILTER);
+				if(*cmd.data){
+					irc_send_raw(conn->session, "%s", cmd.data);
 				} else {
-					util_ipc_add(addr.sun_path);
+					update_ms = false;
 				}
+			} break;
+		}
+
+		if(update_ms) {
+			util_conn_take(conn, q->is_mod, now);
+			if(q->chan){
+				util_bucket_take(&q->tat, util_cmd_queue_interval(q), now);
 			}
+			cmd_queue_cursor = idx + 1;
 		}
+
+		if(cmd.chan) free(cmd.chan);
+		if(cmd.data) free(cmd.data);
 	}
 
-	sb_each(m, irc_modules){
-		if(!m->data_modified) continue;
-		m->data_modified = false;
+	util_cmd_queues_gc(now);
+}
 
-		if(m->needs_reload) {
-			reload = true;
+static void* util_async_thread(void* arg){
+	AsyncJob** slot = arg;
+
+	pthread_mutex_lock(&async_pool.lock);
+
+	for(;;){
+		while(!async_pool.todo_head && !async_pool.quit){
+			pthread_cond_wait(&async_pool.todo_cond, &async_pool.lock);
 		}
 
-		fprintf(stderr, "Calling on_data_modified for %s\n", m->ctx->name);
-		IRC_MOD_CALL(m, on_modified, ());
-	}
+		if(async_pool.quit) break;
 
-	return reload;
-}
+		AsyncJob* job = async_pool.todo_head;
+		if(!(async_pool.todo_head = job->next)){
+			async_pool.todo_tail = NULL;
+		}
+		*slot = job;
 
-static void util_ipc_init(void){
-	char ipc_dir[100];
-	struct stat st;
+		pthread_mutex_unlock(&async_pool.lock);
+		job->work(job->arg);
+		pthread_mutex_lock(&async_pool.lock);
 
-	// get dir to store ipc sockets
+		*slot = NULL;
+		job->next = NULL;
 
-	const char* ipc_dir_prefix   = getenv("XDG_RUNTIME_DIR");
-	const char  ipc_dir_suffix[] = "/insobot/";
+		if(async_pool.done_tail){
+			async_pool.done_tail->next = job;
+		} else {
+			async_pool.done_head = job;
+		}
+		async_pool.done_tail = job;
 
-	if(!ipc_dir_prefix || stat(ipc_dir_prefix, &st) == -1 || !S_ISDIR(st.st_mode) || access(ipc_dir_prefix, W_OK) == -1){
-		ipc_dir_prefix = "/run/shm";
+		pthread_cond_broadcast(&async_pool.done_cond);
+		eventfd_write(async_pool.wake_fd, 1);
 	}
 
-	if(strlen(ipc_dir_prefix) + sizeof(ipc_dir_suffix) + 8 > sizeof(ipc_self.addr.sun_path)){
-		fprintf(stderr, "IPC dir name too long!");
+	pthread_mutex_unlock(&async_pool.lock);
+	return NULL;
+}
+
+static void util_async_init(void){
+	async_pool.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(async_pool.wake_fd == -1){
+		perror("async_init: eventfd");
 		return;
 	}
 
-	strcpy(ipc_dir, ipc_dir_prefix);
-	strcat(ipc_dir, ipc_dir_suffix);
+	// block signals in the workers, so they always get delivered to the main thread.
+	sigset_t all, prev;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &prev);
 
-	if(stat(ipc_dir, &st) == -1){
-		if(mkdir(ipc_dir, 0777) == -1){
-			perror("ipc_init: mkdir");
+	for(int i = 0; i < ASYNC_NUM_THREADS; ++i){
+		int n = async_pool.num_threads;
+		int err = pthread_create(async_pool.threads + n, NULL, &util_async_thread, async_pool.running + n);
+
+		if(err){
+			fprintf(stderr, "async_init: pthread_create: %s\n", strerror(err));
+		} else {
+			++async_pool.num_threads;
 		}
 	}
 
-	// create our socket
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
 
-	ipc_self.id = getpid();
-	ipc_self.addr.sun_family = AF_UNIX;
+	printf("Started %d async worker threads.\n", async_pool.num_threads);
+}
 
-	snprintf(ipc_self.addr.sun_path, sizeof(ipc_self.addr.sun_path), "%s%d", ipc_dir, ipc_self.id);
-	unlink(ipc_self.addr.sun_path);
+static void util_async_quit(void){
+	pthread_mutex_lock(&async_pool.lock);
+	async_pool.quit = true;
+	pthread_cond_broadcast(&async_pool.todo_cond);
+	pthread_mutex_unlock(&async_pool.lock);
 
-	printf("IPC socket: %s\n", ipc_self.addr.sun_path);
+	for(int i = 0; i < async_pool.num_threads; ++i){
+		pthread_join(async_pool.threads[i], NULL);
+	}
 
-	ipc_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
-	if(ipc_socket == -1){
-		perror("ipc_init: socket");
+	AsyncJob* lists[] = { async_pool.todo_head, async_pool.done_head };
+	for(size_t i = 0; i < ARRAY_SIZE(lists); ++i){
+		for(AsyncJob *j = lists[i], *next; j; j = next){
+			next = j->next;
+			free(j);
+		}
 	}
 
-	if(bind(ipc_socket, &ipc_self.addr, sizeof(ipc_self.addr)) == -1){
-		perror("ipc_init: bind");
+	if(async_pool.wake_fd != -1){
+		close(async_pool.wake_fd);
 	}
+}
 
-	// get all the peer addresses in the dir
+static void util_async_call_done(AsyncJob* job){
+	if(!job->done) return;
 
-	util_inotify_add(&inotify.ipc, ipc_dir, IN_CREATE | IN_DELETE | IN_MOVED_TO);
+	if(!job->owner){
+		job->done(job->arg);
+		return;
+	}
 
-	strcat(ipc_dir, "*");
+	sb_each(m, irc_modules){
+		if(m->ctx != job->owner) continue;
 
-	glob_t glob_data;
-	if(glob(ipc_dir, 0, NULL, &glob_data) != 0){
-		perror("ipc_init: glob");
-	} else {
-		for(size_t i = 0; i < glob_data.gl_pathc; ++i){
-			if(strcmp(ipc_self.addr.sun_path, glob_data.gl_pathv[i]) == 0) continue;
+		IRC_MOD_CALL_FN(m, "async_done", job->done, (job->arg));
+		break;
+	}
+}
 
-			IPCAddress peer = {
-				.id   = atoi(basename(glob_data.gl_pathv[i])),
-				.addr = { .sun_family = AF_UNIX }
-			};
+// runs the done callbacks of finished jobs (only the ones owned by owner, if it isn't NULL).
+// returns true if any were run.
+static bool util_async_complete(const IRCModuleCtx* owner){
+	if(!owner && async_pool.wake_fd != -1){
+		eventfd_t unused;
+		eventfd_read(async_pool.wake_fd, &unused);
+	}
 
-			printf("ipc_init: adding peer %d [%s]\n", peer.id, glob_data.gl_pathv[i]);
+	AsyncJob* list = NULL;
+	AsyncJob** tail = &list;
 
-			strcpy(peer.addr.sun_path, glob_data.gl_pathv[i]);
-			sb_push(ipc_peers, peer);
+	pthread_mutex_lock(&async_pool.lock);
+
+	async_pool.done_tail = NULL;
+	for(AsyncJob** p = &async_pool.done_head; *p;){
+		AsyncJob* job = *p;
+
+		if(owner && job->owner != owner){
+			async_pool.done_tail = job;
+			p = &job->next;
+			continue;
 		}
 
-		globfree(&glob_data);
+		*p = job->next;
+		job->next = NULL;
+		*tail = job;
+		tail = &job->next;
 	}
 
-	// check for stale peers
+	pthread_mutex_unlock(&async_pool.lock);
 
-	for(IPCAddress* p = ipc_peers; p < sb_end(ipc_peers); ++p){
-		if(connect(ipc_socket, &p->addr, sizeof(p->addr)) == -1){
-			if(errno == ECONNREFUSED){
-				unlink(p->addr.sun_path);
-			}
-			sb_erase(ipc_peers, p - ipc_peers);
-			--p;
-		} else {
-			struct sockaddr sa = { .sa_family = AF_UNSPEC };
-			connect(ipc_socket, &sa, sizeof(sa));
-		}
+	bool ran = list;
+
+	while(list){
+		AsyncJob* job = list;
+		list = job->next;
+
+		util_async_call_done(job);
+		free(job);
 	}
+
+	return ran;
 }
 
-static IPCAddress* util_ipc_add(const char* name){
-	for(size_t i = 0; i < sb_count(ipc_peers); ++i){
-		if(strcmp(ipc_peers[i].addr.sun_path, name) == 0){
-			return ipc_peers + i;
-		}
+// needs async_pool.lock held.
+static bool util_async_busy(const IRCModuleCtx* owner){
+	for(AsyncJob* j = async_pool.todo_head; j; j = j->next){
+		if(j->owner == owner) return true;
 	}
 
-	IPCAddress peer = {
-		.id   = atoi(basename(name)),
-		.addr = {
-			.sun_family = AF_UNIX
-		}
-	};
+	for(int i = 0; i < async_pool.num_threads; ++i){
+		if(async_pool.running[i] && async_pool.running[i]->owner == owner) return true;
+	}
 
-	strcpy(peer.addr.sun_path, name);
-	sb_push(ipc_peers, peer);
+	return false;
+}
 
-	printf("ipc_add: %d: [%s]\n", peer.id, peer.addr.sun_path);
+// waits for a module's outstanding jobs and runs their done callbacks, so it can be safely unloaded.
+static void util_async_drain(Module* m){
+	if(!m->ctx) return;
 
-	return &sb_last(ipc_peers);
+	do {
+		pthread_mutex_lock(&async_pool.lock);
+		while(util_async_busy(m->ctx)){
+			pthread_cond_wait(&async_pool.done_cond, &async_pool.lock);
+		}
+		pthread_mutex_unlock(&async_pool.lock);
+	} while(util_async_complete(m->ctx));
 }
 
-static void util_ipc_del(const char* name){
-	for(size_t i = 0; i < sb_count(ipc_peers); ++i){
-		if(strcmp(ipc_peers[i].addr.sun_path, name) == 0){
-			sb_erase(ipc_peers, i);
-			break;
-		}
+static void util_http_share_lock(CURL* curl, curl_lock_data data, curl_lock_access access, void* userp){
+	pthread_mutex_lock(http_share_locks + data);
+}
+
+static void util_http_share_unlock(CURL* curl, curl_lock_data data, void* userp){
+	pthread_mutex_unlock(http_share_locks + data);
+}
+
+static int util_http_socket_cb(CURL* curl, curl_socket_t fd, int what, void* userp, void* socketp){
+	uint32_t events = 0;
+	if(what & CURL_POLL_IN)  events |= EPOLLIN;
+	if(what & CURL_POLL_OUT) events |= EPOLLOUT;
+
+	// socketp is non-NULL once the fd is in the epoll set.
+	if(what == CURL_POLL_REMOVE){
+		util_epoll_ctl(EPOLL_CTL_DEL, fd, EV_HTTP, 0);
+	} else if(socketp){
+		util_epoll_ctl(EPOLL_CTL_MOD, fd, EV_HTTP, events);
+	} else {
+		util_epoll_ctl(EPOLL_CTL_ADD, fd, EV_HTTP, events);
+		curl_multi_assign(http_multi, fd, (void*)1);
 	}
+
+	return 0;
 }
 
-static void util_ipc_recv(void){
-	char buffer[4096];
-	struct sockaddr_un addr;
-	socklen_t addr_len = sizeof(addr);
+static int util_http_timer_cb(CURLM* multi, long timeout_ms, void* userp){
+	http_timer_ms = timeout_ms < 0 ? -1 : util_ms_now() + timeout_ms;
+	return 0;
+}
 
-	ssize_t num = recvfrom(ipc_socket, buffer, sizeof(buffer), 0, &addr, &addr_len);
-	if(num == -1){
-		perror("ipc_recv: recvfrom");
+static void util_http_init(void){
+	if(!(http_multi = curl_multi_init())){
+		fputs("http_init: curl_multi_init failed\n", stderr);
 		return;
 	}
 
-	assert(addr.sun_family == AF_UNIX);
+	curl_multi_setopt(http_multi, CURLMOPT_SOCKETFUNCTION, &util_http_socket_cb);
+	curl_multi_setopt(http_multi, CURLMOPT_TIMERFUNCTION , &util_http_timer_cb);
 
-	IPCAddress* peer = util_ipc_add(addr.sun_path);
+	// the share is also handed to modules via get_info, for requests they make on worker threads.
+	// connections aren't in it since libcurl can't share a connection cache between threads, the multi handle
+	// keeps its own connection cache for the requests made through http_request.
+	if((http_share = curl_share_init())){
+		for(size_t i = 0; i < ARRAY_SIZE(http_share_locks); ++i){
+			pthread_mutex_init(http_share_locks + i, NULL);
+		}
+
+		curl_share_setopt(http_share, CURLSHOPT_LOCKFUNC  , &util_http_share_lock);
+		curl_share_setopt(http_share, CURLSHOPT_UNLOCKFUNC, &util_http_share_unlock);
+		curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	}
+}
+
+static void util_http_call_cb(HTTPReq req, int result){
+	Module* owner = NULL;
 
 	sb_each(m, irc_modules){
-		if(strncmp(buffer, m->ctx->name, num) == 0){
-			printf("Got IPC msg from %d for %s\n", peer->id, m->ctx->name);
-			const size_t off = strlen(m->ctx->name) + 1;
-			IRC_MOD_CALL(m, on_ipc, (peer->id, (uint8_t*)(buffer + off), num - off));
+		if(m->ctx == req.owner){
+			owner = m;
+			break;
 		}
 	}
+
+	if(owner){
+		IRC_MOD_CALL_FN(owner, "http", req.cb, (req.curl, result, req.arg));
+	} else {
+		req.cb(req.curl, result, req.arg);
+	}
 }
 
-static void util_find_chan_nick(const char* chan, const char* nick, int* chan_idx, int* nick_idx){
+static void util_http_check_done(void){
+	CURLMsg* msg;
+	int remaining;
 
-	if(chan_idx) *chan_idx = -1;
-	if(nick_idx) *nick_idx = -1;
+	while((msg = curl_multi_info_read(http_multi, &remaining))){
+		if(msg->msg != CURLMSG_DONE) continue;
 
-	for(size_t i = 0; i < sb_count(channels) - 1; ++i){
-		if(strcasecmp(channels[i], chan) != 0) continue;
+		CURL* curl = msg->easy_handle;
+		CURLcode result = msg->data.result;
 
-		if(chan_idx) *chan_idx = i;
+		curl_multi_remove_handle(http_multi, curl);
 
-		for(size_t j = 0; j < sb_count(chan_nicks[i]); ++j){
-			if(strcasecmp(chan_nicks[i][j], nick) == 0){
-				if(nick_idx) *nick_idx = j;
-				break;
-			}
-		}
+		sb_each(r, http_reqs){
+			if(r->curl != curl) continue;
 
-		break;
+			HTTPReq req = *r;
+			sb_erase(http_reqs, r - http_reqs);
+			util_http_call_cb(req, result);
+			break;
+		}
 	}
 }
 
-static void util_trim_end_spaces(char* msg, size_t len){
-	if(len > 0){
-		for(char* p = msg + len - 1; p >= msg && *p == ' '; --p){
-			*p = 0;
-		}
-	}
+// called when epoll says one of curl's sockets is ready.
+static void util_http_socket_ready(int fd, uint32_t events){
+	int flags = 0, running = 0;
+
+	if(events & EPOLLIN)  flags |= CURL_CSELECT_IN;
+	if(events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+	if(events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+
+	curl_multi_socket_action(http_multi, fd, flags, &running);
+	util_http_check_done();
 }
 
-static void util_update_tags(const char** params){
-	if(!have_tag_hack) return;
-	strncpy(irc_tag_buf, params[-1], sizeof(irc_tag_buf)-1);
+static void util_http_check_timeout(int64_t now){
+	if(http_timer_ms == -1 || now < http_timer_ms) return;
 
-	if(irc_tag_ptrs){
-		stb__sbn(irc_tag_ptrs) = 0;
-	}
+	int running = 0;
+	http_timer_ms = -1;
+	curl_multi_socket_action(http_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	util_http_check_done();
+}
 
-	char* state;
-	char* k = strtok_r(irc_tag_buf, ";", &state);
+// cancels a module's outstanding requests, calling their callbacks, so it can be safely unloaded.
+static void util_http_cancel(Module* m){
+	if(!m->ctx) return;
 
-	for(; k; k = strtok_r(NULL, ";", &state)){
-		char* v = k;
+	for(size_t i = 0; i < sb_count(http_reqs); ++i){
+		if(http_reqs[i].owner != m->ctx) continue;
 
-		while(*v && *v != '=') ++v;
+		HTTPReq req = http_reqs[i];
+		sb_erase(http_reqs, i);
+		--i;
 
-		if(*v == '='){
-			*v++ = '\0';
+		curl_multi_remove_handle(http_multi, req.curl);
+		util_http_call_cb(req, CURLE_ABORTED_BY_CALLBACK);
+	}
+}
 
-			for(char* p = v; *p; ++p){
-				if(*p != '\\') continue;
+static void util_http_quit(void){
+	sb_each(r, http_reqs){
+		curl_multi_remove_handle(http_multi, r->curl);
+	}
+	sb_free(http_reqs);
 
-				if(p[1] == ':') *p = ';';
-				else if(p[1] == 's') *p = ' ';
-				else if(p[1] == 'r') *p = '\r';
-				else if(p[1] == 'n') *p = '\n';
+	if(http_multi){
+		curl_multi_cleanup(http_multi);
+	}
 
-				for(char* q = p + 1; *q; ++q){
-					q[0] = q[1];
-				}
-			}
+	if(http_share){
+		curl_share_cleanup(http_share);
+		for(size_t i = 0; i < ARRAY_SIZE(http_share_locks); ++i){
+			pthread_mutex_destroy(http_share_locks + i);
 		}
-
-		sb_push(irc_tag_ptrs, k);
-		sb_push(irc_tag_ptrs, v);
 	}
 }
 
-static char* util_file_read(const char* name){
-	char* mem = NULL;
-	long len = 0;
-	FILE* f = fopen(name, "r");
-	if(!f) return NULL;
+// timer ids are the slot index + 1 in the low bits, and the slot's generation in the rest.
+#define TIMER_SLOT_BITS 24
 
-	if(fseek(f, 0, SEEK_END) == -1) goto end;
-	if((len = ftell(f)) == -1) goto end;
-	if(fseek(f, 0, SEEK_SET) == -1) goto end;
+static size_t util_timer_id(uint32_t slot){
+	return ((size_t)timers[slot].gen << TIMER_SLOT_BITS) | (slot + 1);
+}
 
-	mem = malloc(len + 1);
-	assert(mem);
+static void util_timer_heap_set(size_t i, uint32_t slot){
+	timer_heap[i] = slot;
+	timers[slot].heap_idx = i;
+}
 
-	fread(mem, len, 1, f);
-	mem[len] = 0;
+static void util_timer_sift_up(size_t i){
+	uint32_t slot = timer_heap[i];
 
-end:
-	fclose(f);
-	return mem;
-}
+	while(i > 0){
+		size_t parent = (i - 1) / 2;
+		if(timers[timer_heap[parent]].deadline_ms <= timers[slot].deadline_ms) break;
 
-static bool util_module_filter_update_file(const char* name, char** list){
-	char pathbuf[PATH_MAX];
-	snprintf(pathbuf, sizeof(pathbuf), "%s/%s", insobot_path, name);
+		util_timer_heap_set(i, timer_heap[parent]);
+		i = parent;
+	}
 
-	if(*list) stb__sbn(*list) = 0;
+	util_timer_heap_set(i, slot);
+}
 
-	char* mem = util_file_read(pathbuf);
-	if(mem){
-		char* state;
+static void util_timer_sift_down(size_t i){
+	size_t n = sb_count(timer_heap);
+	uint32_t slot = timer_heap[i];
 
-		for(char* line = strtok_r(mem, "\r\n", &state); line; line = strtok_r(NULL, "\r\n", &state)){
-			if(strchr(line, '/')) continue;
+	for(;;){
+		size_t child = i * 2 + 1;
+		if(child >= n) break;
 
-			size_t len = strlen(line);
-			sb_push(*list, '/');
-			memcpy(sb_add(*list, len), line, len);
+		if(child + 1 < n && timers[timer_heap[child+1]].deadline_ms < timers[timer_heap[child]].deadline_ms){
+			++child;
 		}
 
-		if(sb_count(*list)){
-			sb_push(*list, 0);
-		}
+		if(timers[slot].deadline_ms <= timers[timer_heap[child]].deadline_ms) break;
 
-		free(mem);
-	} else if(errno != ENOENT){
-		fprintf(stderr, "Error reading %s: %m\n", name);
+		util_timer_heap_set(i, timer_heap[child]);
+		i = child;
 	}
 
-	return sb_count(*list) > 0;
+	util_timer_heap_set(i, slot);
 }
 
-static void util_module_filter_update(void){
-	bool inc = util_module_filter_update_file("modules.include", &modules_include);
-	bool exc = util_module_filter_update_file("modules.exclude", &modules_exclude);
-	if(inc && exc){
-		printf("WARNING: Both modules.include and modules.exclude exist. Only modules.include will be used.\n");
+static void util_timer_heap_remove(size_t i){
+	uint32_t last = sb_last(timer_heap);
+	sb_pop(timer_heap);
+
+	if(i < sb_count(timer_heap)){
+		util_timer_heap_set(i, last);
+		util_timer_sift_down(i);
+		util_timer_sift_up(timers[last].heap_idx);
 	}
 }
 
-static bool util_module_filter_allowed(const char* module){
-	char* base = strdupa(basename(module));
-	if(strncmp(base, "mod_", 4) == 0){
-		base += 4;
-	}
+static void util_timer_free(uint32_t slot){
+	timers[slot].heap_idx = -1;
+	timers[slot].gen++;
+	sb_push(timer_free, slot);
+}
 
-	{
-		char* p = strrchr(base, '.');
-		if(p && strcmp(p, ".so") == 0){
-			*p = 0;
+// calls any timers that have expired, O(expired * log(timers)).
+static void util_timer_run(int64_t now){
+	while(sb_count(timer_heap) && timers[timer_heap[0]].deadline_ms <= now){
+		uint32_t slot = timer_heap[0];
+		Timer* t = timers + slot;
+
+		// copy, since the callback can add timers & realloc the slots
+		const IRCModuleCtx* owner = t->owner;
+		void (*cb)(void*) = t->cb;
+		void* arg = t->arg;
+
+		if(t->interval_ms){
+			t->deadline_ms += t->interval_ms;
+			if(t->deadline_ms <= now){
+				t->deadline_ms = now + t->interval_ms;
+			}
+			util_timer_sift_down(0);
+		} else {
+			util_timer_heap_remove(0);
+			util_timer_free(slot);
 		}
-	}
-
-	size_t mod_len = strlen(base);
-	char* p = sb_count(modules_include) ? modules_include : modules_exclude;
-	bool ret = p == modules_include;
 
-	if(p){
-		while((p = strstr(p, base))){
-			if(p && p[-1] == '/' && (p[mod_len] == '/' || !p[mod_len])){
-				return ret;
+		Module* m = NULL;
+		sb_each(mod, irc_modules){
+			if(mod->ctx == owner){
+				m = mod;
+				break;
 			}
-			++p;
 		}
-		return !ret;
-	} else {
-		return true;
+
+		if(m){
+			IRC_MOD_CALL_FN(m, "timer", cb, (arg));
+		} else {
+			cb(arg);
+		}
 	}
 }
 
-void util_check_data_migrate(const char* path){
-	char oldpath[PATH_MAX];
-	char newpath[PATH_MAX];
+static int64_t util_timer_next(void){
+	return sb_count(timer_heap) ? timers[timer_heap[0]].deadline_ms : -1;
+}
 
-	snprintf(oldpath, sizeof(oldpath), "%s/modules/data", path);
-	snprintf(newpath, sizeof(newpath), "%s/data", path);
+static void util_timer_cancel_all(Module* m){
+	if(!m->ctx) return;
 
-	if(access(newpath, F_OK) == 0){
-		// new location already exists, skip.
-		return;
+	for(uint32_t slot = 0; slot < sb_count(timers); ++slot){
+		Timer* t = timers + slot;
+		if(t->heap_idx == -1 || t->owner != m->ctx) continue;
+
+		util_timer_heap_remove(t->heap_idx);
+		util_timer_free(slot);
 	}
+}
 
-	struct stat st;
-	if(stat(oldpath, &st) == 0 && S_ISDIR(st.st_mode)){
-		printf("******************************************************************************\n"
-		       "* The location of module data files has changed from /modules/data to /data. *\n"
-		       "* This allows the modules directory to be symlinked and used by multiple bot *\n"
-		       "*           instances, while each bot keeps its own set of data.             *\n"
-		       "*   Press Y to move this directory, or N to keep it where it is currently.   *\n"
-		       "*     If not moved, the bot will start with a blank set of module data.      *\n"
-		       "******************************************************************************");
+static uint32_t util_fd_to_epoll(uint32_t events){
+	uint32_t result = 0;
+	if(events & IRC_FD_READ)  result |= EPOLLIN;
+	if(events & IRC_FD_WRITE) result |= EPOLLOUT;
+	return result;
+}
 
-		int opt = 0;
-		if(isatty(STDOUT_FILENO)){
-			do {
-				if(opt != '\n'){
-					printf("\nMove the data directory? (Y/N) > ");
-					fflush(stdout);
-				}
-				opt = getchar();
-			} while(!strchr("yYnN", opt));
-		} else {
-			printf("stdout isn't a tty, assuming Y.\n");
-			opt = 'y';
-		}
+static uint32_t util_fd_from_epoll(uint32_t events){
+	uint32_t result = 0;
+	if(events & EPOLLIN)  result |= IRC_FD_READ;
+	if(events & EPOLLOUT) result |= IRC_FD_WRITE;
+	if(events & (EPOLLERR | EPOLLHUP)) result |= IRC_FD_ERROR;
+	return result;
+}
 
-		if(opt == 'y' || opt == 'Y'){
-			if(rename(oldpath, newpath) == -1){
-				perror("rename");
-			} else {
-				printf("Successfully moved data directory.\n");
-			}
-		} else {
-			printf("Keeping old data directory in place.\n");
-		}
+static ModuleFD* util_fd_find(int fd){
+	sb_each(f, mod_fds){
+		if(f->fd == fd) return f;
 	}
+	return NULL;
 }
 
-/*****************
- * IRC Callbacks *
+static void util_fd_ready(int fd, uint32_t events){
+	// can be stale if an earlier event in the same batch removed it
+	ModuleFD* f = util_fd_find(fd);
+	if(!f) return;
+
+	sb_each(m, irc_modules){
+		if(m->ctx == f->owner && ABI_CHECK(m, ABI_FD)){
+			IRC_MOD_CALL(m, on_fd, (fd, util_fd_from_epoll(events)));
+			break;
+		}
+	}
+}
+
+// removes a module's fds from the epoll set. Done before on_quit, which probably closes them.
+static void util_fd_cancel_all(Module* m){
+	if(!m->ctx) return;
+
+	for(size_t i = 0; i < sb_count(mod_fds); ++i){
+		if(mod_fds[i].owner != m->ctx) continue;
+
+		util_epoll_ctl(EPOLL_CTL_DEL, mod_fds[i].fd, EV_MODULE, 0);
+		sb_erase(mod_fds, i);
+		--i;
+	}
+}
+
+// stops everything the core is doing on behalf of a module, before it's saved & unloaded.
+static void util_module_cancel(Module* m){
+	util_async_drain(m);
+	util_http_cancel(m);
+	util_timer_cancel_all(m);
+	util_fd_cancel_all(m);
+}
+
+static void util_module_add(const char* name){
+	char path_buf[PATH_MAX];
+	const char* path = name;
+
+	if(!strchr(path, '/')){
+		if(snprintf(path_buf, PATH_MAX, "%s%s", inotify.module.path, name) >= PATH_MAX) return;
+		path = path_buf;
+	}
+
+	if(util_module_filter_allowed(path)){
+		Module m = {
+			.lib_path = strdup(path),
+			.needs_reload = true,
+			.lib_fd = -1,
+			.old_lib_fd = -1,
+			.save_fd = -1,
+			.save_due_ms = -1,
+			.journal_fd = -1,
+		};
+
+		sb_push(irc_modules, m);
+	} else {
+		printf("NOTE: Loading module '%s' cancelled due to filter.\n", basename(path));
+	}
+}
+
+static bool util_inotify_check(void);
+
+static void util_module_save(Module* m, bool sync);
+
+static void util_data_path(char* buf, size_t buf_sz, const char* name, const char* ext){
+	snprintf(buf, buf_sz, "%s%s%s", data_path, name, ext);
+}
+
+// the data dir watch is shared by all modules, so count how many saves want it disabled.
+static int data_watch_paused;
+
+static void util_data_watch_pause(void){
+	if(data_watch_paused++ == 0){
+		// change the inotify data watch to something we don't care about to disable it temporarily
+		inotify.data.wd = inotify_add_watch(inotify.fd, inotify.data.path, IN_DELETE_SELF);
+	}
+}
+
+static void util_data_watch_resume(void){
+	if(--data_watch_paused == 0){
+		inotify.data.wd = inotify_add_watch(inotify.fd, inotify.data.path, IN_CLOSE_WRITE | IN_MOVED_TO);
+	}
+}
+
+// Journals: a module can append small records with ctx->journal instead of rewriting its whole data file with
+// save_me. They're buffered, written to data/<name>.journal with one write + fdatasync per trip around the main
+// loop, and passed back to on_journal after on_init (or on_modified) has loaded the data file. The journal is
+// folded into the data file by a normal save once it gets big compared to it.
+//
+// When a save starts, the journal is moved to <name>.journal.old (appended if that's still around from a failed
+// save), and that is removed when the save succeeds. If we die in between, both get replayed, so records should
+// hold the new state rather than a difference, making it harmless to apply them twice.
+
+typedef struct JournalRec_ {
+	uint32_t len;
+	uint32_t type;
+} JournalRec;
+
+static void util_journal_path(Module* m, bool old, char* buf, size_t buf_sz){
+	util_data_path(buf, buf_sz, m->ctx->name, old ? ".journal.old" : ".journal");
+}
+
+static void util_journal_flush(Module* m){
+	if(!sb_count(m->journal_buf)) return;
+
+	if(m->journal_fd == -1){
+		char path[PATH_MAX];
+		util_journal_path(m, false, path, sizeof(path));
+
+		m->journal_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+		if(m->journal_fd == -1){
+			fprintf(stderr, "Error opening journal for %s: %s\n", m->ctx->name, strerror(errno));
+			return;
+		}
+
+		struct stat st;
+		m->journal_size = fstat(m->journal_fd, &st) == 0 ? st.st_size : 0;
+	}
+
+	ssize_t n = write(m->journal_fd, m->journal_buf, sb_count(m->journal_buf));
+	if(n != (ssize_t)sb_count(m->journal_buf)){
+		fprintf(stderr, "Error writing journal for %s: %s\n", m->ctx->name, n == -1 ? strerror(errno) : "short write");
+
+		// don't leave half a record in there for the rest to be appended after.
+		if(ftruncate(m->journal_fd, m->journal_size) == -1){
+			perror("ftruncate");
+		}
+		return;
+	}
+
+	m->journal_size += n;
+	stb__sbn(m->journal_buf) = 0;
+
+	// everything buffered since the last flush went out in that one write, so it only needs one sync.
+	if(fdatasync(m->journal_fd) == -1){
+		fprintf(stderr, "Error syncing journal for %s: %s\n", m->ctx->name, strerror(errno));
+	}
+
+	if(m->journal_size < JOURNAL_COMPACT_MIN || m->save_due_ms != -1) return;
+
+	char path[PATH_MAX];
+	struct stat st;
+	util_data_path(path, sizeof(path), m->ctx->name, ".data");
+
+	off_t data_size = stat(path, &st) == 0 ? st.st_size : 0;
+	if(m->journal_size * 100 > data_size * JOURNAL_COMPACT_PERCENT){
+		m->save_due_ms = INSO_MAX(util_ms_now(), m->last_save_ms + SAVE_MIN_INTERVAL_MS);
+	}
+}
+
+static void util_journal_flush_all(void){
+	sb_each(m, irc_modules){
+		util_journal_flush(m);
+	}
+}
+
+// called just before a save, so everything journalled up to now ends up in .journal.old
+static void util_journal_rotate(Module* m){
+	util_journal_flush(m);
+	if(m->journal_fd == -1) return;
+
+	char path[PATH_MAX], old_path[PATH_MAX];
+	util_journal_path(m, false, path, sizeof(path));
+	util_journal_path(m, true, old_path, sizeof(old_path));
+
+	if(m->journal_size > 0){
+		if(access(old_path, F_OK) != 0){
+			if(rename(path, old_path) == -1){
+				perror("rename journal");
+				return;
+			}
+		} else {
+			int in  = open(path, O_RDONLY | O_CLOEXEC);
+			int out = open(old_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+			char buf[4096];
+			ssize_t n = -1;
+
+			while(in != -1 && out != -1 && (n = read(in, buf, sizeof(buf))) > 0){
+				if(write(out, buf, n) != n){
+					n = -1;
+					break;
+				}
+			}
+
+			if(in  != -1) close(in);
+			if(out != -1) close(out);
+
+			if(n != 0){
+				fprintf(stderr, "Error moving journal for %s, keeping it.\n", m->ctx->name);
+				return;
+			}
+
+			unlink(path);
+		}
+		m->journal_rotated = true;
+	}
+
+	close(m->journal_fd);
+	m->journal_fd   = -1;
+	m->journal_size = 0;
+}
+
+static void util_journal_saved(Module* m){
+	if(!m->journal_rotated) return;
+	m->journal_rotated = false;
+
+	char old_path[PATH_MAX];
+	util_journal_path(m, true, old_path, sizeof(old_path));
+	unlink(old_path);
+}
+
+static void util_journal_close(Module* m){
+	util_journal_flush(m);
+	if(m->journal_fd != -1){
+		close(m->journal_fd);
+		m->journal_fd = -1;
+	}
+	sb_free(m->journal_buf);
+}
+
+// adds the number of records given to on_journal to *replayed.
+static bool util_journal_replay_file(Module* m, const char* path, bool fix_tail, size_t* replayed){
+	int fd = open(path, (fix_tail ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+	if(fd == -1) return false;
+
+	struct stat st;
+	char* data = NULL;
+
+	if(fstat(fd, &st) == 0 && st.st_size > 0){
+		data = malloc(st.st_size);
+		if(!data || read(fd, data, st.st_size) != st.st_size){
+			fprintf(stderr, "Error reading journal %s\n", path);
+			free(data);
+			close(fd);
+			return true;
+		}
+	}
+
+	size_t off = 0, count = 0;
+	while(data && off + sizeof(JournalRec) <= (size_t)st.st_size){
+		JournalRec rec;
+		memcpy(&rec, data + off, sizeof(rec));
+
+		if(rec.len > st.st_size - off - sizeof(rec)) break;
+
+		IRC_MOD_CALL(m, on_journal, (rec.type, data + off + sizeof(rec), rec.len));
+		off += sizeof(rec) + rec.len;
+		++count;
+	}
+
+	if(off != (size_t)st.st_size){
+		fprintf(stderr, "Journal %s has a partial record at the end, ignoring it.\n", path);
+		if(fix_tail && ftruncate(fd, off) == -1){
+			perror("ftruncate");
+		}
+	}
+
+	if(count){
+		printf("Replayed %zu journal records for %s.\n", count, m->ctx->name);
+	}
+	*replayed += count;
+
+	free(data);
+	close(fd);
+	return true;
+}
+
+static void util_journal_replay(Module* m){
+	if(!ABI_CHECK(m, ABI_JOURNAL) || !m->ctx->on_journal) return;
+
+	char path[PATH_MAX];
+	size_t replayed = 0;
+
+	util_journal_path(m, true, path, sizeof(path));
+	if(util_journal_replay_file(m, path, false, &replayed)){
+		m->journal_rotated = true;
+	}
+
+	util_journal_path(m, false, path, sizeof(path));
+	util_journal_replay_file(m, path, true, &replayed);
+
+	if(replayed){
+		IRC_MOD_CALL(m, on_journal, (IRC_JOURNAL_DONE, NULL, 0));
+	}
+}
+
+static bool util_module_save_file(Module* m){
+	const char*  save_fname = core_get_datafile();
+	const size_t save_fsz   = strlen(save_fname);
+	const char   tmp_end[]  = ".XXXXXX";
+	char*        tmp_fname  = alloca(save_fsz + sizeof(tmp_end));
+
+	memcpy(tmp_fname, save_fname, save_fsz);
+	memcpy(tmp_fname + save_fsz, tmp_end, sizeof(tmp_end));
+
+	int tmp_fd = mkstemp(tmp_fname);
+	if(tmp_fd < 0){
+		fprintf(stderr, "Error saving file for %s: %s\n", m->ctx->name, strerror(errno));
+		return false;
+	}
+
+	FILE* tmp_file = fdopen(tmp_fd, "wb");
+	bool saved = m->ctx->on_save(tmp_file);
+	if(fclose(tmp_file) != 0){
+		saved = false;
+	}
+
+	if(saved && rename(tmp_fname, save_fname) < 0){
+		fprintf(stderr, "Error saving file for %s: %s\n", m->ctx->name, strerror(errno));
+		saved = false;
+	} else if(!saved){
+		unlink(tmp_fname);
+	}
+
+	// allow other users to read the data files (e.g. CGI command list)
+	chmod(save_fname, 0644);
+
+	return saved;
+}
+
+static void util_module_save_reap(Module* m, bool block){
+	if(!m->save_pid) return;
+
+	int status;
+	pid_t pid;
+
+	do {
+		pid = waitpid(m->save_pid, &status, block ? 0 : WNOHANG);
+	} while(block && pid == -1 && errno == EINTR);
+
+	if(pid == 0 || (pid == -1 && errno == EINTR)){
+		return;
+	}
+
+	if(pid == -1){
+		perror("waitpid");
+	} else if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+		fprintf(stderr, "Background save for %s failed (status %x)\n", m->ctx ? m->ctx->name : m->lib_path, status);
+	} else if(m->ctx){
+		util_journal_saved(m);
+	}
+
+	if(m->save_fd != -1){
+		util_epoll_ctl(EPOLL_CTL_DEL, m->save_fd, EV_SAVE, 0);
+		close(m->save_fd);
+		m->save_fd = -1;
+	}
+
+	m->save_pid = 0;
+	util_data_watch_resume();
+}
+
+static void util_module_save_ready(int fd){
+	sb_each(m, irc_modules){
+		if(!m->save_pid || m->save_fd != fd) continue;
+
+		util_module_save_reap(m, false);
+
+		// something changed while the child was writing, so its snapshot is already stale.
+		if(!m->save_pid && m->save_again){
+			m->save_again = false;
+			util_module_save(m, false);
+		}
+		break;
+	}
+}
+
+// sync = false lets modules with IRC_MOD_FORK_SAVE write their data from a forked child, so the (copy-on-write)
+// snapshot is saved while the parent carries on. Reloads and shutdown pass sync = true, since the data file has to
+// be complete before the module is unloaded / re-initialised from it.
+static void util_module_save(Module* m, bool sync){
+	m->save_due_ms = -1;
+	if(!m->ctx || !m->ctx->on_save) return;
+
+	bool fork_save = !sync && (m->ctx->flags & IRC_MOD_FORK_SAVE);
+	m->last_save_ms = util_ms_now();
+
+	if(m->save_pid){
+		if(fork_save){
+			m->save_again = true;
+			return;
+		}
+		util_module_save_reap(m, true);
+	}
+	m->save_again = false;
+
+	sb_push(mod_call_stack, m);
+
+	// lock the file for writing, then check for modification when we have the lock.
+	int orig_file = open(core_get_datafile(), O_RDONLY, 0644);
+	if(orig_file != -1) {
+		flock(orig_file, LOCK_EX);
+
+		// don't check return value for full reload here
+		util_inotify_check();
+
+		close(orig_file);
+	}
+
+	util_data_watch_pause();
+	util_journal_rotate(m);
+
+	pid_t pid = fork_save ? fork() : -1;
+
+	if(pid == 0){
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		_exit(util_module_save_file(m) ? 0 : 1);
+	} else if(pid > 0){
+		m->save_pid = pid;
+		m->save_fd  = -1;
+
+#ifdef SYS_pidfd_open
+		m->save_fd = syscall(SYS_pidfd_open, pid, 0);
+		if(m->save_fd != -1 && !util_epoll_ctl(EPOLL_CTL_ADD, m->save_fd, EV_SAVE, EPOLLIN)){
+			close(m->save_fd);
+			m->save_fd = -1;
+		}
+#endif
+		// no pidfd support, just wait for it like a normal save.
+		if(m->save_fd == -1){
+			util_module_save_reap(m, true);
+		}
+	} else {
+		if(fork_save){
+			perror("fork");
+		}
+		if(util_module_save_file(m)){
+			util_journal_saved(m);
+		}
+		util_data_watch_resume();
+	}
+
+	sb_pop(mod_call_stack);
+}
+
+static Module* util_module_get(const char* name, int type){
+	sb_each(m, irc_modules){
+		const char* base_path = basename(m->lib_path);
+
+		if(type == MOD_GET_CTXNAME && !m->ctx){ // can happen inside inotify loop
+			continue;
+		}
+
+		const char* comparison
+			= (type == MOD_GET_CTXNAME)	? m->ctx->name
+			: (type == MOD_GET_SONAME)  ? base_path
+			: NULL;
+
+		if(strcmp(name, comparison) == 0){
+			return m;
+		}
+	}
+	return NULL;
+}
+
+static int util_mod_sort(const void* a, const void* b){
+	return ((Module*)b)->ctx->priority - ((Module*)a)->ctx->priority;
+}
+
+static void util_module_swap_old(Module* m){
+	void*         handle = m->lib_handle;
+	int           fd     = m->lib_fd;
+	IRCModuleCtx* ctx    = m->ctx;
+	size_t        size   = m->ctx_size;
+
+	m->lib_handle = m->old_handle;
+	m->lib_fd     = m->old_lib_fd;
+	m->ctx        = m->old_ctx;
+	m->ctx_size   = m->old_ctx_size;
+
+	m->old_handle   = handle;
+	m->old_lib_fd   = fd;
+	m->old_ctx      = ctx;
+	m->old_ctx_size = size;
+}
+
+static void util_module_dlclose(Module* m){
+	dlclose(m->lib_handle);
+	m->lib_handle = NULL;
+
+	if(m->lib_fd != -1){
+		close(m->lib_fd);
+		m->lib_fd = -1;
+	}
+}
+
+// dlopen hands back the instance that's already loaded for a path or file, so a new instance that has to be loaded
+// next to the old one is dlopen'd from a copy in a memfd instead. The fd stays open until the instance is closed,
+// which keeps its /proc/self/fd path from being reused (and matched by dlopen) while it's loaded.
+static void* util_module_dlopen_copy(Module* m){
+	void* handle = NULL;
+	const char* err = NULL;
+	struct stat st;
+
+	int src = open(m->lib_path, O_RDONLY | O_CLOEXEC);
+	int fd  = memfd_create(basename(m->lib_path), MFD_CLOEXEC);
+
+	if(src == -1 || fd == -1 || fstat(src, &st) == -1){
+		err = strerror(errno);
+		goto out;
+	}
+
+	for(off_t off = 0; off < st.st_size;){
+		if(sendfile(fd, src, &off, st.st_size - off) <= 0){
+			err = errno ? strerror(errno) : "short copy";
+			goto out;
+		}
+	}
+
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+	if((handle = dlopen(path, RTLD_LAZY | RTLD_LOCAL))){
+		m->lib_fd = fd;
+		fd = -1;
+	} else {
+		err = dlerror();
+	}
+
+out:
+	if(err){
+		fprintf(stderr, "Couldn't load a copy of %s, reloading it normally: %s\n", m->lib_path, err);
+	}
+	if(fd  != -1) close(fd);
+	if(src != -1) close(src);
+	return handle;
+}
+
+// saves & unloads the module's current instance
+static void util_module_retire(Module* m){
+	util_module_save(m, true);
+	util_journal_close(m);
+	IRC_MOD_CALL(m, on_quit, ());
+	util_module_dlclose(m);
+}
+
+// the same, for an old instance that didn't get to hand over its state
+static void util_module_retire_old(Module* m){
+	if(!m->old_handle) return;
+
+	util_module_swap_old(m);
+	util_module_retire(m);
+	util_module_swap_old(m);
+
+	m->old_handle = NULL;
+	m->old_ctx    = NULL;
+}
+
+// passes the old instance's state to the new one with on_handoff / on_adopt, so it doesn't need to be saved and
+// loaded again. If that doesn't work out, the old one is saved and unloaded as usual and false is returned.
+static bool util_module_adopt(Module* m){
+	uint32_t version = 0;
+	void* state;
+
+	util_module_swap_old(m);
+	state = IRC_MOD_CALL(m, on_handoff, (&version));
+	util_module_swap_old(m);
+
+	if(state && ABI_CHECK(m, ABI_HANDOFF) && m->ctx->on_adopt && IRC_MOD_CALL(m, on_adopt, (&core_ctx, state, version))){
+		util_module_swap_old(m);
+		util_module_dlclose(m);
+		util_module_swap_old(m);
+		m->old_ctx = NULL;
+		return true;
+	}
+
+	printf("** %s didn't adopt the previous state (version %u), reloading it from disk.\n", m->ctx->name, version);
+	util_module_retire_old(m);
+	return false;
+}
+
+static void util_reload_modules(void){
+
+	// these depend on the modules' memory / positions, so drop them until they're all reloaded.
+	util_cmd_index_free();
+	util_meta_clear();
+
+	sb_each(m, irc_modules){
+		if(!m->needs_reload) continue;
+
+		const char* mod_name = basename(m->lib_path);
+
+		if(m->lib_handle){
+			util_module_cancel(m);
+
+			if(ABI_CHECK(m, ABI_HANDOFF) && m->ctx->on_handoff && util_module_filter_allowed(mod_name)){
+				util_journal_flush(m);
+				util_module_swap_old(m);
+			} else {
+				util_module_retire(m);
+			}
+		}
+
+		if(!util_module_filter_allowed(mod_name)){
+			printf("Module '%s' is now filtered. Unloading.\n", mod_name);
+			free(m->lib_path);
+			sb_erase(irc_modules, m - irc_modules);
+			--m;
+			continue;
+		}
+
+		dlerror();
+
+		// the old instance is still loaded if it's going to hand over its state, so load the new one separately.
+		if(m->old_handle && !(m->lib_handle = util_module_dlopen_copy(m))){
+			util_module_retire_old(m);
+		}
+
+		if(!m->lib_handle){
+			m->lib_handle = dlopen(m->lib_path, RTLD_LAZY | RTLD_LOCAL);
+		}
+
+		printf("Loading module %-20s", mod_name);
+
+		const char* errmsg = dlerror();
+		if(!errmsg && m->lib_handle){
+			m->ctx = dlsym(m->lib_handle, "irc_mod_ctx");
+			errmsg = dlerror();
+		} else if(!errmsg && !m->lib_handle){
+			errmsg = "NULL lib handle.";
+		}
+
+		if(!errmsg){
+			const ElfW(Sym)* sym = NULL;
+			Dl_info unused;
+			if(dladdr1(m->ctx, &unused, (void**)&sym, RTLD_DL_SYMENT) == 0){
+				errmsg = "dladdr1 failed.";
+			} else if(sym->st_size < (sizeof(void*)*23)) {
+
+				// NOTE: ABI Table for IRCModuleCtx:
+				//
+				//       | sizeof(void*) | last field   |
+				//       +---------------+--------------+
+				//       |      x23      | on_ipc       |
+				//       |      x24      | on_filter    |
+				//       |      x25      | on_unknown   |
+				//       |      x27      | help_url     |
+				//       |      x28      | on_fd        |
+				//       |      x29      | on_journal   |
+				//       |      x30      | on_handoff   |
+				//       |      x31      | on_adopt     |
+				//       |      x32      | on_join_bulk |
+				//       |      x33      | prefilter    |
+
+				errmsg = "version mismatch (wrong size irc_mod_ctx)";
+			} else {
+				m->ctx_size = sym->st_size;
+			}
+		}
+
+		if(errmsg){
+			puts("");
+			fprintf(stderr, "** Error loading module %s:\n  %s\n", mod_name, errmsg);
+			if(m->lib_handle){
+				util_module_dlclose(m);
+			}
+			util_module_retire_old(m);
+			free(m->lib_path);
+			sb_erase(irc_modules, m - irc_modules);
+			--m;
+		} else {
+			struct link_map* mod_info = m->lib_handle;
+			printf("[0x%zx]\n", (size_t)mod_info->l_addr);
+			m->trace_name = util_trace_intern(m->ctx->name);
+		}
+	}
+
+	qsort(irc_modules, sb_count(irc_modules), sizeof(*irc_modules), &util_mod_sort);
+
+	sb_each(m, irc_modules){
+		if(!m->needs_reload) continue;
+		m->needs_reload = false;
+
+		const char* mod_name = basename(m->lib_path);
+
+		if(m->old_ctx && util_module_adopt(m)){
+			printf("Adopted previous state for %s.\n", mod_name);
+			continue;
+		}
+
+		printf("Init %s...\n", mod_name);
+
+		if(!IRC_MOD_CALL(m, on_init, (&core_ctx))){
+			printf("** Init failed for %s.\n", mod_name);
+			util_module_cancel(m);
+			util_module_dlclose(m);
+			free(m->lib_path);
+			sb_erase(irc_modules, m - irc_modules);
+			--m;
+			continue;
+		}
+
+		util_journal_replay(m);
+
+		sb_each(c, irc_conns){
+			if(!c->registered) continue;
+
+			irc_cur = irc_connecting = c;
+			IRC_MOD_CALL(m, on_connect, (c->serv));
+			irc_cur = irc_connecting = NULL;
+		}
+
+		for(size_t i = 0; i < sb_count(channels) - 1; ++i){
+			const char** c = (const char**)channels + i;
+
+			IRC_MOD_CALL(m, on_join, (*c, bot_nick));
+			util_module_join_bulk(m, *c, (const char**)chan_nicks[i], sb_count(chan_nicks[i]));
+		}
+	}
+
+	util_cmd_index_build();
+	util_ipc_routes_build();
+	util_meta_init();
+}
+
+static void util_inotify_add(INotifyWatch* watch, const char* path, uint32_t flags){
+
+	if(access(path, W_OK) != 0){
+		printf("Creating dir [%s] for inotify.\n", path);
+		if(mkdir(path, 00750) == -1){
+			perror("Error creating dir");
+		}
+	}
+
+	watch->path = strdup(path);
+	watch->wd   = inotify_add_watch(inotify.fd, path, flags);
+}
+
+static bool util_inotify_check(void){
+	struct inotify_event* ev;
+	char buff[sizeof(*ev) + NAME_MAX + 1];
+	bool reload = false;
+	bool updated_filter = false;
+
+	ssize_t num_read;
+	while((num_read = read(inotify.fd, buff, sizeof(buff))) > 0){
+		for(char* p = buff; (p - buff) < num_read; p += (sizeof(*ev) + ev->len)){
+			ev = (struct inotify_event*)p;
+
+			if(ev->wd == inotify.module.wd){
+				if(!updated_filter){
+					updated_filter = true;
+					util_module_filter_update();
+				}
+
+				Module* m = util_module_get(ev->name, MOD_GET_SONAME);
+				if(m){
+					m->needs_reload = true;
+				} else {
+					util_module_add(ev->name);
+					// XXX: Careful, this leaves some parts of the new irc_module null
+					//      if util_module_get is called later in the loop, it must check this
+				}
+				reload = true;
+			} else if(ev->wd == inotify.data.wd){
+				if(!memmem(ev->name, ev->len, ".data", 6)) continue;
+				fprintf(stderr, "%s was modified. %x\n", ev->name, ev->mask);
+
+				Module* m = util_module_get(strndupa(ev->name, strlen(ev->name) - 5), MOD_GET_CTXNAME);
+				if(m){
+					m->data_modified = true;
+				}
+			} else if(ev->wd == inotify.ipc.wd){
+				struct sockaddr_un addr;
+
+				assert(strlen(ev->name) + strlen(inotify.ipc.path) + 1 < sizeof(addr.sun_path));
+
+				strcpy(addr.sun_path, inotify.ipc.path);
+				strcat(addr.sun_path, ev->name);
+
+				if(ev->mask & IN_DELETE){
+					util_ipc_del(addr.sun_path);
+				} else {
+					util_ipc_add(addr.sun_path);
+				}
+			}
+		}
+	}
+
+	sb_each(m, irc_modules){
+		if(!m->data_modified) continue;
+		m->data_modified = false;
+
+		if(m->needs_reload) {
+			reload = true;
+		}
+
+		fprintf(stderr, "Calling on_data_modified for %s\n", m->ctx->name);
+		IRC_MOD_CALL(m, on_modified, ());
+
+		// the module just reloaded the data file, so the changes since it was last saved need applying again.
+		util_journal_flush(m);
+		util_journal_replay(m);
+	}
+
+	return reload;
+}
+
+static LIVE_ONLY void util_ipc_init(void){
+	char ipc_dir[100];
+	struct stat st;
+
+	// get dir to store ipc sockets
+
+	const char* ipc_dir_prefix   = getenv("XDG_RUNTIME_DIR");
+	const char  ipc_dir_suffix[] = "/insobot/";
+
+	if(!ipc_dir_prefix || stat(ipc_dir_prefix, &st) == -1 || !S_ISDIR(st.st_mode) || access(ipc_dir_prefix, W_OK) == -1){
+		ipc_dir_prefix = "/run/shm";
+	}
+
+	if(strlen(ipc_dir_prefix) + sizeof(ipc_dir_suffix) + 8 > sizeof(ipc_self.addr.sun_path)){
+		fprintf(stderr, "IPC dir name too long!");
+		return;
+	}
+
+	strcpy(ipc_dir, ipc_dir_prefix);
+	strcat(ipc_dir, ipc_dir_suffix);
+
+	if(stat(ipc_dir, &st) == -1){
+		if(mkdir(ipc_dir, 0777) == -1){
+			perror("ipc_init: mkdir");
+		}
+	}
+
+	// create our socket
+
+	ipc_self.id = getpid();
+	ipc_self.addr.sun_family = AF_UNIX;
+
+	snprintf(ipc_self.addr.sun_path, sizeof(ipc_self.addr.sun_path), "%s%d", ipc_dir, ipc_self.id);
+	unlink(ipc_self.addr.sun_path);
+
+	printf("IPC socket: %s\n", ipc_self.addr.sun_path);
+
+	ipc_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if(ipc_socket == -1){
+		perror("ipc_init: socket");
+	}
+
+	if(bind(ipc_socket, &ipc_self.addr, sizeof(ipc_self.addr)) == -1){
+		perror("ipc_init: bind");
+	}
+
+	// get all the peer addresses in the dir
+
+	util_inotify_add(&inotify.ipc, ipc_dir, IN_CREATE | IN_DELETE | IN_MOVED_TO);
+
+	strcat(ipc_dir, "*");
+
+	glob_t glob_data;
+	if(glob(ipc_dir, 0, NULL, &glob_data) != 0){
+		perror("ipc_init: glob");
+	} else {
+		for(size_t i = 0; i < glob_data.gl_pathc; ++i){
+			if(strcmp(ipc_self.addr.sun_path, glob_data.gl_pathv[i]) == 0) continue;
+
+			IPCAddress peer = {
+				.id   = atoi(basename(glob_data.gl_pathv[i])),
+				.addr = { .sun_family = AF_UNIX }
+			};
+
+			printf("ipc_init: adding peer %d [%s]\n", peer.id, glob_data.gl_pathv[i]);
+
+			strcpy(peer.addr.sun_path, glob_data.gl_pathv[i]);
+			sb_push(ipc_peers, peer);
+		}
+
+		globfree(&glob_data);
+	}
+
+	// check for stale peers
+
+	for(IPCAddress* p = ipc_peers; p < sb_end(ipc_peers); ++p){
+		if(connect(ipc_socket, &p->addr, sizeof(p->addr)) == -1){
+			if(errno == ECONNREFUSED){
+				unlink(p->addr.sun_path);
+			}
+			sb_erase(ipc_peers, p - ipc_peers);
+			--p;
+		} else {
+			struct sockaddr sa = { .sa_family = AF_UNSPEC };
+			connect(ipc_socket, &sa, sizeof(sa));
+		}
+	}
+
+	sb_each(p, ipc_peers){
+		util_ipc_hello(p);
+	}
+}
+
+static size_t util_ipc_ring_bytes(uint32_t size){
+	return sizeof(IPCRing) + size;
+}
+
+static void util_ipc_peer_free(IPCAddress* p){
+	if(p->tx){
+		munmap(p->tx, util_ipc_ring_bytes(p->tx->size));
+		close(p->tx_memfd);
+		close(p->tx_evfd);
+	}
+
+	if(p->rx){
+		util_epoll_ctl(EPOLL_CTL_DEL, p->rx_evfd, EV_IPC_RING, 0);
+		munmap(p->rx, util_ipc_ring_bytes(p->rx->size));
+		close(p->rx_evfd);
+	}
+
+	sb_free(p->tx_backlog);
+}
+
+// creates our ring for this peer and passes its memfd & eventfd over the socket.
+static void util_ipc_hello(IPCAddress* p){
+	if(!p->tx){
+		const size_t sz = util_ipc_ring_bytes(IPC_RING_SIZE);
+
+		int memfd = memfd_create("insobot-ipc", MFD_CLOEXEC);
+		int evfd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		void* mem = MAP_FAILED;
+
+		if(memfd != -1 && evfd != -1 && ftruncate(memfd, sz) == 0){
+			mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+		}
+
+		if(mem == MAP_FAILED){
+			perror("ipc_hello");
+			if(memfd != -1) close(memfd);
+			if(evfd  != -1) close(evfd);
+			return;
+		}
+
+		p->tx       = mem;
+		p->tx_memfd = memfd;
+		p->tx_evfd  = evfd;
+
+		p->tx->magic = IPC_RING_MAGIC;
+		p->tx->size  = IPC_RING_SIZE;
+	}
+
+	int fds[2] = { p->tx_memfd, p->tx_evfd };
+	char cbuf[CMSG_SPACE(sizeof(fds))] = {};
+
+	struct iovec iov = { .iov_base = (void*)ipc_ring_hello, .iov_len = sizeof(ipc_ring_hello) };
+	struct msghdr msg = {
+		.msg_name       = &p->addr,
+		.msg_namelen    = sizeof(p->addr),
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+		.msg_control    = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+
+	struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type  = SCM_RIGHTS;
+	c->cmsg_len   = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+	if(sendmsg(ipc_socket, &msg, 0) == -1){
+		perror("ipc_hello: sendmsg");
+	}
+}
+
+static IPCAddress* util_ipc_add(const char* name){
+	for(size_t i = 0; i < sb_count(ipc_peers); ++i){
+		if(strcmp(ipc_peers[i].addr.sun_path, name) == 0){
+			return ipc_peers + i;
+		}
+	}
+
+	IPCAddress peer = {
+		.id   = atoi(basename(name)),
+		.addr = {
+			.sun_family = AF_UNIX
+		}
+	};
+
+	strcpy(peer.addr.sun_path, name);
+	sb_push(ipc_peers, peer);
+
+	printf("ipc_add: %d: [%s]\n", peer.id, peer.addr.sun_path);
+
+	util_ipc_hello(&sb_last(ipc_peers));
+
+	return &sb_last(ipc_peers);
+}
+
+static void util_ipc_del(const char* name){
+	for(size_t i = 0; i < sb_count(ipc_peers); ++i){
+		if(strcmp(ipc_peers[i].addr.sun_path, name) == 0){
+			util_ipc_peer_free(ipc_peers + i);
+			sb_erase(ipc_peers, i);
+			break;
+		}
+	}
+}
+
+// forgets a peer that's gone or stopped reading, it gets added again if it sends us anything (a new hello).
+static void util_ipc_drop(IPCAddress* p, const char* why){
+	printf("ipc: dropping %d [%s]: %s\n", p->id, p->addr.sun_path, why);
+
+	if(kill(p->id, 0) == -1 && errno == ESRCH){
+		unlink(p->addr.sun_path);
+	}
+
+	util_ipc_peer_free(p);
+	sb_erase(ipc_peers, p - ipc_peers);
+}
+
+static IPCAddress* util_ipc_find(int id){
+	sb_each(p, ipc_peers){
+		if(p->id == id) return p;
+	}
+	return NULL;
+}
+
+static size_t util_ipc_route_hash(const void* arg){
+	return ((const IPCRoute*)arg)->hash;
+}
+
+static bool util_ipc_route_cmp(const void* elem, void* param){
+	const IPCRoute* r = elem;
+	return r->mod_idx < sb_count(irc_modules) && strcasecmp(irc_modules[r->mod_idx].ctx->name, param) == 0;
+}
+
+static void util_ipc_routes_build(void){
+	if(ipc_routes.memory){
+		inso_ht_free(&ipc_routes);
+	}
+	inso_ht_init(&ipc_routes, 64, sizeof(IPCRoute), &util_ipc_route_hash);
+
+	for(size_t i = 0; i < sb_count(irc_modules); ++i){
+		const char* name = irc_modules[i].ctx->name;
+		IPCRoute r = { .hash = inso_hash_nocase(name, 0), .mod_idx = i };
+		inso_ht_put(&ipc_routes, &r);
+	}
+}
+
+static void util_ipc_dispatch(int sender, uint32_t hash, const char* name, const uint8_t* data, size_t len){
+	if(!ipc_routes.memory) return;
+
+	IPCRoute* r = inso_ht_get(&ipc_routes, hash, &util_ipc_route_cmp, (void*)name);
+	if(r){
+		Module* m = irc_modules + r->mod_idx;
+		IRC_MOD_CALL(m, on_ipc, (sender, data, len));
+	}
+}
+
+static void util_ipc_recv(void){
+	char buffer[4096];
+	struct sockaddr_un addr;
+	int fds[2];
+	char cbuf[CMSG_SPACE(sizeof(fds))];
+
+	struct iovec iov = { .iov_base = buffer, .iov_len = sizeof(buffer) };
+	struct msghdr msg = {
+		.msg_name       = &addr,
+		.msg_namelen    = sizeof(addr),
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+		.msg_control    = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+
+	ssize_t num = recvmsg(ipc_socket, &msg, MSG_CMSG_CLOEXEC);
+	if(num == -1){
+		perror("ipc_recv: recvmsg");
+		return;
+	}
+
+	assert(addr.sun_family == AF_UNIX);
+
+	IPCAddress* peer = util_ipc_add(addr.sun_path);
+
+	int nfds = 0;
+	for(struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)){
+		if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS && c->cmsg_len == CMSG_LEN(sizeof(fds))){
+			memcpy(fds, CMSG_DATA(c), sizeof(fds));
+			nfds = 2;
+		}
+	}
+
+	if(num == sizeof(ipc_ring_hello) && memcmp(buffer, ipc_ring_hello, num) == 0){
+		struct stat st;
+		IPCRing* ring = MAP_FAILED;
+
+		if(nfds == 2 && fstat(fds[0], &st) == 0 && (size_t)st.st_size > sizeof(IPCRing)){
+			ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+		}
+
+		if(ring != MAP_FAILED && ring->magic == IPC_RING_MAGIC && util_ipc_ring_bytes(ring->size) == (size_t)st.st_size){
+
+			// a second hello means the peer started over (e.g. it dropped us), and doesn't have our old ring either.
+			if(peer->rx){
+				printf("ipc: %d sent a new ring, replacing ours too\n", peer->id);
+				util_ipc_peer_free(peer);
+				*peer = (IPCAddress){ .id = peer->id, .addr = peer->addr };
+				util_ipc_hello(peer);
+			}
+
+			printf("ipc: using shared memory with %d\n", peer->id);
+			peer->rx      = ring;
+			peer->rx_evfd = fds[1];
+			peer->tx_ok   = true;
+			util_epoll_ctl(EPOLL_CTL_ADD, fds[1], EV_IPC_RING, EPOLLIN);
+			close(fds[0]);
+			return;
+		}
+
+		if(ring != MAP_FAILED){
+			munmap(ring, st.st_size);
+		}
+
+		for(int i = 0; i < nfds; ++i){
+			close(fds[i]);
+		}
+		return;
+	}
+
+	for(int i = 0; i < nfds; ++i){
+		close(fds[i]);
+	}
+
+	size_t name_len = strnlen(buffer, num);
+	if(name_len == (size_t)num) return;
+
+	printf("Got IPC msg from %d for %s\n", peer->id, buffer);
+	util_ipc_dispatch(peer->id, inso_hash_nocase(buffer, name_len), buffer, (uint8_t*)buffer + name_len + 1, num - name_len - 1);
+}
+
+// reads everything a peer has put in its ring for us.
+static void util_ipc_ring_ready(int fd){
+	IPCAddress* peer = NULL;
+	sb_each(p, ipc_peers){
+		if(p->rx && p->rx_evfd == fd){
+			peer = p;
+			break;
+		}
+	}
+	if(!peer) return;
+
+	uint64_t count;
+	if(read(fd, &count, sizeof(count)) != sizeof(count) && errno != EAGAIN){
+		perror("ipc_ring_ready: read");
+	}
+
+	const int id = peer->id;
+	IPCRing* ring = peer->rx;
+
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	while(tail != head){
+		const size_t off = tail & (ring->size - 1);
+		IPCRecord rec;
+
+		if(head - tail > ring->size || ring->size - off < sizeof(rec)){
+			goto corrupt;
+		}
+
+		memcpy(&rec, ring->data + off, sizeof(rec));
+
+		if(rec.name_len == IPC_REC_SKIP){
+			tail += ring->size - off;
+			continue;
+		}
+
+		const size_t total = IPC_REC_SIZE(rec.len);
+		const char* name = ring->data + off + sizeof(rec);
+
+		if(total > ring->size - off || rec.name_len >= rec.len || name[rec.name_len] != '\0'){
+			goto corrupt;
+		}
+
+		util_ipc_dispatch(id, rec.hash, name, (uint8_t*)name + rec.name_len + 1, rec.len - rec.name_len - 1);
+
+		// a module might have caused the peer to be removed, or the peers array to move.
+		if(!(peer = util_ipc_find(id)) || peer->rx != ring){
+			return;
+		}
+
+		tail += total;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return;
+
+corrupt:
+	fprintf(stderr, "ipc: bad record from %d, skipping its ring ahead.\n", id);
+	__atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+}
+
+// appends a record to a peer's tx ring, returns false if there isn't room right now.
+static bool util_ipc_ring_put(IPCRing* ring, const IPCRecord* rec, const void* body){
+	const size_t total = IPC_REC_SIZE(rec->len);
+
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	size_t off    = head & (ring->size - 1);
+	size_t to_end = ring->size - off;
+	size_t need   = total + (to_end < total ? to_end : 0);
+
+	if(ring->size - (head - tail) < need) return false;
+
+	if(to_end < total){
+		IPCRecord skip = { .name_len = IPC_REC_SKIP };
+		memcpy(ring->data + off, &skip, sizeof(skip));
+		head += to_end;
+		off = 0;
+	}
+
+	memcpy(ring->data + off, rec, sizeof(*rec));
+	memcpy(ring->data + off + sizeof(*rec), body, rec->len);
+
+	__atomic_store_n(&ring->head, head + total, __ATOMIC_RELEASE);
+	return true;
+}
+
+// writes out any backlog & wakes up peers we've sent something to, once per trip around the main loop.
+// returns true if there's still a backlog waiting for space.
+static bool util_ipc_flush(void){
+	bool waiting = false;
+
+	for(IPCAddress* p = ipc_peers; p < sb_end(ipc_peers); ++p){
+		if(!p->tx) continue;
+
+		// nothing will ever read it if the peer died without its socket being removed.
+		if(sb_count(p->tx_backlog) && kill(p->id, 0) == -1 && errno == ESRCH){
+			util_ipc_drop(p, "process is gone");
+			--p;
+			continue;
+		}
+
+		size_t done = 0;
+		while(done < sb_count(p->tx_backlog)){
+			IPCRecord rec;
+			memcpy(&rec, p->tx_backlog + done, sizeof(rec));
+
+			if(!util_ipc_ring_put(p->tx, &rec, p->tx_backlog + done + sizeof(rec))) break;
+
+			done += sizeof(rec) + rec.len;
+			p->tx_signal = true;
+		}
+
+		if(done){
+			memmove(p->tx_backlog, p->tx_backlog + done, sb_count(p->tx_backlog) - done);
+			stb__sbn(p->tx_backlog) -= done;
+		}
+
+		if(sb_count(p->tx_backlog)){
+			waiting = true;
+		}
+
+		if(p->tx_signal){
+			p->tx_signal = false;
+			uint64_t one = 1;
+			if(write(p->tx_evfd, &one, sizeof(one)) == -1 && errno != EAGAIN){
+				perror("ipc_flush: write");
+			}
+		}
+	}
+
+	return waiting;
+}
+
+// channel / nick registry.
+// channels & chan_nicks are kept as the array views that get_channels / get_nicks hand out, but the lookups go
+// through hash tables keyed on case-folded names. Nicks are interned, so the views just point at the Nick's name.
+
+static size_t util_chan_key_hash(const void* arg){
+	return ((const ChanKey*)arg)->hash;
+}
+
+static bool util_chan_key_cmp(const void* elem, void* param){
+	return strcasecmp(((const ChanKey*)elem)->chan->name, param) == 0;
+}
+
+static bool util_chan_key_is(const void* elem, void* param){
+	return ((const ChanKey*)elem)->chan == param;
+}
+
+static size_t util_nick_key_hash(const void* arg){
+	return ((const NickKey*)arg)->hash;
+}
+
+static bool util_nick_key_cmp(const void* elem, void* param){
+	return strcasecmp(((const NickKey*)elem)->nick->name, param) == 0;
+}
+
+static bool util_nick_key_is(const void* elem, void* param){
+	return ((const NickKey*)elem)->nick == param;
+}
+
+static size_t util_member_hash(const void* arg){
+	uint64_t x = (uintptr_t)((const ChanMember*)arg)->nick;
+	x ^= x >> 33;
+	x *= UINT64_C(0xff51afd7ed558ccd);
+	x ^= x >> 33;
+	return x;
+}
+
+static bool util_member_cmp(const void* elem, void* param){
+	return ((const ChanMember*)elem)->nick == param;
+}
+
+static ChanMember* util_member_get(Channel* c, Nick* n){
+	return inso_ht_get(&c->members, util_member_hash(&(ChanMember){ .nick = n }), &util_member_cmp, n);
+}
+
+static void util_registry_init(void){
+	inso_ht_init(&chan_index, 64, sizeof(ChanKey), &util_chan_key_hash);
+	inso_ht_init(&nick_index, 1024, sizeof(NickKey), &util_nick_key_hash);
+	sb_push(channels, 0);
+}
+
+static Channel* util_chan_find(const char* name){
+	ChanKey* key = inso_ht_get(&chan_index, inso_hash_nocase(name, 0), &util_chan_key_cmp, (void*)name);
+	return key ? key->chan : NULL;
+}
+
+static Channel* util_chan_add(const char* name){
+	Channel* c = util_chan_find(name);
+	if(c) return c;
+
+	c = calloc(1, sizeof(*c));
+	assert(c);
+
+	c->name = strdup(name);
+	c->idx  = sb_count(chan_list);
+	c->conn = -1;
+	inso_ht_init(&c->members, 64, sizeof(ChanMember), &util_member_hash);
+
+	sb_push(chan_list, c);
+	sb_last(channels) = c->name;
+	sb_push(channels, 0);
+	sb_push(chan_nicks, 0);
+
+	inso_ht_put(&chan_index, &(ChanKey){ inso_hash_nocase(name, 0), c });
+
+	return c;
+}
+
+static IRCConn* util_conn_get(int id){
+	return (id >= 0 && (size_t)id < sb_count(irc_conns)) ? irc_conns + id : NULL;
+}
+
+static void util_chan_set_conn(Channel* c, int id){
+	IRCConn* old = util_conn_get(c->conn);
+	IRCConn* new = util_conn_get(id);
+
+	if(old) --old->num_chans;
+	if(new) ++new->num_chans;
+
+	c->conn   = id;
+	c->joined = false;
+}
+
+// the connection a new channel should go on: whichever has the fewest.
+static int util_conn_pick(void){
+	int best = -1;
+	sb_each(c, irc_conns){
+		if(best == -1 || c->num_chans < irc_conns[best].num_chans){
+			best = c->id;
+		}
+	}
+	return best;
+}
+
+static Nick* util_nick_find(const char* name){
+	NickKey* key = inso_ht_get(&nick_index, inso_hash_nocase(name, 0), &util_nick_key_cmp, (void*)name);
+	return key ? key->nick : NULL;
+}
+
+static Nick* util_nick_intern(const char* name){
+	Nick* n = util_nick_find(name);
+	if(n) return n;
+
+	n = calloc(1, sizeof(*n));
+	assert(n);
+
+	n->name = strdup(name);
+	inso_ht_put(&nick_index, &(NickKey){ inso_hash_nocase(name, 0), n });
+
+	return n;
+}
+
+// frees the nick once it isn't in any channels
+static void util_nick_release(Nick* n){
+	if(sb_count(n->chans)) return;
+
+	inso_ht_del(&nick_index, inso_hash_nocase(n->name, 0), &util_nick_key_is, n);
+	sb_free(n->chans);
+	free(n->name);
+	free(n);
+}
+
+static void util_chan_add_nick(Channel* c, const char* name){
+	Nick* n = util_nick_intern(name);
+	if(util_member_get(c, n)) return;
+
+	inso_ht_put(&c->members, &(ChanMember){ n, sb_count(c->nicks) });
+	sb_push(c->nicks, n);
+	sb_push(chan_nicks[c->idx], n->name);
+	sb_push(n->chans, c);
+}
+
+// removes n from c, but leaves it interned even if that was its last channel.
+static void util_chan_unlink_nick(Channel* c, Nick* n){
+	ChanMember* mem = util_member_get(c, n);
+	if(!mem) return;
+
+	// swap the last nick into this one's place in the views
+	uint32_t i = mem->idx;
+	inso_ht_del(&c->members, util_member_hash(mem), &util_member_cmp, n);
+
+	size_t last = sb_count(c->nicks) - 1;
+	if(i != last){
+		Nick* moved = c->nicks[last];
+		c->nicks[i] = moved;
+		chan_nicks[c->idx][i] = moved->name;
+		util_member_get(c, moved)->idx = i;
+	}
+	sb_pop(c->nicks);
+	sb_pop(chan_nicks[c->idx]);
+
+	for(size_t j = 0; j < sb_count(n->chans); ++j){
+		if(n->chans[j] == c){
+			n->chans[j] = sb_last(n->chans);
+			sb_pop(n->chans);
+			break;
+		}
+	}
+}
+
+static void util_chan_del_nick(Channel* c, Nick* n){
+	util_chan_unlink_nick(c, n);
+	util_nick_release(n);
+}
+
+static void util_chan_del(Channel* c){
+	util_chan_set_conn(c, -1);
+
+	while(sb_count(c->nicks)){
+		util_chan_del_nick(c, sb_last(c->nicks));
+	}
+
+	sb_free(chan_nicks[c->idx]);
+
+	// swap the last channel into this one's place in the views
+	size_t last = sb_count(chan_list) - 1;
+	if(c->idx != last){
+		Channel* moved = chan_list[last];
+		moved->idx = c->idx;
+
+		chan_list[moved->idx]  = moved;
+		channels[moved->idx]   = moved->name;
+		chan_nicks[moved->idx] = chan_nicks[last];
+	}
+
+	sb_pop(chan_list);
+	sb_pop(chan_nicks);
+	sb_pop(channels);
+	channels[last] = NULL;
+
+	inso_ht_del(&chan_index, inso_hash_nocase(c->name, 0), &util_chan_key_is, c);
+
+	inso_ht_free(&c->members);
+	sb_free(c->nicks);
+	free(c->name);
+	free(c);
+}
+
+static void util_nick_rename(Nick* n, const char* new_name){
+	Nick* other = util_nick_find(new_name);
+
+	// the new name is already known (e.g. we missed a part), move n's channels over to it instead.
+	if(other && other != n){
+		while(sb_count(n->chans)){
+			Channel* c = sb_last(n->chans);
+
+			if(util_member_get(c, other)){
+				util_chan_unlink_nick(c, n);
+				continue;
+			}
+
+			ChanMember* mem = util_member_get(c, n);
+			uint32_t i = mem->idx;
+			inso_ht_del(&c->members, util_member_hash(mem), &util_member_cmp, n);
+			inso_ht_put(&c->members, &(ChanMember){ other, i });
+
+			c->nicks[i] = other;
+			chan_nicks[c->idx][i] = other->name;
+			sb_push(other->chans, c);
+			sb_pop(n->chans);
+		}
+
+		util_nick_release(n);
+		return;
+	}
+
+	inso_ht_del(&nick_index, inso_hash_nocase(n->name, 0), &util_nick_key_is, n);
+
+	free(n->name);
+	n->name = strdup(new_name);
+
+	inso_ht_put(&nick_index, &(NickKey){ inso_hash_nocase(new_name, 0), n });
+
+	sb_each(c, n->chans){
+		ChanMember* mem = util_member_get(*c, n);
+		chan_nicks[(*c)->idx][mem->idx] = n->name;
+	}
+}
+
+static void util_registry_free(void){
+	while(sb_count(chan_list)){
+		util_chan_del(sb_last(chan_list));
+	}
+
+	sb_free(chan_list);
+	sb_free(channels);
+	sb_free(chan_nicks);
+	inso_ht_free(&chan_index);
+	inso_ht_free(&nick_index);
+}
+
+static void util_trim_end_spaces(char* msg, size_t len){
+	if(len > 0){
+		for(char* p = msg + len - 1; p >= msg && *p == ' '; --p){
+			*p = 0;
+		}
+	}
+}
+
+// the tags are only copied here, they're split up when a module first asks for one.
+static void util_update_tags(const char** params){
+	if(!have_tag_hack) return;
+
+	const char* tags = params[-1] ? params[-1] : "";
+	size_t len = strlen(tags) + 1;
+
+	if(irc_tag_buf){
+		stb__sbn(irc_tag_buf) = 0;
+	}
+	memcpy(sb_add(irc_tag_buf, len), tags, len);
+
+	irc_tags_parsed = false;
+}
+
+static void util_tags_parse(void){
+	if(irc_tags_parsed) return;
+	irc_tags_parsed = true;
+
+	if(irc_tags){
+		stb__sbn(irc_tags) = 0;
+	}
+
+	if(!irc_tag_buf) return;
+
+	char* state;
+	char* k = strtok_r(irc_tag_buf, ";", &state);
+
+	for(; k; k = strtok_r(NULL, ";", &state)){
+		char* v = strchrnul(k, '=');
+
+		if(*v == '='){
+			*v++ = '\0';
+		}
+
+		IRCTag tag = {
+			.key  = k,
+			.val  = v,
+			.hash = inso_hash_nocase(k, 0),
+		};
+		sb_push(irc_tags, tag);
+	}
+
+	// open addressing table at most half full, so lookups by name don't have to compare every key.
+	size_t num_slots = 16;
+	while(num_slots < sb_count(irc_tags) * 2){
+		num_slots *= 2;
+	}
+
+	if(irc_tag_slots){
+		stb__sbn(irc_tag_slots) = 0;
+	}
+	memset(sb_add(irc_tag_slots, num_slots), 0, num_slots * sizeof(*irc_tag_slots));
+
+	for(size_t i = 0; i < sb_count(irc_tags); ++i){
+		size_t slot = irc_tags[i].hash & (num_slots - 1);
+		while(irc_tag_slots[slot]){
+			slot = (slot + 1) & (num_slots - 1);
+		}
+		irc_tag_slots[slot] = i + 1;
+	}
+}
+
+static const char* util_tag_value(IRCTag* tag){
+	if(tag->unescaped){
+		return tag->val;
+	}
+	tag->unescaped = true;
+
+	// the unescaped value is never longer, so it's done in place.
+	char* w = tag->val;
+	for(const char* r = tag->val; *r; ++r){
+		if(*r != '\\'){
+			*w++ = *r;
+			continue;
+		}
+
+		switch(*++r){
+			case ':':  *w++ = ';';  break;
+			case 's':  *w++ = ' ';  break;
+			case 'r':  *w++ = '\r'; break;
+			case 'n':  *w++ = '\n'; break;
+			case '\0': --r;         break;
+			default:   *w++ = *r;   break;
+		}
+	}
+	*w = '\0';
+
+	return tag->val;
+}
+
+static const char* util_tag_get(const char* key){
+	util_tags_parse();
+
+	if(!sb_count(irc_tags)){
+		return NULL;
+	}
+
+	const size_t mask = sb_count(irc_tag_slots) - 1;
+	const uint32_t hash = inso_hash_nocase(key, 0);
+
+	for(size_t slot = hash & mask; irc_tag_slots[slot]; slot = (slot + 1) & mask){
+		IRCTag* tag = irc_tags + irc_tag_slots[slot] - 1;
+		if(tag->hash == hash && strcmp(tag->key, key) == 0){
+			return util_tag_value(tag);
+		}
+	}
+
+	return NULL;
+}
+
+static char* util_file_read(const char* name){
+	char* mem = NULL;
+	long len = 0;
+	FILE* f = fopen(name, "r");
+	if(!f) return NULL;
+
+	if(fseek(f, 0, SEEK_END) == -1) goto end;
+	if((len = ftell(f)) == -1) goto end;
+	if(fseek(f, 0, SEEK_SET) == -1) goto end;
+
+	mem = malloc(len + 1);
+	assert(mem);
+
+	fread(mem, len, 1, f);
+	mem[len] = 0;
+
+end:
+	fclose(f);
+	return mem;
+}
+
+static bool util_module_filter_update_file(const char* name, char** list){
+	char pathbuf[PATH_MAX];
+	snprintf(pathbuf, sizeof(pathbuf), "%s/%s", insobot_path, name);
+
+	if(*list) stb__sbn(*list) = 0;
+
+	char* mem = util_file_read(pathbuf);
+	if(mem){
+		char* state;
+
+		for(char* line = strtok_r(mem, "\r\n", &state); line; line = strtok_r(NULL, "\r\n", &state)){
+			if(strchr(line, '/')) continue;
+
+			size_t len = strlen(line);
+			sb_push(*list, '/');
+			memcpy(sb_add(*list, len), line, len);
+		}
+
+		if(sb_count(*list)){
+			sb_push(*list, 0);
+		}
+
+		free(mem);
+	} else if(errno != ENOENT){
+		fprintf(stderr, "Error reading %s: %m\n", name);
+	}
+
+	return sb_count(*list) > 0;
+}
+
+static void util_module_filter_update(void){
+	bool inc = util_module_filter_update_file("modules.include", &modules_include);
+	bool exc = util_module_filter_update_file("modules.exclude", &modules_exclude);
+	if(inc && exc){
+		printf("WARNING: Both modules.include and modules.exclude exist. Only modules.include will be used.\n");
+	}
+}
+
+static bool util_module_filter_allowed(const char* module){
+	char* base = strdupa(basename(module));
+	if(strncmp(base, "mod_", 4) == 0){
+		base += 4;
+	}
+
+	{
+		char* p = strrchr(base, '.');
+		if(p && strcmp(p, ".so") == 0){
+			*p = 0;
+		}
+	}
+
+	size_t mod_len = strlen(base);
+	char* p = sb_count(modules_include) ? modules_include : modules_exclude;
+	bool ret = p == modules_include;
+
+	if(p){
+		while((p = strstr(p, base))){
+			if(p && p[-1] == '/' && (p[mod_len] == '/' || !p[mod_len])){
+				return ret;
+			}
+			++p;
+		}
+		return !ret;
+	} else {
+		return true;
+	}
+}
+
+void util_check_data_migrate(const char* path){
+	char oldpath[PATH_MAX];
+	char newpath[PATH_MAX];
+
+	snprintf(oldpath, sizeof(oldpath), "%s/modules/data", path);
+	snprintf(newpath, sizeof(newpath), "%s/data", path);
+
+	if(access(newpath, F_OK) == 0){
+		// new location already exists, skip.
+		return;
+	}
+
+	struct stat st;
+	if(stat(oldpath, &st) == 0 && S_ISDIR(st.st_mode)){
+		printf("******************************************************************************\n"
+		       "* The location of module data files has changed from /modules/data to /data. *\n"
+		       "* This allows the modules directory to be symlinked and used by multiple bot *\n"
+		       "*           instances, while each bot keeps its own set of data.             *\n"
+		       "*   Press Y to move this directory, or N to keep it where it is currently.   *\n"
+		       "*     If not moved, the bot will start with a blank set of module data.      *\n"
+		       "******************************************************************************");
+
+		int opt = 0;
+		if(isatty(STDOUT_FILENO)){
+			do {
+				if(opt != '\n'){
+					printf("\nMove the data directory? (Y/N) > ");
+					fflush(stdout);
+				}
+				opt = getchar();
+			} while(!strchr("yYnN", opt));
+		} else {
+			printf("stdout isn't a tty, assuming Y.\n");
+			opt = 'y';
+		}
+
+		if(opt == 'y' || opt == 'Y'){
+			if(rename(oldpath, newpath) == -1){
+				perror("rename");
+			} else {
+				printf("Successfully moved data directory.\n");
+			}
+		} else {
+			printf("Keeping old data directory in place.\n");
+		}
+	}
+}
+
+/*****************
+ * IRC Callbacks *
  *****************/
 
-IRC_STR_CALLBACK(on_connect) {
-	printf("Our nick is %s\n", params[0]);
-	free(bot_nick);
-	bot_nick = strdup(params[0]);
+IRC_STR_CALLBACK(on_connect) {
+	printf("Our nick is %s\n", params[0]);
+	free(bot_nick);
+	bot_nick = strdup(params[0]);
+
+	printf("connect origin = %s\n", origin_full);
+
+	IRCConn* conn = irc_cur;
+	if(!conn) return;
+
+	conn->registered = true;
+
+	irc_connecting = conn;
+	IRC_MOD_CALL_ALL(on_connect, (conn->serv));
+	irc_connecting = NULL;
+
+	// join anything that was put on this connection while it was down.
+	for(size_t i = 0; i < sb_count(chan_list); ++i){
+		Channel* c = chan_list[i];
+		if(c->conn == conn->id && c->want_join){
+			c->want_join = false;
+			util_cmd_enqueue(IRC_CMD_JOIN, c->name, NULL);
+		}
+	}
+}
+
+// message prefilters (IRCMsgPrefilter), so modules don't get on_msg for chatter they'd ignore anyway.
+// has_url uses the message view (util_msg_view_begin must have been called), which is built at most once per
+// message however many modules ask. substrs is searched for separately for each module that has it.
+static bool util_prefilter_match(const Module* m, const char* chan, const char* msg){
+	if(!ABI_CHECK(m, ABI_PREFILTER) || !m->ctx->prefilter){
+		return true;
+	}
+
+	const IRCMsgPrefilter* pf = m->ctx->prefilter;
+
+	if(pf->first_chars && (!*msg || !strchr(pf->first_chars, *msg))){
+		return false;
+	}
+
+	if(pf->chans){
+		const char** c = pf->chans;
+		while(*c && strcasecmp(*c, chan) != 0) ++c;
+		if(!*c) return false;
+	}
+
+	if(pf->has_url && core_get_msg_view()->num_urls == 0){
+		return false;
+	}
+
+	if(pf->substrs){
+		const char** s = pf->substrs;
+		while(*s && !strcasestr(msg, *s)) ++s;
+		if(!*s) return false;
+	}
+
+	return true;
+}
+
+// copies src to dst without mIRC formatting codes (bold, colors etc), returns the length written.
+// dst must have space for strlen(src)+1, or be src itself.
+static size_t util_strip_mirc(char* dst, const char* src){
+	char* out = dst;
+
+	while(*src){
+		switch(*src){
+			case 0x02: case 0x0F: case 0x11: case 0x16: case 0x1D: case 0x1E: case 0x1F: {
+				++src;
+			} break;
+
+			// \x03[fg[,bg]] with 1 or 2 digit colors
+			case 0x03: {
+				++src;
+				for(int i = 0; i < 2 && isdigit((uint8_t)*src); ++i) ++src;
+				if(*src == ',' && isdigit((uint8_t)src[1])){
+					++src;
+					for(int i = 0; i < 2 && isdigit((uint8_t)*src); ++i) ++src;
+				}
+			} break;
+
+			// \x04[RRGGBB[,RRGGBB]]
+			case 0x04: {
+				++src;
+				for(int i = 0; i < 6 && isxdigit((uint8_t)*src); ++i) ++src;
+				if(*src == ',' && isxdigit((uint8_t)src[1])){
+					++src;
+					for(int i = 0; i < 6 && isxdigit((uint8_t)*src); ++i) ++src;
+				}
+			} break;
+
+			default: {
+				*out++ = *src++;
+			}
+		}
+	}
+
+	*out = '\0';
+	return out - dst;
+}
+
+// url scanning, for IRCMsgView.urls. it works on one word at a time, most words are skipped by the memchrs.
+
+static const struct {
+	const char* host;
+	int         host_class;
+} url_hosts[] = {
+	{ "youtube.com"                 , IRC_HOST_YOUTUBE },
+	{ "youtu.be"                    , IRC_HOST_YOUTUBE },
+	{ "y2u.be"                      , IRC_HOST_YOUTUBE },
+	{ "youtube-nocookie.com"        , IRC_HOST_YOUTUBE },
+	{ "twitter.com"                 , IRC_HOST_TWITTER },
+	{ "twitch.tv"                   , IRC_HOST_TWITCH  },
+	{ "github.com"                  , IRC_HOST_GITHUB  },
+	{ "store.steampowered.com"      , IRC_HOST_STEAM   },
+	{ "vimeo.com"                   , IRC_HOST_VIMEO   },
+	{ "xkcd.com"                    , IRC_HOST_XKCD    },
+	{ "msdn.microsoft.com"          , IRC_HOST_MSDN    },
+	{ "handmade.network"            , IRC_HOST_HMN     },
+	{ "guide.handmadehero.org"      , IRC_HOST_CINERA  },
+	{ "guide.handmade-seattle.com"  , IRC_HOST_CINERA  },
+	{ "guide.riscy.tv"              , IRC_HOST_CINERA  },
+};
+
+// host is lowercase. it matches an entry if it's the same, or a subdomain of it.
+static int util_url_host_class(const char* host, size_t len){
+	for(size_t i = 0; i < ARRAY_SIZE(url_hosts); ++i){
+		size_t n = strlen(url_hosts[i].host);
+		if(n > len || memcmp(host + len - n, url_hosts[i].host, n) != 0) continue;
+
+		if(n == len || host[len - n - 1] == '.'){
+			return url_hosts[i].host_class;
+		}
+	}
+	return IRC_HOST_OTHER;
+}
+
+static bool util_url_host_char(uint8_t c){
+	return isalnum(c) || c == '-' || c == '.' || c >= 0x80;
+}
+
+// looks for a url in the word at plain+off, adds it to msg_view_urls if there is one.
+static void util_url_scan_word(const char* plain, const char* lower, uint32_t off, uint32_t len){
+	static const char lead_punct[]  = "<([{\"'";
+	static const char trail_punct[] = ">)]}\"'.,;:!?";
+
+	const char* w = plain + off;
+	const char* scheme_end = memchr(w, ':', len);
+	const char* dot = memchr(w, '.', len);
+
+	if(!dot && !scheme_end) return;
+
+	while(len && strchr(lead_punct, *w)){
+		++w, ++off, --len;
+	}
+	while(len && strchr(trail_punct, w[len-1])){
+		--len;
+	}
+
+	const char* end = w + len;
+	const char* host = w;
+	bool has_scheme = false;
+
+	if((scheme_end = memchr(w, ':', len)) && end - scheme_end >= 3 && memcmp(scheme_end, "://", 3) == 0){
+		has_scheme = scheme_end > w;
+		for(const char* p = w; p < scheme_end; ++p){
+			if(!isalpha((uint8_t)*p) && !strchr("+-.", *p)) has_scheme = false;
+		}
+		if(!has_scheme) return;
+		host = scheme_end + 3;
+	}
+
+	const char* host_end = host;
+	while(host_end < end && !strchr("/?#", *host_end)) ++host_end;
+
+	// skip user@ and :port
+	const char* at = memrchr(host, '@', host_end - host);
+	if(at){
+		if(!has_scheme) return; // an email address
+		host = at + 1;
+	}
+
+	const char* port = memchr(host, ':', host_end - host);
+	if(port){
+		for(const char* p = port + 1; p < host_end; ++p){
+			if(!isdigit((uint8_t)*p)) return;
+		}
+		host_end = port;
+	}
+
+	if(host == host_end || *host == '.' || host_end[-1] == '.') return;
+
+	const char* last_dot = NULL;
+	for(const char* p = host; p < host_end; ++p){
+		if(!util_url_host_char(*p)) return;
+		if(*p == '.'){
+			if(p[-1] == '.') return;
+			last_dot = p;
+		}
+	}
+
+	// without a scheme it needs to look like a domain: something.tld, with at least 2 letters in the tld.
+	if(!has_scheme){
+		if(!last_dot || host_end - last_dot < 3) return;
+		for(const char* p = last_dot + 1; p < host_end; ++p){
+			if(!isalpha((uint8_t)*p) && (uint8_t)*p < 0x80) return;
+		}
+	}
+
+	uint32_t host_off = host - plain;
+	uint32_t host_len = host_end - host;
+
+	IRCMsgUrl url = {
+		.span       = { off, len },
+		.host       = { host_off, host_len },
+		.host_class = util_url_host_class(lower + host_off, host_len),
+	};
+	sb_push(msg_view_urls, url);
+}
+
+static void util_msg_view_build(void){
+	const char* src = msg_view_src;
+	size_t len = strlen(src);
+
+	if(msg_view_plain) stb__sbn(msg_view_plain) = 0;
+	if(msg_view_lower) stb__sbn(msg_view_lower) = 0;
+	if(msg_view_words) stb__sbn(msg_view_words) = 0;
+	if(msg_view_urls)  stb__sbn(msg_view_urls)  = 0;
+
+	char* plain = sb_add(msg_view_plain, len + 1);
+	size_t plain_len = util_strip_mirc(plain, src);
+
+	char* lower = sb_add(msg_view_lower, plain_len + 1);
+	for(size_t i = 0; i <= plain_len; ++i){
+		lower[i] = (plain[i] >= 'A' && plain[i] <= 'Z') ? plain[i] | 0x20 : plain[i];
+	}
+
+	for(size_t i = 0; i < plain_len;){
+		if(plain[i] == ' '){
+			++i;
+			continue;
+		}
+
+		const char* end = memchr(plain + i, ' ', plain_len - i);
+		size_t word_len = end ? (size_t)(end - (plain + i)) : plain_len - i;
+
+		IRCMsgSpan span = { i, word_len };
+		sb_push(msg_view_words, span);
+
+		util_url_scan_word(plain, lower, i, word_len);
+
+		i += word_len;
+	}
+
+	util_tags_parse();
+
+	msg_view = (IRCMsgView){
+		.text      = src,
+		.len       = len,
+		.plain     = plain,
+		.plain_len = plain_len,
+		.lower     = lower,
+		.words     = msg_view_words,
+		.num_words = sb_count(msg_view_words),
+		.urls      = msg_view_urls,
+		.num_urls  = sb_count(msg_view_urls),
+		.num_tags  = sb_count(irc_tags),
+	};
+
+	msg_view_built = true;
+}
+
+// sets the message get_msg_view describes, returns the previous one to give to util_msg_view_end.
+// (gen_event can handle a message inside another's callbacks)
+static const char* util_msg_view_begin(const char* msg){
+	const char* prev = msg_view_src;
+	msg_view_src = msg;
+	msg_view_built = false;
+	return prev;
+}
+
+static void util_msg_view_end(const char* prev){
+	msg_view_src = prev;
+	msg_view_built = false;
+}
+
+IRC_STR_CALLBACK(on_chat_msg) {
+	if(count < 2 || !params[0] || !params[1]) return;
+
+	util_update_tags(params);
+
+	char _name[128] = "";
+	irc_target_get_nick(origin_full, _name, sizeof(_name));
+
+	const char *_chan = params[0];
+	util_trace_set_chan(util_chan_find(_chan));
+
+	size_t msglen = strlen(params[1]);
+	char*  msgbuf = alloca(msglen+2);
+	char*  _msg   = msgbuf + 1;
+
+	// null-prefix the msg, so that cmds can walk backwards to see the full msg
+	*msgbuf = 0;
+	memcpy(_msg, params[1], msglen+1);
+
+	util_trim_end_spaces(_msg, msglen);
+
+	send_msg_called = false;
+
+	CmdAlias alias = {};
+	util_cmd_lookup(_msg, &alias);
+	CmdTarget* target = alias.targets;
+
+	const char* prev_view = util_msg_view_begin(_msg);
+
+	sb_each(m, irc_modules){
+		bool global = m->ctx->flags & IRC_MOD_GLOBAL;
+		uint32_t mod_idx = m - irc_modules;
+
+		if(target && target < alias.targets + alias.count && target->mod_idx == mod_idx){
+			bool allowed = global || util_check_perms(m, _chan, IRC_CB_CMD);
+
+			for(; target < alias.targets + alias.count && target->mod_idx == mod_idx; ++target){
+				if(allowed){
+					IRC_MOD_CALL(m, on_cmd, (_chan, _name, _msg + alias.len, target->cmd_idx));
+				}
+			}
+		}
+
+		if(m->ctx->on_msg && util_prefilter_match(m, _chan, _msg) && (global || util_check_perms(m, _chan, IRC_CB_MSG))){
+			IRC_MOD_CALL(m, on_msg, (_chan, _name, _msg));
+		}
+	}
+
+	util_msg_view_end(prev_view);
+}
+
+IRC_STR_CALLBACK(on_action) {
+	if(count < 2 || !params[0] || !params[1]) return;
+
+	util_update_tags(params);
+
+	char _name[128] = "";
+	irc_target_get_nick(origin_full, _name, sizeof(_name));
+
+	const char *_chan = params[0];
+	char* _msg = strdupa(params[1]);
+	util_trace_set_chan(util_chan_find(_chan));
+	util_trim_end_spaces(_msg, strlen(_msg));
+
+	const char* prev_view = util_msg_view_begin(_msg);
+
+	sb_each(m, irc_modules){
+		if(!m->ctx->on_action || !util_prefilter_match(m, _chan, _msg)) continue;
+
+		if((m->ctx->flags & IRC_MOD_GLOBAL) || util_check_perms(m, _chan, IRC_CB_ACTION)){
+			IRC_MOD_CALL(m, on_action, (_chan, _name, _msg));
+		}
+	}
+
+	util_msg_view_end(prev_view);
+}
+
+IRC_STR_CALLBACK(on_pm){
+	if(count < 2 || !params[1] || !origin_full) return;
+
+	util_update_tags(params);
+
+	char _name[128] = "";
+	irc_target_get_nick(origin_full, _name, sizeof(_name));
+
+	char* _msg = strdupa(params[1]);
+	util_trim_end_spaces(_msg, strlen(_msg));
+
+	const char* prev_view = util_msg_view_begin(_msg);
+	IRC_MOD_CALL_ALL(on_pm, (_name, _msg));
+	util_msg_view_end(prev_view);
+}
+
+IRC_STR_CALLBACK(on_join) {
+	if(count < 1 || !origin_full || !params[0]) return;
+
+	char origin[128] = "";
+	irc_target_get_nick(origin_full, origin, sizeof(origin));
+
+	fprintf(stderr, "JOIN: %s %s\n", params[0], origin);
+
+	Channel* chan = util_chan_add(params[0]);
+	util_chan_add_nick(chan, origin);
+	util_trace_set_chan(chan);
+
+	if(strcmp(origin, bot_nick) == 0){
+
+		if(irc_cur){
+			if(chan->conn != irc_cur->id){
+				util_chan_set_conn(chan, irc_cur->id);
+			}
+			chan->joined    = true;
+			chan->want_join = false;
+		}
+
+		// if we're joining the debug channel, set the global so we know we can now send stuff
+		const char* c = getenv("INSOBOT_DEBUG_CHAN");
+		if(c && strcmp(params[0], c) == 0){
+			debug_chan = c;
+		}
+
+		if(strlen(origin_full) > strlen(origin)){
+			bot_host_len = strlen(origin_full);
+			printf("new host len: %zu\n", bot_host_len);
+		}
+	}
+
+	//XXX: can't use CHECK here unless our own name bypasses it FIXME
+	IRC_MOD_CALL_ALL(on_join, (params[0], origin));
+}
+
+static void util_module_join_bulk(Module* m, const char* chan, const char** names, size_t count){
+	if(!count) return;
+
+	if(ABI_CHECK(m, ABI_JOIN_BULK) && m->ctx->on_join_bulk){
+		IRC_MOD_CALL(m, on_join_bulk, (chan, names, count));
+	} else if(m->ctx->on_join){
+		for(size_t i = 0; i < count; ++i){
+			IRC_MOD_CALL(m, on_join, (chan, names[i]));
+		}
+	}
+}
+
+IRC_STR_CALLBACK(on_part) {
+	if(count < 1 || !origin_full || !params[0]) return;
+
+	char origin[128] = "";
+	irc_target_get_nick(origin_full, origin, sizeof(origin));
+
+	printf("PART: %s %s\n", params[0], origin);
+
+	Channel* c = util_chan_find(params[0]);
+	util_trace_set_chan(c);
+	Nick* n;
+
+	if(c && strcasecmp(origin, bot_nick) == 0){
+		util_chan_del(c);
+	} else if(c && (n = util_nick_find(origin))){
+		util_chan_del_nick(c, n);
+	}
+
+	IRC_MOD_CALL_ALL_CHECK(on_part, (params[0], origin), IRC_CB_PART);
+}
+
+IRC_STR_CALLBACK(on_quit) {
+	if(!origin_full) return;
+
+	char origin[128] = "";
+	irc_target_get_nick(origin_full, origin, sizeof(origin));
+
+	util_update_tags(params);
+
+	printf("QUIT: %s\n", origin);
+
+	Nick* n = util_nick_find(origin);
+	if(!n) return;
+
+	// remove them everywhere before calling on_part, since modules could make us part channels from it.
+	char** parted = NULL;
+	for(size_t i = sb_count(n->chans); i > 0; --i){
+		Channel* c = n->chans[i-1];
+		sb_push(parted, strdup(c->name));
+		util_chan_del_nick(c, n); // frees n after the last one
+	}
+
+	sb_each(chan, parted){
+		IRC_MOD_CALL_ALL_CHECK(on_part, (*chan, origin), IRC_CB_PART);
+		free(*chan);
+	}
+	sb_free(parted);
+}
+
+IRC_STR_CALLBACK(on_nick) {
+	if(count < 1 || !origin_full || !params[0]) return;
+
+	char origin[128] = "";
+	irc_target_get_nick(origin_full, origin, sizeof(origin));
+
+	util_update_tags(params);
+
+	if(strcmp(origin, bot_nick) == 0){
+		printf("We changed nicks! new nick: %s\n", params[0]);
+		free(bot_nick);
+		bot_nick = strdup(params[0]);
+	}
+
+	Nick* n = util_nick_find(origin);
+	if(n){
+		util_nick_rename(n, params[0]);
+	}
+
+	IRC_MOD_CALL_ALL(on_nick, (origin, params[0]));
+}
+
+IRC_STR_CALLBACK(on_unknown) {
+	util_update_tags(params);
+
+	char origin[128] = "";
+	irc_target_get_nick(origin_full, origin, sizeof(origin));
+
+	if(strcmp(event, "PONG") == 0){
+//		printf(":: PONG");
+		return;
+	} else {
+		printf("Unknown event:\n:: %s :: %s", event, origin);
+	}
+
+	if(strcmp(event, "USERSTATE") == 0 && count >= 1 && params[0]){
+		// twitch sends this on join and after each message, with the mod / broadcaster status we have there.
+		const char* mod    = util_tag_get("mod");
+		const char* badges = util_tag_get("badges");
+		util_cmd_set_mod(params[0], (mod && strcmp(mod, "1") == 0) || (badges && strstr(badges, "broadcaster/")));
+	}
+
+	for(size_t i = 0; i < count; ++i){
+		printf(" :: %s", params[i]);
+	}
+	puts("");
+
+	util_trace_set_chan(count ? util_chan_find(params[0]) : NULL);
+	IRC_MOD_CALL_ALL_ABI(on_unknown, (event, origin, params, count), ABI_UNKNOWN);
+}
+
+IRC_STR_CALLBACK(on_mode) {
+	if(count < 3 || !params[0] || !params[1] || !params[2]) return;
+
+	if(strcasecmp(params[2], bot_nick) == 0){
+		if(strcmp(params[1], "+o") == 0){
+			util_cmd_set_mod(params[0], true);
+		} else if(strcmp(params[1], "-o") == 0){
+			util_cmd_set_mod(params[0], false);
+		}
+	}
+}
+
+IRC_STR_CALLBACK(on_invite) {
+	if(count < 2 || !origin_full || !params[1]) return;
+	printf("We got invited to [%s] by [%s]\n", params[1], origin_full);
+	core_join(params[1]);
+}
+
+IRC_NUM_CALLBACK(on_numeric) {
+	static const char nick_start_symbols[] = "[]\\`_^{|}";
+
+	if(event == LIBIRC_RFC_RPL_NAMREPLY && count >= 4 && params[3]){
+		char *names = strdup(params[3]),
+		     *state = NULL,
+		     *n     = strtok_r(names, " ", &state);
+
+		const char* chan_name = params[2];
+		Channel* chan = util_chan_add(chan_name);
+		const char** list = NULL;
+
+		util_trace_set_chan(chan);
+
+		for(; n; n = strtok_r(NULL, " ", &state)){
+			if(!isalpha(*n) && !strchr(nick_start_symbols, *n)){
+				++n;
+			}
+			util_chan_add_nick(chan, n);
+			sb_push(list, n);
+		}
+
+		printf("NAMES: %s (%zu)\n", chan_name, sb_count(list));
+
+		sb_each(m, irc_modules){
+			util_module_join_bulk(m, chan_name, list, sb_count(list));
+		}
+
+		sb_free(list);
+		free(names);
+	} else {
+		printf(":: [%03u] :: %s", event, origin_full);
+		for(size_t i = 0; i < count; ++i){
+			printf(" :: %s", params[i]);
+		}
+		puts("");
+	}
+}
+
+/********************
+ * IRCCoreCtx funcs *
+ ********************/
+
+static intptr_t core_get_info(int id){
+	switch(id){
+		case IRC_INFO_CAN_PARSE_TAGS: {
+			return have_tag_hack;
+		} break;
+
+		case IRC_INFO_NEXT_CMD_ID: {
+			return next_cmd_id;
+		} break;
+
+		case IRC_INFO_CURL_SHARE: {
+			return (intptr_t)http_share;
+		} break;
+
+		case IRC_INFO_CMDS_QUEUED: {
+			return cmds_queued;
+		} break;
+
+		case IRC_INFO_CMDS_DROPPED: {
+			return cmds_dropped;
+		} break;
+
+		case IRC_INFO_CONN_ID: {
+			return irc_cur ? irc_cur->id : 0;
+		} break;
+
+		case IRC_INFO_CONN_COUNT: {
+			return sb_count(irc_conns);
+		} break;
+
+		default: {
+			return 0;
+		} break;
+	}
+}
+
+static const char* core_get_username(void){
+	return bot_nick;
+}
+
+// FIXME: this function is bad and should return a FILE* instead
+static char datafile_buff[PATH_MAX];
+static const char* core_get_datafile(void){
+	Module* caller = sb_last(mod_call_stack);
+
+	util_data_path(datafile_buff, sizeof(datafile_buff), caller->ctx->name, ".data");
+
+	if(access(datafile_buff, F_OK) != 0){
+		util_data_watch_pause();
+		close(creat(datafile_buff, 00600));
+		util_data_watch_resume();
+	}
+
+	if(access(datafile_buff, R_OK | W_OK) != 0){
+		fprintf(stderr, "ERROR: We don't have rw permission on '%s'! Please chown/chmod it.\n", datafile_buff);
+		// gcc calls me names if i dare use tmpnam for this dumb fallback, so let's do something even worse...
+		snprintf(datafile_buff, sizeof(datafile_buff), "/tmp/insobot-%s.%ld.%d.data", caller->ctx->name, (long)time(0), rand());
+	}
+
+	return datafile_buff;
+}
+
+static IRCModuleCtx** core_get_modules(bool chan_only){
+	Module* caller = sb_last(mod_call_stack);
+
+	if(chan_mod_list) stb__sbn(chan_mod_list) = 0;
+	if(global_mod_list) stb__sbn(global_mod_list) = 0;
+
+	sb_each(m, irc_modules){
+		// XXX: don't return modules with a lower ABI than the caller for safety.
+		if(caller && caller->ctx_size > m->ctx_size) continue;
+
+		sb_push(global_mod_list, m->ctx);
+		if(!(m->ctx->flags & IRC_MOD_GLOBAL)){
+			sb_push(chan_mod_list, m->ctx);
+		}
+	}
+
+	sb_push(chan_mod_list, 0);
+	sb_push(global_mod_list, 0);
+
+	return chan_only ? chan_mod_list : global_mod_list;
+}
+
+static const char** core_get_channels(void){
+	return (const char**)channels;
+}
+
+static const char** core_get_nicks(const char* chan, int* count){
+	assert(count);
+
+	Channel* c = util_chan_find(chan);
+
+	if(c){
+		*count = sb_count(chan_nicks[c->idx]);
+		return (const char**)chan_nicks[c->idx];
+	} else {
+		*count = 0;
+		return NULL;
+	}
+}
+
+static void core_join(const char* chan){
+	Channel* c = util_chan_find(chan);
+	if(!c){
+		c = util_chan_add(chan);
+		util_chan_add_nick(c, bot_nick);
+	}
+
+	if(c->conn == -1){
+		util_chan_set_conn(c, util_conn_pick());
+	} else if(irc_connecting && c->conn != irc_connecting->id){
+		// modules join everything again when any connection connects, but this one belongs to another.
+		return;
+	}
+
+	IRCConn* conn = util_conn_get(c->conn);
+	if(conn && !conn->registered){
+		c->want_join = true;
+		return;
+	}
+
+	c->want_join = false;
+	util_cmd_enqueue(IRC_CMD_JOIN, chan, NULL); //TODO: password protected channels?
+}
 
-	printf("connect origin = %s\n", origin_full);
+static void core_part(const char* chan){
 
-	IRC_MOD_CALL_ALL(on_connect, (serv));
+	util_cmd_enqueue(IRC_CMD_PART, chan, NULL);
+
+	Channel* c = util_chan_find(chan);
+	if(c){
+		util_chan_del(c);
+	}
 }
 
-IRC_STR_CALLBACK(on_chat_msg) {
-	if(count < 2 || !params[0] || !params[1]) return;
+static size_t core_send_msg(const char* chan, const char* fmt, ...){
+	if(!chan || !fmt) return 0;
 
-	util_update_tags(params);
+	size_t id = next_cmd_id++;
+	char buff[8192];
+	va_list v;
 
-	char _name[128] = "";
-	irc_target_get_nick(origin_full, _name, sizeof(_name));
+	va_start(v, fmt);
+	int total_len = vsnprintf(buff, sizeof(buff), fmt, v);
+	if(total_len < 0)
+		goto end;
 
-	const char *_chan = params[0];
+	if(total_len > (int)sizeof(buff))
+		total_len = sizeof(buff);
 
-	size_t msglen = strlen(params[1]);
-	char*  msgbuf = alloca(msglen+2);
-	char*  _msg   = msgbuf + 1;
+	util_cmd_enqueue_id(IRC_CMD_MSG, id, chan, buff, -1);
 
-	// null-prefix the msg, so that cmds can walk backwards to see the full msg
-	*msgbuf = 0;
-	memcpy(_msg, params[1], msglen+1);
+end:
+	va_end(v);
+	send_msg_called = true;
+
+	return id;
+}
+
+static size_t core_send_raw(const char* raw){
+	return util_cmd_enqueue(IRC_CMD_RAW, NULL, raw);
+}
+
+static void core_send_ipc(int target, const void* data, size_t data_len){
+	if(ipc_socket <= 0) return;
+
+	Module* m = sb_count(mod_call_stack) ? sb_last(mod_call_stack) : NULL;
+	const char* name = m ? m->ctx->name : "core";
+	const size_t name_len = strlen(name);
+	const size_t total_len = data_len + name_len + 1;
+
+	// why doesn't AF_UNIX support MSG_MORE? :(
+	char* buffer = malloc(total_len);
+	memcpy(buffer, name, name_len + 1);
+	memcpy(buffer + name_len + 1, data, data_len);
+
+	IPCRecord rec = {
+		.len      = total_len,
+		.hash     = inso_hash_nocase(name, name_len),
+		.name_len = name_len,
+	};
+
+	for(IPCAddress* p = ipc_peers; p < sb_end(ipc_peers); ++p){
+		if(target != 0 && p->id != target) continue;
+
+		if(p->tx_ok){
+			if(IPC_REC_SIZE(total_len) > IPC_RING_SIZE / 2){
+				fprintf(stderr, "send_ipc: %zu byte message from %s is too big.\n", data_len, name);
+				continue;
+			}
+
+			// keep things in order if there's already a backlog.
+			if(sb_count(p->tx_backlog) || !util_ipc_ring_put(p->tx, &rec, buffer)){
+				if(sb_count(p->tx_backlog) + sizeof(rec) + total_len > IPC_BACKLOG_MAX){
+					util_ipc_drop(p, "too far behind");
+					--p;
+					continue;
+				}
+				memcpy(sb_add(p->tx_backlog, sizeof(rec)), &rec, sizeof(rec));
+				memcpy(sb_add(p->tx_backlog, total_len), buffer, total_len);
+			} else {
+				p->tx_signal = true;
+			}
+			continue;
+		}
+
+		printf("Sending IPC msg to %d for %s\n", p->id, name);
+
+		if(sendto(ipc_socket, buffer, total_len, 0, &p->addr, sizeof(p->addr)) == -1){
+			if(errno == ECONNREFUSED || errno == ENOENT){
+				if(errno == ECONNREFUSED){
+					unlink(p->addr.sun_path);
+				}
+				util_ipc_drop(p, "socket is gone");
+				--p;
+			} else {
+				perror("send_ipc: sendto");
+			}
+		}
+	}
+
+	free(buffer);
+}
+
+static void core_send_mod_msg(IRCModMsg* msg){
+	const char* sender = sb_last(mod_call_stack)->ctx->name;
+	IRC_MOD_CALL_ALL(on_mod_msg, (sender, msg));
+}
+
+static void core_self_save(void){
+	Module* m = sb_last(mod_call_stack);
+	if(m->save_due_ms != -1) return;
+
+	// wait a bit so a flurry of changes only gets written once, and not too often for the same module.
+	m->save_due_ms = INSO_MAX(util_ms_now() + SAVE_DELAY_MS, m->last_save_ms + SAVE_MIN_INTERVAL_MS);
+}
+
+static void core_journal(uint32_t type, const void* data, size_t len){
+	Module* m = sb_last(mod_call_stack);
+
+	JournalRec rec = { .len = len, .type = type };
+	memcpy(sb_add(m->journal_buf, sizeof(rec)), &rec, sizeof(rec));
+	if(len){
+		memcpy(sb_add(m->journal_buf, len), data, len);
+	}
+}
+
+static void core_log(const char* fmt, ...){
+
+	if(getenv("INSOBOT_NO_FORK")){
+		char time_buf[64];
+		time_t now = time(0);
+		struct tm* now_tm = localtime(&now);
+		strftime(time_buf, sizeof(time_buf), "[%F][%T]", now_tm);
+
+		const char* mod_name = sb_count(mod_call_stack) ? sb_last(mod_call_stack)->ctx->name : "CORE";
+		fprintf(stderr, "%s %s: ", time_buf, mod_name);
+	}
+
+	va_list v;
+	va_start(v, fmt);
+	vfprintf(stderr, fmt, v);
+	va_end(v);
+}
+
+static void core_strip_colors(char* msg){
+	util_strip_mirc(msg, msg);
+}
+
+static bool core_responded(void){
+	return send_msg_called;
+}
+
+static bool core_get_tag(size_t index, const char** k, const char** v){
+	util_tags_parse();
+
+	if(index >= sb_count(irc_tags)){
+		return false;
+	}
+
+	if(k) *k = irc_tags[index].key;
+	if(v) *v = util_tag_value(irc_tags + index);
+
+	return true;
+}
+
+static const char* core_get_tag_by_name(const char* key){
+	return util_tag_get(key);
+}
+
+static const IRCMsgView* core_get_msg_view(void){
+	if(!msg_view_src){
+		return NULL;
+	}
+
+	if(!msg_view_built){
+		util_msg_view_build();
+	}
+
+	return &msg_view;
+}
+
+static void core_gen_event(int which, ...){
+	va_list va;
+	va_start(va, which);
+
+	// TODO: get tags in here?
+	const char* pbuf[3] = { "" };
+	const char** params = pbuf + 1;
+	const char* origin;
+
+	// TODO: queue this up in events like cmd_queue, and process later
+
+	switch(which){
+		case IRC_CB_MSG: {
+			params[0] = va_arg(va, const char*); // chan
+			origin    = va_arg(va, const char*); // name
+			params[1] = va_arg(va, const char*); // msg
+
+			irc_on_chat_msg(NULL, "", origin, params, 2);
+		} break;
+
+		case IRC_CB_JOIN: {
+			params[0] = va_arg(va, const char*); // chan;
+			origin    = va_arg(va, const char*); // name;
+
+			irc_on_join(NULL, "", origin, params, 1);
+		} break;
+
+		case IRC_CB_PART: {
+			params[0] = va_arg(va, const char*); // chan;
+			origin    = va_arg(va, const char*); // name;
+
+			irc_on_part(NULL, "", origin, params, 1);
+		} break;
+
+		case IRC_CB_ACTION: {
+			params[0] = va_arg(va, const char*); // chan
+			origin    = va_arg(va, const char*); // name
+			params[1] = va_arg(va, const char*); // msg
+
+			irc_on_action(NULL, "", origin, params, 2);
+		} break;
+
+		case IRC_CB_NICK: {
+			origin    = va_arg(va, const char*); // prev_nick
+			params[0] = va_arg(va, const char*); // new_nick
+
+			irc_on_nick(NULL, "", origin, params, 1);
+		} break;
+
+		case IRC_CB_PM: {
+			// params[0] unused?
+			origin    = va_arg(va, const char*); // name
+			params[1] = va_arg(va, const char*); // msg
+
+			irc_on_pm(NULL, "", origin, params, 2);
+		} break;
+	}
+
+	va_end(va);
+}
+
+static void core_run_async(void (*work)(void*), void (*done)(void*), void* arg){
+	if(async_pool.num_threads == 0){
+		work(arg);
+		if(done) done(arg);
+		return;
+	}
+
+	Module* m = sb_count(mod_call_stack) ? sb_last(mod_call_stack) : NULL;
+
+	AsyncJob* job = calloc(1, sizeof(*job));
+	assert(job);
+
+	job->owner = m ? m->ctx : NULL;
+	job->work  = work;
+	job->done  = done;
+	job->arg   = arg;
+
+	pthread_mutex_lock(&async_pool.lock);
+
+	if(async_pool.todo_tail){
+		async_pool.todo_tail->next = job;
+	} else {
+		async_pool.todo_head = job;
+	}
+	async_pool.todo_tail = job;
+
+	pthread_cond_signal(&async_pool.todo_cond);
+	pthread_mutex_unlock(&async_pool.lock);
+}
+
+static void core_http_request(void* curl, void (*cb)(void*, int, void*), void* arg){
+	Module* m = sb_count(mod_call_stack) ? sb_last(mod_call_stack) : NULL;
+
+	if(!http_multi){
+		cb(curl, CURLE_FAILED_INIT, arg);
+		return;
+	}
+
+	HTTPReq req = {
+		.curl  = curl,
+		.owner = m ? m->ctx : NULL,
+		.cb    = cb,
+		.arg   = arg,
+	};
+
+	if(http_share){
+		curl_easy_setopt(curl, CURLOPT_SHARE, http_share);
+	}
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+	sb_push(http_reqs, req);
+
+	CURLMcode err = curl_multi_add_handle(http_multi, curl);
+	if(err != CURLM_OK){
+		fprintf(stderr, "http_request: %s\n", curl_multi_strerror(err));
+		sb_pop(http_reqs);
+		cb(curl, CURLE_FAILED_INIT, arg);
+	}
+}
+
+static size_t core_add_timer(uint32_t delay_ms, uint32_t interval_ms, void (*cb)(void*), void* arg){
+	Module* m = sb_count(mod_call_stack) ? sb_last(mod_call_stack) : NULL;
+
+	uint32_t slot;
+	if(sb_count(timer_free)){
+		slot = sb_last(timer_free);
+		sb_pop(timer_free);
+	} else {
+		slot = sb_count(timers);
+		if(slot + 1 >= (UINT32_C(1) << TIMER_SLOT_BITS)){
+			fputs("add_timer: too many timers!\n", stderr);
+			return 0;
+		}
+		sb_push(timers, (Timer){});
+	}
+
+	Timer* t = timers + slot;
+	t->deadline_ms = util_ms_now() + delay_ms;
+	t->interval_ms = interval_ms;
+	t->owner       = m ? m->ctx : NULL;
+	t->cb          = cb;
+	t->arg         = arg;
+
+	sb_push(timer_heap, slot);
+	util_timer_sift_up(sb_count(timer_heap) - 1);
+
+	return util_timer_id(slot);
+}
+
+static void core_cancel_timer(size_t id){
+	uint32_t slot = (id & ((UINT32_C(1) << TIMER_SLOT_BITS) - 1)) - 1;
+
+	if(id == 0 || slot >= sb_count(timers) || timers[slot].heap_idx == -1 || util_timer_id(slot) != id){
+		return;
+	}
+
+	util_timer_heap_remove(timers[slot].heap_idx);
+	util_timer_free(slot);
+}
+
+static bool core_add_fd(int fd, uint32_t events){
+	Module* m = sb_count(mod_call_stack) ? sb_last(mod_call_stack) : NULL;
+	if(!m || !ABI_CHECK(m, ABI_FD) || !m->ctx->on_fd){
+		fputs("add_fd: the calling module has no on_fd callback.\n", stderr);
+		return false;
+	}
+
+	if(util_fd_find(fd)){
+		fprintf(stderr, "add_fd: fd %d was already added.\n", fd);
+		return false;
+	}
+
+	if(!util_epoll_ctl(EPOLL_CTL_ADD, fd, EV_MODULE, util_fd_to_epoll(events))){
+		return false;
+	}
+
+	ModuleFD f = { .fd = fd, .owner = m->ctx };
+	sb_push(mod_fds, f);
+
+	return true;
+}
+
+static bool core_mod_fd(int fd, uint32_t events){
+	if(!util_fd_find(fd)){
+		return false;
+	}
+
+	return util_epoll_ctl(EPOLL_CTL_MOD, fd, EV_MODULE, util_fd_to_epoll(events));
+}
 
-	util_trim_end_spaces(_msg, msglen);
+static void core_del_fd(int fd){
+	ModuleFD* f = util_fd_find(fd);
+	if(f){
+		util_epoll_ctl(EPOLL_CTL_DEL, fd, EV_MODULE, 0);
+		sb_erase(mod_fds, f - mod_fds);
+	}
+}
 
-	send_msg_called = false;
+static void core_invalidate_meta(const char* chan){
+	if(!meta_valid) return;
 
-	sb_each(m, irc_modules){
-		bool global = m->ctx->flags & IRC_MOD_GLOBAL;
-		if(global || util_check_perms(m->ctx->name, _chan, IRC_CB_CMD)){
-			util_dispatch_cmds(m, _chan, _name, _msg);
+	if(chan){
+		MetaCacheKey* key = inso_ht_get(&meta_index, inso_hash_nocase(chan, 0), &util_meta_cmp, (void*)chan);
+		if(key){
+			key->cache->known = 0;
 		}
-		if(global || util_check_perms(m->ctx->name, _chan, IRC_CB_MSG)){
-			IRC_MOD_CALL(m, on_msg, (_chan, _name, _msg));
+	} else {
+		sb_each(c, meta_caches){
+			(*c)->known = 0;
 		}
 	}
 }
 
-IRC_STR_CALLBACK(on_action) {
-	if(count < 2 || !params[0] || !params[1]) return;
+static const IRCCoreCtx core_ctx = {
+	.api_version  = INSO_CORE_API_VERSION,
+	.get_info     = &core_get_info,
+	.get_username = &core_get_username,
+	.get_datafile = &core_get_datafile,
+	.get_modules  = &core_get_modules,
+	.get_channels = &core_get_channels,
+	.get_nicks    = &core_get_nicks,
+	.send_msg     = &core_send_msg,
+	.send_raw     = &core_send_raw,
+	.send_ipc     = &core_send_ipc,
+	.send_mod_msg = &core_send_mod_msg,
+	.join         = &core_join,
+	.part         = &core_part,
+	.save_me      = &core_self_save,
+	.log          = &core_log,
+	.strip_colors = &core_strip_colors,
+	.responded    = &core_responded,
+	.get_tag      = &core_get_tag,
+	.gen_event    = &core_gen_event,
+	.run_async    = &core_run_async,
+	.http_request = &core_http_request,
+	.add_timer    = &core_add_timer,
+	.cancel_timer = &core_cancel_timer,
+	.add_fd       = &core_add_fd,
+	.mod_fd       = &core_mod_fd,
+	.del_fd       = &core_del_fd,
+	.invalidate_meta = &core_invalidate_meta,
+	.get_tag_by_name = &core_get_tag_by_name,
+	.journal         = &core_journal,
+	.get_msg_view    = &core_get_msg_view,
+};
 
-	util_update_tags(params);
+/***************
+ * entry point *
+ * *************/
 
-	char _name[128] = "";
-	irc_target_get_nick(origin_full, _name, sizeof(_name));
+/**************
+ * Event loop *
+ **************/
 
-	const char *_chan = params[0];
-	char* _msg = strdupa(params[1]);
-	util_trim_end_spaces(_msg, strlen(_msg));
+static void util_event_init(void){
+	if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1){
+		err(1, "epoll_create1");
+	}
 
-	IRC_MOD_CALL_ALL_CHECK(on_action, (_chan, _name, _msg), IRC_CB_ACTION);
-}
+	if((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1){
+		err(1, "timerfd_create");
+	}
 
-IRC_STR_CALLBACK(on_pm){
-	if(count < 2 || !params[1] || !origin_full) return;
+	util_epoll_ctl(EPOLL_CTL_ADD, timer_fd, EV_TIMER, EPOLLIN);
 
-	util_update_tags(params);
+	// epoll refuses regular files / /dev/null, in which case there's nothing to read anyway.
+	struct epoll_event ev = { .events = EPOLLIN, .data.u64 = ((uint64_t)EV_STDIN << 32) | STDIN_FILENO };
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == -1 && errno != EPERM){
+		perror("epoll_ctl stdin");
+	}
 
-	char _name[128] = "";
-	irc_target_get_nick(origin_full, _name, sizeof(_name));
+	if(ipc_socket > 0){
+		util_epoll_ctl(EPOLL_CTL_ADD, ipc_socket, EV_IPC, EPOLLIN);
+	}
 
-	char* _msg = strdupa(params[1]);
-	util_trim_end_spaces(_msg, strlen(_msg));
+	util_epoll_ctl(EPOLL_CTL_ADD, inotify.fd, EV_INOTIFY, EPOLLIN);
 
-	IRC_MOD_CALL_ALL(on_pm, (_name, _msg));
+	if(async_pool.wake_fd != -1){
+		util_epoll_ctl(EPOLL_CTL_ADD, async_pool.wake_fd, EV_ASYNC, EPOLLIN);
+	}
 }
 
-IRC_STR_CALLBACK(on_join) {
-	if(count < 1 || !origin_full || !params[0]) return;
-
-	char origin[128] = "";
-	irc_target_get_nick(origin_full, origin, sizeof(origin));
-
-	fprintf(stderr, "JOIN: %s %s\n", params[0], origin);
-
-	int chan_i, nick_i;
-	util_find_chan_nick(params[0], origin, &chan_i, &nick_i);
+static void util_event_quit(void){
+	if(timer_fd != -1) close(timer_fd);
+	if(epoll_fd != -1) close(epoll_fd);
+}
 
-	if(chan_i == -1){
-		sb_last(channels) = strdup(params[0]);
-		chan_i = sb_count(channels) - 1;
+// libircclient only exposes its socket through fd_sets, so find it (and whether it wants to write) that way.
+static LIVE_ONLY void util_irc_update_fd(IRCConn* c){
+	fd_set in, out;
+	FD_ZERO(&in);
+	FD_ZERO(&out);
 
-		sb_push(channels, 0);
-		sb_push(chan_nicks, 0);
+	// we don't use DCC, so the session's socket is the only thing added here.
+	int fd = -1;
+	if(c->session && irc_is_connected(c->session) && irc_add_select_descriptors(c->session, &in, &out, &fd) != 0){
+		fprintf(stderr, "Error adding select fds: %s\n", irc_strerror(irc_errno(c->session)));
+		return;
 	}
 
-	if(nick_i == -1){
-		sb_push(chan_nicks[chan_i], strdup(origin));
+	uint32_t events = 0;
+	if(fd != -1){
+		if(FD_ISSET(fd, &in))  events |= EPOLLIN;
+		if(FD_ISSET(fd, &out)) events |= EPOLLOUT;
 	}
 
-	if(strcmp(origin, bot_nick) == 0){
+	if(fd != c->fd){
+		if(c->fd != -1) util_epoll_ctl(EPOLL_CTL_DEL, c->fd, EV_IRC, 0);
+		if(fd    != -1) util_epoll_ctl(EPOLL_CTL_ADD, fd, EV_IRC, events);
+	} else if(fd != -1 && events != c->fd_events){
+		util_epoll_ctl(EPOLL_CTL_MOD, fd, EV_IRC, events);
+	}
 
-		// if we're joining the debug channel, set the global so we know we can now send stuff
-		const char* c = getenv("INSOBOT_DEBUG_CHAN");
-		if(c && strcmp(params[0], c) == 0){
-			debug_chan = c;
-		}
+	c->fd = fd;
+	c->fd_events = events;
+}
 
-		if(strlen(origin_full) > strlen(origin)){
-			bot_host_len = strlen(origin_full);
-			printf("new host len: %zu\n", bot_host_len);
-		}
+static void util_irc_forget_fd(IRCConn* c){
+	if(c->fd != -1){
+		util_epoll_ctl(EPOLL_CTL_DEL, c->fd, EV_IRC, 0);
 	}
-
-	//XXX: can't use CHECK here unless our own name bypasses it FIXME
-	IRC_MOD_CALL_ALL(on_join, (params[0], origin));
+	c->fd = -1;
+	c->fd_events = 0;
 }
 
-IRC_STR_CALLBACK(on_part) {
-	if(count < 1 || !origin_full || !params[0]) return;
+static void util_irc_ready(int fd, uint32_t events){
+	IRCConn* c = NULL;
+	sb_each(conn, irc_conns){
+		if(conn->fd == fd){
+			c = conn;
+			break;
+		}
+	}
 
-	char origin[128] = "";
-	irc_target_get_nick(origin_full, origin, sizeof(origin));
+	if(!c || !c->session || !irc_is_connected(c->session)) return;
 
-	int chan_i, nick_i;
-	util_find_chan_nick(params[0], origin, &chan_i, &nick_i);
+	fd_set in, out;
+	FD_ZERO(&in);
+	FD_ZERO(&out);
 
-	printf("PART: %s %s\n", params[0], origin);
+	if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+		FD_SET(fd, &in);
+		c->active_ms = util_ms_now();
+		c->ping_sent = 0;
+	}
 
-	if(chan_i != -1 && strcasecmp(origin, bot_nick) == 0){
-		free(channels[chan_i]);
-		sb_erase(channels, chan_i);
+	if(events & EPOLLOUT){
+		FD_SET(fd, &out);
+	}
 
-		for(size_t i = 0; i < sb_count(chan_nicks[chan_i]); ++i){
-			free(chan_nicks[chan_i][i]);
-		}
-		sb_free(chan_nicks[chan_i]);
-		sb_erase(chan_nicks, chan_i);
+	irc_cur = c;
 
-	} else if(nick_i != -1){
-		free(chan_nicks[chan_i][nick_i]);
-		sb_erase(chan_nicks[chan_i], nick_i);
+	if(irc_process_select_descriptors(c->session, &in, &out) != 0){
+		fprintf(stderr, "Error processing select fds: %s\n", irc_strerror(irc_errno(c->session)));
 	}
 
-	IRC_MOD_CALL_ALL_CHECK(on_part, (params[0], origin), IRC_CB_PART);
+	irc_cur = NULL;
 }
 
-IRC_STR_CALLBACK(on_quit) {
-	if(!origin_full) return;
+static irc_callbacks_t irc_callbacks = {
+	.event_connect     = irc_on_connect,
+	.event_channel     = irc_on_chat_msg,
+	.event_privmsg     = irc_on_pm,
+	.event_join        = irc_on_join,
+	.event_part        = irc_on_part,
+	.event_quit        = irc_on_quit,
+	.event_nick        = irc_on_nick,
+	.event_ctcp_action = irc_on_action,
+	.event_numeric     = irc_on_numeric,
+	.event_unknown     = irc_on_unknown,
+	.event_invite      = irc_on_invite,
+	.event_mode        = irc_on_mode,
+};
 
-	char origin[128] = "";
-	irc_target_get_nick(origin_full, origin, sizeof(origin));
+// IRC_CONNECTIONS connections are made to IRC_SERV, IRC_SERV_<n> / IRC_PORT_<n> can change where the nth (from 0)
+// one goes. They all log in as IRC_USER, and channel names are assumed to be unique across them.
+static void util_conns_init(void){
+	user = util_env_else("IRC_USER", DEFAULT_BOT_NAME);
+	pass = util_env_else("IRC_PASS", NULL);
 
-	util_update_tags(params);
+	const char* serv = util_env_else("IRC_SERV", "irc.nonexistent.domain");
+	const char* port = util_env_else("IRC_PORT", "6667");
 
-	printf("QUIT: %s\n", origin);
+	int count = atoi(util_env_else("IRC_CONNECTIONS", "1"));
+	if(count < 1) count = 1;
 
-	for(size_t i = 0; i < sb_count(channels) - 1; ++i){
-		for(size_t j = 0; j < sb_count(chan_nicks[i]); ++j){
-			if(strcmp(origin, chan_nicks[i][j]) == 0){
-				free(chan_nicks[i][j]);
-				sb_erase(chan_nicks[i], j);
+	for(int i = 0; i < count; ++i){
+		char var[32];
+		IRCConn c = { .id = i, .fd = -1 };
 
-				IRC_MOD_CALL_ALL_CHECK(on_part, (channels[i], origin), IRC_CB_PART);
-				break;
-			}
-		}
+		snprintf(var, sizeof(var), "IRC_SERV_%d", i);
+		c.serv = util_env_else(var, serv);
+
+		snprintf(var, sizeof(var), "IRC_PORT_%d", i);
+		c.port = util_env_else(var, port);
+
+#ifdef CMD_GLOBAL_RATE_SERVER
+		size_t serv_len = strlen(c.serv), suffix_len = strlen(CMD_GLOBAL_RATE_SERVER);
+		c.limited = serv_len >= suffix_len && strcasecmp(c.serv + serv_len - suffix_len, CMD_GLOBAL_RATE_SERVER) == 0;
+#else
+		c.limited = true;
+#endif
+
+		sb_push(irc_conns, c);
 	}
 }
 
-IRC_STR_CALLBACK(on_nick) {
-	if(count < 1 || !origin_full || !params[0]) return;
+static void util_conn_connect(IRCConn* c){
+	if(!(c->session = irc_create_session(&irc_callbacks))){
+		fprintf(stderr, "Failed to create irc session.\n");
+		exit(1);
+	}
 
-	char origin[128] = "";
-	irc_target_get_nick(origin_full, origin, sizeof(origin));
+	char* libirc_serv;
+	if(getenv("IRC_ENABLE_SSL")){
+		puts("Using ssl connection...");
+		asprintf_check(&libirc_serv, "#%s", c->serv);
 
-	util_update_tags(params);
+		//XXX: you might not want this!
+		irc_option_set(c->session, LIBIRC_OPTION_SSL_NO_VERIFY);
+	} else {
+		libirc_serv = strdup(c->serv);
+	}
 
-	if(strcmp(origin, bot_nick) == 0){
-		printf("We changed nicks! new nick: %s\n", params[0]);
-		free(bot_nick);
-		bot_nick = strdup(params[0]);
+	if(irc_connect(c->session, libirc_serv, atoi(c->port), pass, user, user, user) != 0){
+		fprintf(stderr, "Unable to connect: %s\n", irc_strerror(irc_errno(c->session)));
 	}
 
-	for(size_t i = 0; i < sb_count(channels) - 1; ++i){
-		for(size_t j = 0; j < sb_count(chan_nicks[i]); ++j){
-			if(strcasecmp(chan_nicks[i][j], origin) == 0){
-				free(chan_nicks[i][j]);
-				chan_nicks[i][j] = strdup(params[0]);
-				break;
-			}
+	free(libirc_serv);
+
+	c->active_ms = util_ms_now();
+	c->ping_sent = 0;
+}
+
+static void util_conn_close(IRCConn* c){
+	util_irc_forget_fd(c);
+	irc_destroy_session(c->session);
+
+	c->session    = NULL;
+	c->registered = false;
+	c->ping_sent  = 0;
+
+	// JOIN / PART / raw commands were for the old session, modules redo what they need in on_connect.
+	util_conn_clear_joins(c);
+
+	CmdQueue* q = cmd_queues[c->id];
+	for(int l = 0; l < CMD_LANE_COUNT; ++l){
+		CmdRing* r = q->lanes + l;
+		for(; r->count; --r->count, --cmds_queued){
+			IRCCmd* cmd = r->cmds + r->head;
+			r->head = (r->head + 1) % CMD_QUEUE_MAX;
+			free(cmd->chan);
+			free(cmd->data);
 		}
 	}
 
-	IRC_MOD_CALL_ALL(on_nick, (origin, params[0]));
+	for(size_t i = 0; i < sb_count(chan_list); ++i){
+		Channel* chan = chan_list[i];
+		if(chan->conn == c->id && chan->joined){
+			chan->joined    = false;
+			chan->want_join = true;
+		}
+	}
 }
 
-IRC_STR_CALLBACK(on_unknown) {
-	util_update_tags(params);
+// pings / reconnects each connection as needed, returns when this next needs doing.
+static int64_t util_conns_run(int64_t now){
+	int64_t next = -1;
 
-	char origin[128] = "";
-	irc_target_get_nick(origin_full, origin, sizeof(origin));
+	sb_each(c, irc_conns){
+		if(c->session && irc_is_connected(c->session)){
+			int64_t idle_ms = now - c->active_ms;
 
-	if(strcmp(event, "PONG") == 0){
-//		printf(":: PONG");
-		return;
-	} else {
-		printf("Unknown event:\n:: %s :: %s", event, origin);
-	}
+			if(!c->ping_sent && idle_ms > PING_IDLE_SECS * 1000){
+				irc_send_raw(c->session, "PING %s", c->serv);
+				c->ping_sent = 1;
+			} else if(c->ping_sent && idle_ms > PING_TIMEOUT_SECS * 1000){
+				printf("Reached 'no PONG' threshold on connection %d, disconnecting.\n", c->id);
+				irc_disconnect(c->session);
+			}
+		}
 
-	for(size_t i = 0; i < count; ++i){
-		printf(" :: %s", params[i]);
-	}
-	puts("");
+		if(c->session && !irc_is_connected(c->session)){
+			util_conn_close(c);
 
-	IRC_MOD_CALL_ALL_ABI(on_unknown, (event, origin, params, count), ABI_UNKNOWN);
-}
+			if(!running) continue;
 
-IRC_STR_CALLBACK(on_invite) {
-	if(count < 2 || !origin_full || !params[1]) return;
-	printf("We got invited to [%s] by [%s]\n", params[1], origin_full);
-	core_join(params[1]);
-}
+			printf("Restarting connection %d.\n", c->id);
+			c->retry_ms = now + IRC_RECONNECT_MS;
 
-IRC_NUM_CALLBACK(on_numeric) {
-	static const char nick_start_symbols[] = "[]\\`_^{|}";
+			if(getenv("INSOBOT_NO_AUTO_RESTART")){
+				puts("(when you press a key...)");
+				sigprocmask(SIG_SETMASK, &wait_sigmask, NULL);
+				getchar();
+				sigprocmask(SIG_BLOCK, &int_sigmask, NULL);
+				c->retry_ms = now;
+			}
+		}
 
-	if(event == LIBIRC_RFC_RPL_NAMREPLY && count >= 4 && params[3]){
-		char *names = strdup(params[3]),
-		     *state = NULL,
-		     *n     = strtok_r(names, " ", &state);
+		if(!c->session && running && now >= c->retry_ms){
+			util_conn_connect(c);
+		}
 
-		do {
-			if(!isalpha(*n) && !strchr(nick_start_symbols, *n)){
-				++n;
-			}
-			irc_on_join(session, "join", n, (const char**)(params + 2), 1);
-		} while((n = strtok_r(NULL, " ", &state)));
+		int64_t t = c->session
+			? c->active_ms + (c->ping_sent ? PING_TIMEOUT_SECS : PING_IDLE_SECS) * 1000 + 1
+			: c->retry_ms;
 
-		free(names);
-	} else {
-		printf(":: [%03u] :: %s", event, origin_full);
-		for(size_t i = 0; i < count; ++i){
-			printf(" :: %s", params[i]);
+		if(next == -1 || t < next){
+			next = t;
 		}
-		puts("");
 	}
-}
 
-/********************
- * IRCCoreCtx funcs *
- ********************/
+	return next;
+}
 
-static intptr_t core_get_info(int id){
-	switch(id){
-		case IRC_INFO_CAN_PARSE_TAGS: {
-			return have_tag_hack;
-		} break;
+static void util_stdin_ready(void){
+	char stdin_buf[1024];
+	ssize_t n = read(STDIN_FILENO, stdin_buf, sizeof(stdin_buf));
+	if(n > 0){
+		stdin_buf[n-1] = 0; // remove \n
 
-		case IRC_INFO_NEXT_CMD_ID: {
-			return next_cmd_id;
-		} break;
+		if(strcmp(stdin_buf, "trace") == 0){
+			util_trace_dump();
+			return;
+		}
 
-		default: {
-			return 0;
-		} break;
+		IRC_MOD_CALL_ALL(on_stdin, (stdin_buf));
+	} else if(n == 0){
+		// EOF, stop epoll from reporting it forever
+		util_epoll_ctl(EPOLL_CTL_DEL, STDIN_FILENO, EV_STDIN, 0);
 	}
 }
 
-static const char* core_get_username(void){
-	return bot_nick;
+static void util_debug_ready(void){
+	char buf[256];
+	char* fname;
+	int off;
+	ssize_t n = read(debug_pipe[0], buf, sizeof(buf)-1);
+
+	if(n > 0){
+		buf[n] = 0;
+		if(sscanf(buf, "%m[^(]%n", &fname, &off) == 1){
+			buf[n-1] = 0; // remove \n
+			core_send_msg(debug_chan, "Recovered from crash: %s%s", basename(fname), buf + off);
+			free(fname);
+		}
+	} else {
+		util_epoll_ctl(EPOLL_CTL_DEL, debug_pipe[0], EV_DEBUG, 0);
+	}
 }
 
-// FIXME: this function is bad and should return a FILE* instead
-static char datafile_buff[PATH_MAX];
-static const char* core_get_datafile(void){
-	Module* caller = sb_last(mod_call_stack);
-
-	snprintf(datafile_buff, sizeof(datafile_buff), "%s/data/%s.data", insobot_path, caller->ctx->name);
-
-	if(access(datafile_buff, F_OK) != 0){
-		inotify.data.wd = inotify_add_watch(inotify.fd, inotify.data.path, IN_DELETE_SELF);
-		close(creat(datafile_buff, 00600));
-		inotify.data.wd = inotify_add_watch(inotify.fd, inotify.data.path, IN_CLOSE_WRITE | IN_MOVED_TO);
+static bool util_tick_wanted(void){
+	sb_each(m, irc_modules){
+		if(m->ctx->on_tick) return true;
 	}
+	return false;
+}
 
-	if(access(datafile_buff, R_OK | W_OK) != 0){
-		fprintf(stderr, "ERROR: We don't have rw permission on '%s'! Please chown/chmod it.\n", datafile_buff);
-		// gcc calls me names if i dare use tmpnam for this dumb fallback, so let's do something even worse...
-		snprintf(datafile_buff, sizeof(datafile_buff), "/tmp/insobot-%s.%ld.%d.data", caller->ctx->name, (long)time(0), rand());
+static void util_save_run(int64_t now){
+	for(size_t i = 0; i < sb_count(irc_modules); ++i){
+		Module* m = irc_modules + i;
+		if(m->save_due_ms != -1 && now >= m->save_due_ms){
+			util_module_save(m, false);
+		}
 	}
+}
 
-	return datafile_buff;
+static int64_t util_save_next(void){
+	int64_t next = -1;
+	sb_each(m, irc_modules){
+		if(m->save_due_ms != -1 && (next == -1 || m->save_due_ms < next)){
+			next = m->save_due_ms;
+		}
+	}
+	return next;
 }
 
-static IRCModuleCtx** core_get_modules(bool chan_only){
-	Module* caller = sb_last(mod_call_stack);
+// runs everything that's time based, and returns the next CLOCK_MONOTONIC ms deadline, or -1 for none.
+static LIVE_ONLY int64_t util_run_timers(void){
+	int64_t now = util_ms_now();
+	int64_t next = -1;
 
-	if(chan_mod_list) stb__sbn(chan_mod_list) = 0;
-	if(global_mod_list) stb__sbn(global_mod_list) = 0;
+	trace_chan = 0;
+	irc_cur    = NULL;
 
-	sb_each(m, irc_modules){
-		// XXX: don't return modules with a lower ABI than the caller for safety.
-		if(caller && caller->ctx_size > m->ctx_size) continue;
+	util_http_check_timeout(now);
+	util_timer_run(now);
+	util_journal_flush_all();
+	util_save_run(now);
 
-		sb_push(global_mod_list, m->ctx);
-		if(!(m->ctx->flags & IRC_MOD_GLOBAL)){
-			sb_push(chan_mod_list, m->ctx);
-		}
+	//TODO: check on_meta?
+	bool tick_wanted = util_tick_wanted();
+	if(tick_wanted && now >= next_tick_ms){
+		IRC_MOD_CALL_ALL(on_tick, (time(0)));
+		next_tick_ms = now + TICK_INTERVAL_MS;
 	}
 
-	sb_push(chan_mod_list, 0);
-	sb_push(global_mod_list, 0);
+	int64_t conn_ms = util_conns_run(now);
 
-	return chan_only ? chan_mod_list : global_mod_list;
-}
+	// last, since the callbacks above might have queued something.
+	util_process_pending_cmds();
+	bool ipc_waiting = util_ipc_flush();
 
-static const char** core_get_channels(void){
-	return (const char**)channels;
-}
+	// work out when we next need to wake up, the above can all change these.
 
-static const char** core_get_nicks(const char* chan, int* count){
-	assert(count);
+	#define DEADLINE(t) next = (next == -1 ? (t) : INSO_MIN(next, (t)))
 
-	int index = -1;
-	for(size_t i = 0; i < sb_count(channels) - 1; ++i){
-		if(strcasecmp(channels[i], chan) == 0){
-			index = i;
-			break;
-		}
+	int64_t cmd_ms = util_cmd_next_ms();
+	if(cmd_ms != -1){
+		DEADLINE(cmd_ms);
 	}
 
-	if(index >= 0){
-		*count = sb_count(chan_nicks[index]);
-		return (const char**)chan_nicks[index];
-	} else {
-		*count = 0;
-		return NULL;
+	if(http_timer_ms != -1){
+		DEADLINE(http_timer_ms);
 	}
-}
 
-static void core_join(const char* chan){
+	if(sb_count(timer_heap)){
+		DEADLINE(util_timer_next());
+	}
 
-	util_cmd_enqueue(IRC_CMD_JOIN, chan, NULL); //TODO: password protected channels?
+	int64_t save_ms = util_save_next();
+	if(save_ms != -1){
+		DEADLINE(save_ms);
+	}
+
+	if(tick_wanted){
+		DEADLINE(next_tick_ms);
+	}
+
+	// a peer's ring was full, try again soon.
+	if(ipc_waiting){
+		DEADLINE(now + IPC_RETRY_MS);
+	}
+
+	if(conn_ms != -1){
+		DEADLINE(conn_ms);
+	}
+
+	#undef DEADLINE
 
-	int chan_i, nick_i;
-	util_find_chan_nick(chan, bot_nick, &chan_i, &nick_i);
+	return next;
+}
 
-	if(chan_i == -1){
-		sb_last(channels) = strdup(chan);
-		chan_i = sb_count(channels) - 1;
+static LIVE_ONLY void util_timer_arm(int64_t deadline_ms){
+	if(deadline_ms == timer_armed_ms) return;
 
-		sb_push(channels, 0);
+	// an all-zero it_value disarms the timer, a deadline in the past fires immediately.
+	struct itimerspec its = {};
+	if(deadline_ms != -1){
+		its.it_value.tv_sec  = deadline_ms / 1000;
+		its.it_value.tv_nsec = (deadline_ms % 1000) * 1000000 + 1;
+	}
 
-		sb_push(chan_nicks, 0);
-		sb_push(chan_nicks[chan_i], strdup(bot_nick));
+	if(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1){
+		perror("timerfd_settime");
 	}
 
+	timer_armed_ms = deadline_ms;
 }
 
-static void core_part(const char* chan){
+static LIVE_ONLY void util_event_dispatch(struct epoll_event* ev){
+	int fd   = (int)(uint32_t)ev->data.u64;
+	int type = ev->data.u64 >> 32;
 
-	util_cmd_enqueue(IRC_CMD_PART, chan, NULL);
+	trace_chan = 0;
+	irc_cur    = NULL;
 
-	for(char** c = channels; *c; ++c){
-		if(strcmp(*c, chan) == 0){
-			free(*c);
-			sb_erase(channels, c - channels);
-			break;
-		}
-	}
-}
+	switch(type){
+		case EV_STDIN: {
+			util_stdin_ready();
+		} break;
 
-static size_t core_send_msg(const char* chan, const char* fmt, ...){
-	if(!chan || !fmt) return 0;
+		case EV_IPC: {
+			util_ipc_recv();
+		} break;
 
-	size_t id = next_cmd_id++;
-	char buff[8192];
-	va_list v;
+		case EV_INOTIFY: {
+			if(util_inotify_check()){
+				util_reload_modules();
+			}
+		} break;
 
-	va_start(v, fmt);
-	int total_len = vsnprintf(buff, sizeof(buff), fmt, v);
-	if(total_len < 0)
-		goto end;
+		case EV_ASYNC: {
+			util_async_complete(NULL);
+		} break;
 
-	if(total_len > (int)sizeof(buff))
-		total_len = sizeof(buff);
+		case EV_DEBUG: {
+			util_debug_ready();
+		} break;
 
-	util_cmd_enqueue_id(IRC_CMD_MSG, id, chan, buff);
+		case EV_TIMER: {
+			uint64_t expirations;
+			if(read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)){
+				timer_armed_ms = -1;
+			}
+		} break;
 
-end:
-	va_end(v);
-	send_msg_called = true;
+		case EV_IRC: {
+			util_irc_ready(fd, ev->events);
+		} break;
 
-	return id;
-}
+		case EV_HTTP: {
+			util_http_socket_ready(fd, ev->events);
+		} break;
 
-static size_t core_send_raw(const char* raw){
-	return util_cmd_enqueue(IRC_CMD_RAW, NULL, raw);
-}
+		case EV_MODULE: {
+			util_fd_ready(fd, ev->events);
+		} break;
 
-static void core_send_ipc(int target, const void* data, size_t data_len){
-	if(ipc_socket <= 0) return;
+		case EV_SAVE: {
+			util_module_save_ready(fd);
+		} break;
 
-	Module* m = sb_count(mod_call_stack) ? sb_last(mod_call_stack) : NULL;
-	const char* name = m ? m->ctx->name : "core";
-	const size_t name_len = strlen(name);
-	const size_t total_len = data_len + name_len + 1;
+		case EV_IPC_RING: {
+			util_ipc_ring_ready(fd);
+		} break;
+	}
+}
 
-	// why doesn't AF_UNIX support MSG_MORE? :(
-	char* buffer = malloc(total_len);
-	memcpy(buffer, name, name_len + 1);
-	memcpy(buffer + name_len + 1, data, data_len);
+#ifdef INSOBOT_REPLAY
 
-	for(IPCAddress* p = ipc_peers; p < sb_end(ipc_peers); ++p){
-		if(target != 0 && p->id != target) continue;
+/******************
+ * Replay harness *
+ ******************/
 
-		printf("Sending IPC msg to %d for %s\n", p->id, name);
+// insobot-replay feeds raw IRC lines ("@tags :nick!user@host PRIVMSG #chan :text") from a log through the same
+// irc_on_* callbacks as fast as it can, instead of connecting anywhere. Anything the modules send is written to
+// the output file (if given) rather than the server.
 
-		if(sendto(ipc_socket, buffer, total_len, 0, &p->addr, sizeof(p->addr)) == -1){
-			bool remove = false;
+static FILE*  replay_out;
+static size_t replay_sent;
 
-			if(errno == ECONNREFUSED){
-				unlink(p->addr.sun_path);
-				remove = true;
-			} else if(errno == ENOENT){
-				remove = true;
-			} else {
-				perror("send_ipc: sendto");
-			}
+static void util_replay_write(const char* cmd, const char* chan, const char* data){
+	++replay_sent;
+	if(replay_out){
+		fprintf(replay_out, "%s %s %s\n", cmd, chan ? chan : "-", data ? data : "");
+	}
+}
 
-			if(remove){
-				printf("removing [%s]\n", p->addr.sun_path);
-				sb_erase(ipc_peers, p - ipc_peers);
-				--p;
-			}
+// sends everything queued the same way util_process_pending_cmds does, just without waiting for the rate limits.
+static void util_replay_drain_cmds(void){
+	sb_each(c, irc_conns){
+		sb_each(j, c->joins){
+			util_replay_write(j->cmd == IRC_CMD_JOIN ? "JOIN" : "PART", j->chan, j->data);
 		}
+		util_conn_clear_joins(c);
 	}
 
-	free(buffer);
-}
+	// by index, on_filter and on_msg_out can send to a new target, which reallocs cmd_queues.
+	for(size_t i = 0; i < sb_count(cmd_queues); ++i){
+		CmdQueue* q = cmd_queues[i];
 
-static void core_send_mod_msg(IRCModMsg* msg){
-	const char* sender = sb_last(mod_call_stack)->ctx->name;
-	IRC_MOD_CALL_ALL(on_mod_msg, (sender, msg));
-}
+		for(int l = 0; l < CMD_LANE_COUNT; ++l){
+			CmdRing* r = q->lanes + l;
 
-static void core_self_save(void){
-	util_module_save(sb_last(mod_call_stack));
-}
+			while(r->count){
+				IRCCmd cmd = r->cmds[r->head];
+				r->head = (r->head + 1) % CMD_QUEUE_MAX;
+				--r->count;
+				--cmds_queued;
 
-static void core_log(const char* fmt, ...){
+				switch(cmd.cmd){
 
-	if(getenv("INSOBOT_NO_FORK")){
-		char time_buf[64];
-		time_t now = time(0);
-		struct tm* now_tm = localtime(&now);
-		strftime(time_buf, sizeof(time_buf), "[%F][%T]", now_tm);
+					case IRC_CMD_MSG: {
+						if(!cmd.filtered){
+							size_t len = strlen(cmd.data);
+							IRC_MOD_CALL_ALL_ABI(on_filter, (cmd.id, cmd.chan, cmd.data, len), ABI_FILTER);
+						}
 
-		const char* mod_name = sb_count(mod_call_stack) ? sb_last(mod_call_stack)->ctx->name : "CORE";
-		fprintf(stderr, "%s %s: ", time_buf, mod_name);
-	}
+						if(!*cmd.data) break;
 
-	va_list v;
-	va_start(v, fmt);
-	vfprintf(stderr, fmt, v);
-	va_end(v);
+#ifdef CMD_COALESCE_SEP
+						if(l == CMD_LANE_NORMAL){
+							util_cmd_coalesce(r, &cmd);
+						}
+#endif
+					} // fall-thru
+
+					case IRC_CMD_MSG_SPLIT: {
+						char tmp[512];
+
+						const int max_msg_len = util_max_msg_len(cmd.chan);
+						const char* src = cmd.data;
+						size_t src_len = strlen(cmd.data);
+
+						if(util_split_msg(tmp, max_msg_len, &src, &src_len)){
+							util_cmd_enqueue_id(IRC_CMD_MSG_SPLIT, cmd.id, cmd.chan, src, l);
+						}
+
+						util_replay_write("PRIVMSG", cmd.chan, tmp);
+						IRC_MOD_CALL_ALL(on_msg_out, (cmd.chan, tmp));
+					} break;
+
+					case IRC_CMD_RAW: {
+						size_t len = strlen(cmd.data);
+						IRC_MOD_CALL_ALL_ABI(on_filter, (cmd.id, NULL, cmd.data, len), ABI_FILTER);
+						if(*cmd.data){
+							util_replay_write("RAW", NULL, cmd.data);
+						}
+					} break;
+				}
+
+				free(cmd.chan);
+				free(cmd.data);
+			}
+		}
+	}
 }
 
-static void core_strip_colors(char* msg){
-	char* stripped = irc_color_strip_from_mirc(msg);
-	assert(strlen(stripped) <= strlen(msg));
+static void util_replay_line(char* line){
+	// params[-1] is where the patched libircclient puts the tags
+	const char* param_buf[17] = { "" };
+	const char** params = param_buf + 1;
+	unsigned count = 0;
 
-	memcpy(msg, stripped, strlen(stripped) + 1);
-	free(stripped);
-}
+	line[strcspn(line, "\r\n")] = '\0';
 
-static bool core_responded(void){
-	return send_msg_called;
-}
+	if(*line == '@'){
+		param_buf[0] = strsep(&line, " ") + 1;
+		if(!line) return;
+	}
 
-static bool core_get_tag(size_t index, const char** k, const char** v){
-	index <<= 1;
+	const char* origin = "";
+	if(*line == ':'){
+		origin = strsep(&line, " ") + 1;
+		if(!line) return;
+	}
 
-	if(index >= sb_count(irc_tag_ptrs)){
-		return false;
+	const char* event = strsep(&line, " ");
+
+	while(line && *line && count < 16){
+		if(*line == ':'){
+			params[count++] = line + 1;
+			break;
+		}
+		params[count++] = strsep(&line, " ");
 	}
 
-	if(k) *k = irc_tag_ptrs[index+0];
-	if(v) *v = irc_tag_ptrs[index+1];
+	if(strcmp(event, "PRIVMSG") == 0 && count >= 2){
+		size_t len = strlen(params[1]);
 
-	return true;
+		if(strncmp(params[1], "\001ACTION ", 8) == 0 && params[1][len-1] == '\001'){
+			((char*)params[1])[len-1] = '\0';
+			params[1] += 8;
+			irc_on_action(NULL, event, origin, params, count);
+		} else if(*params[0] == '#'){
+			irc_on_chat_msg(NULL, event, origin, params, count);
+		} else {
+			irc_on_pm(NULL, event, origin, params, count);
+		}
+	} else if(strcmp(event, "JOIN") == 0){
+		irc_on_join(NULL, event, origin, params, count);
+	} else if(strcmp(event, "PART") == 0){
+		irc_on_part(NULL, event, origin, params, count);
+	} else if(strcmp(event, "QUIT") == 0){
+		irc_on_quit(NULL, event, origin, params, count);
+	} else if(strcmp(event, "NICK") == 0){
+		irc_on_nick(NULL, event, origin, params, count);
+	} else {
+		irc_on_unknown(NULL, event, origin, params, count);
+	}
 }
 
-static void core_gen_event(int which, ...){
-	va_list va;
-	va_start(va, which);
-
-	// TODO: get tags in here?
-	const char* pbuf[3] = { "" };
-	const char** params = pbuf + 1;
-	const char* origin;
+static int util_replay_mod_cmp(const void* a, const void* b){
+	const Module* ma = *(const Module**)a;
+	const Module* mb = *(const Module**)b;
+	return (mb->trace_ns > ma->trace_ns) - (mb->trace_ns < ma->trace_ns);
+}
 
-	// TODO: queue this up in events like cmd_queue, and process later
+static void util_replay(int argc, char** argv){
+	if(argc < 2){
+		fprintf(stderr, "Usage: %s <log file | -> [output file]\n", argv[0]);
+		return;
+	}
 
-	switch(which){
-		case IRC_CB_MSG: {
-			params[0] = va_arg(va, const char*); // chan
-			origin    = va_arg(va, const char*); // name
-			params[1] = va_arg(va, const char*); // msg
+	FILE* in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+	if(!in){
+		perror(argv[1]);
+		return;
+	}
 
-			irc_on_chat_msg(irc_ctx, "", origin, params, 2);
-		} break;
+	if(argc >= 3 && !(replay_out = fopen(argv[2], "w"))){
+		perror(argv[2]);
+	}
 
-		case IRC_CB_JOIN: {
-			params[0] = va_arg(va, const char*); // chan;
-			origin    = va_arg(va, const char*); // name;
+	// reset the counters, so module loading isn't included.
+	sb_each(m, irc_modules){
+		m->trace_ns = m->trace_calls = 0;
+	}
 
-			irc_on_join(irc_ctx, "", origin, params, 1);
-		} break;
+	char* line = NULL;
+	size_t line_cap = 0;
+	size_t num_lines = 0;
 
-		case IRC_CB_PART: {
-			params[0] = va_arg(va, const char*); // chan;
-			origin    = va_arg(va, const char*); // name;
+	int64_t start = util_trace_now();
 
-			irc_on_part(irc_ctx, "", origin, params, 1);
-		} break;
+	while(running && getline(&line, &line_cap, in) != -1){
+		util_replay_line(line);
+		util_replay_drain_cmds();
 
-		case IRC_CB_ACTION: {
-			params[0] = va_arg(va, const char*); // chan
-			origin    = va_arg(va, const char*); // name
-			params[1] = va_arg(va, const char*); // msg
+		if((++num_lines & 255) == 0){
+			util_timer_run(util_ms_now());
+		}
+	}
 
-			irc_on_action(irc_ctx, "", origin, params, 2);
-		} break;
+	double secs = (util_trace_now() - start) / 1e9;
 
-		case IRC_CB_NICK: {
-			origin    = va_arg(va, const char*); // prev_nick
-			params[0] = va_arg(va, const char*); // new_nick
+	free(line);
+	if(in != stdin) fclose(in);
+	if(replay_out) fclose(replay_out);
 
-			irc_on_nick(irc_ctx, "", origin, params, 1);
-		} break;
+	struct rusage usage = {};
+	getrusage(RUSAGE_SELF, &usage);
 
-		case IRC_CB_PM: {
-			// params[0] unused?
-			origin    = va_arg(va, const char*); // name
-			params[1] = va_arg(va, const char*); // msg
+	printf("\nReplayed %zu lines in %.3fs (%.0f lines/s), %zu messages sent, peak RSS %ld KiB\n\n",
+	       num_lines, secs, secs > 0 ? num_lines / secs : 0.0, replay_sent, usage.ru_maxrss);
 
-			irc_on_pm(irc_ctx, "", origin, params, 2);
-		} break;
+	Module** mods = NULL;
+	sb_each(m, irc_modules){
+		sb_push(mods, m);
 	}
+	qsort(mods, sb_count(mods), sizeof(*mods), &util_replay_mod_cmp);
 
-	va_end(va);
+	printf("%-20s %12s %12s %10s\n", "module", "calls", "total ms", "avg us");
+	sb_each(m, mods){
+		Module* mod = *m;
+		printf("%-20s %12" PRIu64 " %12.3f %10.3f\n", mod->ctx->name, mod->trace_calls, mod->trace_ns / 1e6,
+		       mod->trace_calls ? (mod->trace_ns / 1e3) / mod->trace_calls : 0.0);
+	}
+	sb_free(mods);
 }
 
-static const IRCCoreCtx core_ctx = {
-	.api_version  = INSO_CORE_API_VERSION,
-	.get_info     = &core_get_info,
-	.get_username = &core_get_username,
-	.get_datafile = &core_get_datafile,
-	.get_modules  = &core_get_modules,
-	.get_channels = &core_get_channels,
-	.get_nicks    = &core_get_nicks,
-	.send_msg     = &core_send_msg,
-	.send_raw     = &core_send_raw,
-	.send_ipc     = &core_send_ipc,
-	.send_mod_msg = &core_send_mod_msg,
-	.join         = &core_join,
-	.part         = &core_part,
-	.save_me      = &core_self_save,
-	.log          = &core_log,
-	.strip_colors = &core_strip_colors,
-	.responded    = &core_responded,
-	.get_tag      = &core_get_tag,
-	.gen_event    = &core_gen_event,
-};
-
-/***************
- * entry point *
- * *************/
+#endif
 
 int main(int argc, char** argv){
 
@@ -1691,26 +5626,45 @@ int main(int argc, char** argv){
 	*path_end = 0;
 
 	static const char in_mod_suffix[] = "/modules/";
+#ifdef INSOBOT_REPLAY
+	// don't touch the real bot's data
+	static const char in_dat_suffix[] = "/data-replay/";
+#else
 	static const char in_dat_suffix[] = "/data/";
+#endif
 	static const char glob_suffix[]   = "/modules/*.so";
 
 	if(path_end + sizeof(in_dat_suffix) >= our_path + sizeof(our_path)){
 		errx(1, "Path too long!");
 	}
 
+#ifdef INSOBOT_REPLAY
+	memcpy(path_end, in_dat_suffix, sizeof(in_dat_suffix));
+	mkdir(our_path, 0700);
+	*path_end = 0;
+#else
 	util_check_data_migrate(our_path);
+#endif
 
 	// parent process setup
 
+#ifndef INSOBOT_REPLAY
 	if(!getenv("INSOBOT_NO_FORK")){
 		util_multiprocess_init(); // *** NOTE: only the child process will return from this function ***
 	}
+#endif
 
 	srand(time(0));
 	signal(SIGSEGV, &util_handle_sig);
 	signal(SIGINT , &util_handle_sig);
+	signal(SIGUSR2, &util_handle_sig);
 	signal(SIGPIPE, SIG_IGN);
 
+	sigemptyset(&int_sigmask);
+	sigaddset(&int_sigmask, SIGINT);
+	sigaddset(&int_sigmask, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &int_sigmask, &wait_sigmask);
+
 	if(!setlocale(LC_CTYPE, "C.UTF-8")){
 		fprintf(stderr, "Warning: Couldn't set \"C.UTF-8\" locale. Hopefully your default is UTF-8.\n");
 		setlocale(LC_CTYPE, "");
@@ -1729,12 +5683,19 @@ int main(int argc, char** argv){
 
 	memcpy(path_end, in_dat_suffix, sizeof(in_dat_suffix));
 	util_inotify_add(&inotify.data, our_path, IN_CLOSE_WRITE | IN_MOVED_TO);
+	data_path = strdup(our_path);
 
-	// ipc & curl init
+	// ipc, async & curl init
 
+#ifndef INSOBOT_REPLAY
 	util_ipc_init();
+#endif
+	util_async_init();
 
 	curl_global_init(CURL_GLOBAL_ALL);
+	util_http_init();
+
+	util_event_init();
 
 	// find modules
 
@@ -1763,7 +5724,9 @@ int main(int argc, char** argv){
 	// modules init
 
 
-	sb_push(channels, 0);
+	util_registry_init();
+	util_conns_init();
+	util_cmd_queues_init();
 
 	// check for patched lib with ircv3 tag parsing hack
 	{
@@ -1772,6 +5735,9 @@ int main(int argc, char** argv){
 		if(irc_maj == 1 && irc_min == 0x1b07){
 			have_tag_hack = 1;
 		}
+#ifdef INSOBOT_REPLAY
+		have_tag_hack = 1;
+#endif
 	}
 
 	// initial load of modules
@@ -1799,203 +5765,94 @@ int main(int argc, char** argv){
 
 	// irc init
 
-	user = util_env_else("IRC_USER", DEFAULT_BOT_NAME);
-	pass = util_env_else("IRC_PASS", NULL);
-	serv = util_env_else("IRC_SERV", "irc.nonexistent.domain");
-	port = util_env_else("IRC_PORT", "6667");
 	bot_nick = strdup(user);
 
-	static irc_callbacks_t callbacks = {
-		.event_connect     = irc_on_connect,
-		.event_channel     = irc_on_chat_msg,
-		.event_privmsg     = irc_on_pm,
-		.event_join        = irc_on_join,
-		.event_part        = irc_on_part,
-		.event_quit        = irc_on_quit,
-		.event_nick        = irc_on_nick,
-		.event_ctcp_action = irc_on_action,
-		.event_numeric     = irc_on_numeric,
-		.event_unknown     = irc_on_unknown,
-		.event_invite      = irc_on_invite,
-	};
+#ifdef INSOBOT_REPLAY
+	// nothing to wait for, commands go straight to the output.
+	sb_each(c, irc_conns){
+		c->registered = true;
+	}
 
-	// outer main loop, (re)set irc state
+	util_replay(argc, argv);
+#else
+	// main loop, connections are (re)made by util_run_timers
 
-	do {
-		if(!(irc_ctx = irc_create_session(&callbacks))){
-			fprintf(stderr, "Failed to create irc session.\n");
-			exit(1);
-		}
+	while(running){
 
-		char* libirc_serv;
-		if(getenv("IRC_ENABLE_SSL")){
-			puts("Using ssl connection...");
-			asprintf_check(&libirc_serv, "#%s", serv);
+		int64_t deadline_ms = util_run_timers();
 
-			//XXX: you might not want this!
-			irc_option_set(irc_ctx, LIBIRC_OPTION_SSL_NO_VERIFY);
-		} else {
-			libirc_serv = strdup(serv);
+		sb_each(c, irc_conns){
+			util_irc_update_fd(c);
 		}
+		util_timer_arm(deadline_ms);
 
-		if(irc_connect(irc_ctx, libirc_serv, atoi(port), pass, user, user, user) != 0){
-			fprintf(stderr, "Unable to connect: %s\n", irc_strerror(irc_errno(irc_ctx)));
+		if(debug_chan && debug_pipe[0] && !debug_fd_added){
+			util_epoll_ctl(EPOLL_CTL_ADD, debug_pipe[0], EV_DEBUG, EPOLLIN);
+			debug_fd_added = true;
 		}
 
-		free(libirc_serv);
-
-		// inner main loop
-
-		while(running && irc_is_connected(irc_ctx)){
-
-			util_process_pending_cmds();
-
-			//TODO: check on_meta & better timing for on_tick?
-			time_t now = time(0);
-			IRC_MOD_CALL_ALL(on_tick, (now));
-
-			int max_fd = 0;
-			fd_set in, out;
-
-			FD_ZERO(&in);
-			FD_ZERO(&out);
-
-			FD_SET(STDIN_FILENO, &in);
-			FD_SET(ipc_socket  , &in);
-			FD_SET(inotify.fd  , &in);
-
-			max_fd = INSO_MAX(max_fd, STDIN_FILENO);
-			max_fd = INSO_MAX(max_fd, ipc_socket);
-			max_fd = INSO_MAX(max_fd, inotify.fd);
-
-			if(debug_chan && debug_pipe[0]){
-				FD_SET(debug_pipe[0], &in);
-				max_fd = INSO_MAX(max_fd, debug_pipe[0]);
-			}
-
-			if(irc_add_select_descriptors(irc_ctx, &in, &out, &max_fd) != 0){
-				fprintf(stderr, "Error adding select fds: %s\n", irc_strerror(irc_errno(irc_ctx)));
-			}
-
-			struct timeval tv = {
-				.tv_sec  = 0,
-				.tv_usec = 250000,
-			}, orig_tv = tv;
-
-			int select_status = select(max_fd + 1, &in, &out, NULL, &tv);
-
-			if(select_status > 0){
-
-				if(FD_ISSET(STDIN_FILENO, &in)){
-					FD_CLR(STDIN_FILENO, &in);
-					char stdin_buf[1024];
-					ssize_t n = read(STDIN_FILENO, stdin_buf, sizeof(stdin_buf));
-					if(n > 0){
-						stdin_buf[n-1] = 0; // remove \n
-						IRC_MOD_CALL_ALL(on_stdin, (stdin_buf));
-					}
-				}
-
-				if(FD_ISSET(ipc_socket, &in)){
-					FD_CLR(ipc_socket, &in);
-					util_ipc_recv();
-				}
-
-				if(FD_ISSET(inotify.fd, &in)){
-					FD_CLR(inotify.fd, &in);
-					if(util_inotify_check()) {
-						util_reload_modules();
-					}
-				}
-
-				if(FD_ISSET(debug_pipe[0], &in)){
-					FD_CLR(debug_pipe[0], &in);
-					char buf[256];
-					char* fname;
-					int off;
-					size_t n = read(debug_pipe[0], buf, sizeof(buf)-1);
-
-					if(n > 0 && sscanf(buf, "%m[^(]%n", &fname, &off) == 1){
-						buf[n-1] = 0; // remove \n
-						core_send_msg(debug_chan, "Recovered from crash: %s%s", basename(fname), buf + off);
-						free(fname);
-					}
-				}
-
-				for(int i = 0; i < max_fd + 1; ++i){
-					if(FD_ISSET(i, &in)){
-						timerclear(&idle_tv);
-						ping_sent = 0;
-						break;
-					}
-				}
-
-				if(irc_process_select_descriptors(irc_ctx, &in, &out) != 0){
-					fprintf(stderr, "Error processing select fds: %s\n", irc_strerror(irc_errno(irc_ctx)));
-				}
-
-			} else if(select_status == 0){
-
-				struct timeval ping_tv    = { .tv_sec = 60 };
-				struct timeval restart_tv = { .tv_sec = 90 };
+		struct epoll_event events[32];
+		int n = epoll_pwait(epoll_fd, events, ARRAY_SIZE(events), -1, &wait_sigmask);
 
-				timeradd(&orig_tv, &idle_tv, &idle_tv);
-
-				if(!ping_sent && timercmp(&idle_tv, &ping_tv, >)){
-					irc_send_raw(irc_ctx, "PING %s", serv);
-					ping_sent = 1;
-				} else if(ping_sent && timercmp(&idle_tv, &restart_tv, >)){
-					puts("Reached 'no PONG' threshold, disconnecting.");
-					irc_disconnect(irc_ctx);
-				}
+		if(n == -1 && errno != EINTR){
+			perror("epoll_wait");
+		}
 
-			} else {
-				perror("select");
-			}
+		if(trace_dump_requested){
+			trace_dump_requested = 0;
+			util_trace_dump();
 		}
 
-		irc_destroy_session(irc_ctx);
-		timerclear(&idle_tv);
-		ping_sent = 0;
+		for(int i = 0; i < n; ++i){
+			util_event_dispatch(events + i);
+		}
+	}
 
-		if(running){
-			puts("Restarting.");
-			if(getenv("INSOBOT_NO_AUTO_RESTART")){
-				puts("(when you press a key...)");
-				getchar();
-			}
-			usleep(10000000L);
+	sb_each(c, irc_conns){
+		if(c->session){
+			util_conn_close(c);
 		}
-	} while(running);
+	}
+#endif
 
 	// clean stuff up so real leaks are more obvious in valgrind
 
 	sb_each(m, irc_modules){
-		util_module_save(m);
+		util_module_cancel(m);
+		util_module_save(m, true);
+		util_journal_close(m);
 		IRC_MOD_CALL(m, on_quit, ());
 		free(m->lib_path);
-		dlclose(m->lib_handle);
-		m->lib_handle = NULL;
+		util_module_dlclose(m);
 	}
 
 	sb_free(irc_modules);
+	sb_free(irc_conns);
 	sb_free(chan_mod_list);
 	sb_free(global_mod_list);
 	sb_free(mod_call_stack);
-	sb_free(cmd_queue);
-	sb_free(irc_tag_ptrs);
-
+	util_cmd_queues_free();
+	util_trace_free();
+	sb_free(irc_tag_buf);
+	sb_free(irc_tags);
+	sb_free(irc_tag_slots);
+	sb_free(msg_view_plain);
+	sb_free(msg_view_lower);
+	sb_free(msg_view_words);
+	sb_free(msg_view_urls);
+	sb_free(timers);
+	sb_free(timer_heap);
+	sb_free(timer_free);
+	sb_free(mod_fds);
+	util_cmd_index_free();
+	util_meta_clear();
+
+	util_async_quit();
+	util_http_quit();
 	curl_global_cleanup();
+	util_event_quit();
 
-	for(size_t i = 0; i < sb_count(channels) - 1; ++i){
-		free(channels[i]);
-		for(size_t j = 0; j < sb_count(chan_nicks[i]); ++j){
-			free(chan_nicks[i][j]);
-		}
-		sb_free(chan_nicks[i]);
-	}
-	sb_free(channels);
-	sb_free(chan_nicks);
+	util_registry_free();
 
 	free(bot_nick);
 
@@ -2007,13 +5864,20 @@ int main(int argc, char** argv){
 		close(ipc_socket);
 		unlink(ipc_self.addr.sun_path);
 	}
+	sb_each(p, ipc_peers){
+		util_ipc_peer_free(p);
+	}
 	sb_free(ipc_peers);
+	if(ipc_routes.memory){
+		inso_ht_free(&ipc_routes);
+	}
 
 	if(pipe_fds[1]){
 		close(pipe_fds[1]);
 	}
 
 	free(insobot_path);
+	free(data_path);
 
 	return 0;
 }
@@ -28,6 +28,7 @@ const IRCModuleCtx irc_mod_ctx = {
 	.on_init     = &alias_init,
 	.on_quit     = &alias_quit,
 	.on_mod_msg  = &alias_mod_msg,
+	.prefilter   = &(const IRCMsgPrefilter){ .first_chars = "!" }, // ALIAS_CHAR
 	.commands    = DEFINE_CMDS (
 		[ALIAS_ADD]         = CMD("alias"     ) CMD("alias+"   ),
 		[ALIAS_ADD_GLOBAL]  = CMD("galias"    ) CMD("galias+"  ),
@@ -1,11 +1,11 @@
 #include "module.h"
 
-#include <regex.h>
 #include <string.h>
 #include <wchar.h>
 #include <ctype.h>
 #include <time.h>
 #include "stb_sb.h"
+#include "inso_ht.h"
 #include "inso_utils.h"
 
 //#define TRIGGER_HAPPY
@@ -14,6 +14,7 @@ static void automod_msg     (const char*, const char*, const char*);
 static void automod_cmd     (const char*, const char*, const char*, int);
 static bool automod_init    (const IRCCoreCtx*);
 static void automod_join    (const char*, const char*);
+static void automod_join_bulk(const char*, const char**, size_t);
 static void automod_connect (const char*);
 static void automod_quit    (void);
 
@@ -28,6 +29,7 @@ const IRCModuleCtx irc_mod_ctx = {
 	.on_init    = &automod_init,
 	.on_connect = &automod_connect,
 	.on_join    = &automod_join,
+	.on_join_bulk = &automod_join_bulk,
 	.on_quit    = &automod_quit,
 	.commands   = DEFINE_CMDS(
 		[AUTOMOD_TIMEOUT] = CMD("b") CMD("ko"),
@@ -54,22 +56,15 @@ static Suspect** suspects;
 
 static time_t init_time;
 static bool is_twitch;
-static regex_t url_regex;
 
 static bool automod_init(const IRCCoreCtx* _ctx){
 	ctx = _ctx;
 	init_time = time(0);
 	is_twitch = true;
-	return regcomp(
-		&url_regex,
-        "\\b(https?://[^[:space:]]+|[a-zA-Z0-9][a-zA-Z0-9\\-_]*\\.[A-Za-z]{2,5}(\\.[A-Za-z]{2,5})*([:space:]|$|/|#|:|\\?))",
-		REG_ICASE | REG_EXTENDED | REG_NEWLINE
-	) == 0;
+	return true;
 }
 
 static void automod_quit(void){
-	regfree(&url_regex);
-
 	for(char** c = channels; c < sb_end(channels); ++c){
 		free(*c);
 	}
@@ -88,21 +83,20 @@ static void automod_connect(const char* serv){
 	is_twitch = strcasestr(serv, "twitch.tv") || getenv("IRC_IS_TWITCH");
 }
 
-static Suspect* get_suspect(const char* chan, const char* name){
-
-	int index = -1;
+static int get_chan_index(const char* chan){
 	for(size_t i = 0; i < sb_count(channels); ++i){
 		if(strcmp(chan, channels[i]) == 0){
-			index = i;
-			break;
+			return i;
 		}
 	}
 
-	if(index == -1){
-		sb_push(channels, strdup(chan));
-		sb_push(suspects, NULL);
-		index = sb_count(channels) - 1;
-	}
+	sb_push(channels, strdup(chan));
+	sb_push(suspects, NULL);
+	return sb_count(channels) - 1;
+}
+
+static Suspect* get_suspect(const char* chan, const char* name){
+	int index = get_chan_index(chan);
 
 	for(size_t i = 0; i < sb_count(suspects[index]); ++i){
 		if(strcmp(suspects[index][i].name, name) == 0){
@@ -133,6 +127,59 @@ static void automod_join(const char* chan, const char* name){
 	}
 }
 
+// a set of one channel's suspects, only kept for the duration of automod_join_bulk
+typedef struct {
+	uint32_t hash;
+	uint32_t idx;
+} SuspectKey;
+
+static Suspect* bulk_suspects;
+
+static size_t suspect_key_hash(const void* arg){
+	return ((const SuspectKey*)arg)->hash;
+}
+
+static bool suspect_key_cmp(const void* elem, void* param){
+	return strcmp(bulk_suspects[((const SuspectKey*)elem)->idx].name, param) == 0;
+}
+
+static void automod_join_bulk(const char* chan, const char** names, size_t count){
+	const char* self = ctx->get_username();
+	const time_t now = time(0);
+
+	int index = get_chan_index(chan);
+
+	inso_ht set = {};
+	inso_ht_init(&set, (sb_count(suspects[index]) + count) * 2, sizeof(SuspectKey), &suspect_key_hash);
+
+	for(size_t i = 0; i < sb_count(suspects[index]); ++i){
+		inso_ht_put(&set, &(SuspectKey){ inso_hash_nocase(suspects[index][i].name, 0), i });
+	}
+
+	for(size_t i = 0; i < count; ++i){
+		if(strcmp(names[i], self) == 0) continue;
+
+		bulk_suspects = suspects[index];
+
+		uint32_t hash = inso_hash_nocase(names[i], 0);
+		SuspectKey* key = inso_ht_get(&set, hash, &suspect_key_cmp, (void*)names[i]);
+
+		Suspect* s;
+		if(key){
+			s = suspects[index] + key->idx;
+		} else {
+			sb_push(suspects[index], (Suspect){ .name = strdup(names[i]) });
+			inso_ht_put(&set, &(SuspectKey){ hash, sb_count(suspects[index]) - 1 });
+			s = &sb_last(suspects[index]);
+		}
+
+		if(!s->join) s->join = now;
+	}
+
+	bulk_suspects = NULL;
+	inso_ht_free(&set);
+}
+
 #ifdef TRIGGER_HAPPY
 static int am_score_caps(const Suspect* s, const char* msg, size_t len){
 	size_t num_caps = 0;
@@ -254,12 +301,7 @@ static intptr_t get_user_cb(time_t result, time_t* arg){
 }
 
 static int am_score_links(const Suspect* s, const char* msg, size_t len){
-	bool is_url = false;
-	regmatch_t match;
-
-	if(regexec(&url_regex, msg, 1, &match, 0) == 0){
-		is_url = true;
-	}
+	bool is_url = ctx->get_msg_view()->num_urls > 0;
 
 	time_t now = time(0);
 
@@ -306,15 +348,10 @@ static int am_score_flood(const Suspect* s, const char* msg, size_t len){
 
 static int am_score_emotes(const Suspect* s, const char* msg, size_t len){
 	int emote_count = 0;
-	int i = 0;
-	const char *k, *v;
+	const char* v = ctx->get_tag_by_name("emotes");
 
-	while(ctx->get_tag(i++, &k, &v)){
-		if(strcmp(k, "emotes") != 0) continue;
-		for(; *v; ++v){
-			if(*v == ':' || *v == ',') ++emote_count;
-		}
-		break;
+	for(; v && *v; ++v){
+		if(*v == ':' || *v == ',') ++emote_count;
 	}
 
 	return emote_count >= 5 ? 100 : emote_count * 10;
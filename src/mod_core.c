@@ -14,6 +14,7 @@ static bool core_init    (const IRCCoreCtx*);
 static void core_quit    (void);
 static void core_connect (const char*);
 static void core_mod_msg (const char* sender, const IRCModMsg* msg);
+static void core_modified(void);
 
 enum { CMD_MODULES, CMD_MOD_ON, CMD_MOD_OFF, CMD_MOD_INFO, CMD_JOIN, CMD_LEAVE };
 
@@ -31,6 +32,7 @@ const IRCModuleCtx irc_mod_ctx = {
 	.on_quit    = &core_quit,
 	.on_connect = &core_connect,
 	.on_mod_msg = &core_mod_msg,
+	.on_modified = &core_modified,
 	.commands = DEFINE_CMDS (
 		[CMD_MODULES]  = CMD("m")     CMD("modules"),
 		[CMD_MOD_ON]   = CMD("mon")   CMD("modon"),
@@ -112,6 +114,29 @@ static bool core_init(const IRCCoreCtx* _ctx){
 	return reload_file();
 }
 
+static void core_modified(void){
+	// remember which channels we're already in, reload_file throws that away.
+	char** joined = NULL;
+	sb_each(c, core_chans){
+		if(c->done_join) sb_push(joined, strdup(c->name));
+	}
+
+	reload_file();
+
+	sb_each(j, joined){
+		sb_each(c, core_chans){
+			if(strcmp(c->name, *j) == 0){
+				c->done_join = true;
+				break;
+			}
+		}
+		free(*j);
+	}
+	sb_free(joined);
+
+	ctx->invalidate_meta(NULL);
+}
+
 static struct chan* core_get_or_add(const char* chan_name){
 	sb_each(c, core_chans){
 		if(strcmp(c->name, chan_name) == 0){
@@ -185,6 +210,7 @@ static void core_cmd(const char* chan, const char* name, const char* arg, int cm
 					} else {
 						argz_add(&info->mod_list_argz, &info->mod_list_len, arg);
 						ctx->send_msg(chan, "%s: Enabled module %s.", name, arg);
+						ctx->invalidate_meta(chan);
 						ctx->save_me();
 					}
 
@@ -211,6 +237,7 @@ static void core_cmd(const char* chan, const char* name, const char* arg, int cm
 					if(mod){
 						argz_delete(&info->mod_list_argz, &info->mod_list_len, mod);
 						ctx->send_msg(chan, "%s: Disabled module %s.", name, (*modules)->name);
+						ctx->invalidate_meta(chan);
 						ctx->save_me();
 					} else {
 						ctx->send_msg(chan, "%s: That module is already disabled here!", name);
@@ -323,11 +350,11 @@ static void core_connect(const char* serv){
 		}
 	}
 
+	// the core batches these into as few JOIN lines as its join rate limit allows.
 	sb_each(c, core_chans){
 		if(c->should_join){
 			ctx->join(c->name);
 			c->done_join = true;
-			break;
 		}
 	}
 }
@@ -336,18 +363,10 @@ static void core_join(const char* chan, const char* name){
 	if(strcmp(name, ctx->get_username()) != 0) return;
 
 	struct chan* info = core_get_or_add(chan);
+	bool was_joining = info->should_join;
 	info->should_join = info->done_join = true;
 
-	bool found = false;
-	sb_each(c, core_chans){
-		if(c->should_join && !c->done_join){
-			ctx->join(c->name);
-			found = c->done_join = true;
-			break;
-		}
-	}
-
-	if(!found){
+	if(!was_joining){
 		ctx->save_me();
 	}
 }
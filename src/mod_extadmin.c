@@ -8,7 +8,7 @@
 #include <errno.h>
 
 static bool extadmin_init   (const IRCCoreCtx*);
-static void extadmin_tick   (time_t now);
+static void extadmin_fd     (int fd, uint32_t events);
 static void extadmin_quit   (void);
 static void extadmin_filter (size_t, const char*, char*, size_t);
 
@@ -17,8 +17,8 @@ const IRCModuleCtx irc_mod_ctx = {
 	.desc      = "external admin",
 	.on_init   = &extadmin_init,
 	.on_quit   = &extadmin_quit,
-	.on_tick   = &extadmin_tick,
 	.on_filter = &extadmin_filter,
+	.on_fd     = &extadmin_fd,
 };
 
 static const IRCCoreCtx* ctx;
@@ -57,6 +57,10 @@ static bool extadmin_init(const IRCCoreCtx* _ctx){
 		return false;
 	}
 
+	if(!ctx->add_fd(sock, IRC_FD_READ)){
+		return false;
+	}
+
 	return true;
 }
 
@@ -81,40 +85,59 @@ static void run_command(struct client* c, char* buf, size_t n) {
 	}
 }
 
-static void extadmin_tick(time_t now) {
+static void client_close(struct client* c) {
+	ctx->del_fd(c->fd);
+	close(c->fd);
+	sb_free(c->filter_ids);
+	sb_erase(clients, c - clients);
+}
+
+static void extadmin_fd(int fd, uint32_t events) {
 
-	int cfd;
-	while((cfd = accept4(sock, NULL, NULL, SOCK_NONBLOCK)) != -1){
-		printf("new client: %d\n", cfd);
+	if(fd == sock) {
+		int cfd;
+		while((cfd = accept4(sock, NULL, NULL, SOCK_NONBLOCK)) != -1){
+			printf("new client: %d\n", cfd);
 
-		struct client c = {
-			.fd = cfd,
-			.connected_at = now
-		};
+			struct client c = {
+				.fd = cfd,
+				.connected_at = time(0)
+			};
 
-		sb_push(clients, c);
+			if(ctx->add_fd(cfd, IRC_FD_READ)) {
+				sb_push(clients, c);
+			} else {
+				close(cfd);
+			}
+		}
+		return;
 	}
 
 	sb_each(c, clients) {
+		if(c->fd != fd)
+			continue;
+
 		char buf[512];
 		ssize_t n = recv(c->fd, buf, sizeof(buf)-1, 0);
 
-		if(n == -1) {
-			if(errno != EAGAIN) {
-				close(c->fd);
-				sb_erase(clients, c - clients);
-				--c;
-			}
-			continue;
+		if(n == -1 && errno == EAGAIN) {
+			break;
+		}
+
+		// error or the client hung up
+		if(n <= 0) {
+			client_close(c);
+			break;
 		}
 
 		buf[n] = '\0';
 
-		if(n > 0 && buf[n-1] == '\n') {
+		if(buf[n-1] == '\n') {
 			buf[n-1] = '\0';
 		}
 
 		run_command(c, buf, n);
+		break;
 	}
 }
 
@@ -155,8 +178,7 @@ static void extadmin_filter (size_t id, const char* chan, char* msg, size_t msg_
 		}
 
 		if(sb_count(c->filter_ids) == 0) {
-			close(c->fd);
-			sb_erase(clients, c - clients);
+			client_close(c);
 			--c;
 		}
 	}
@@ -11,13 +11,14 @@
 #include "inso_tz.h"
 #include "inso_xml.h"
 #include "inso_json.h"
+#include "inso_http.h"
 
 static void hmh_cmd     (const char*, const char*, const char*, int);
 static bool hmh_init    (const IRCCoreCtx*);
 static void hmh_quit    (void);
 static void hmh_mod_msg (const char* sender, const IRCModMsg* msg);
 static void hmh_ipc     (int who, const uint8_t* ptr, size_t sz);
-static void hmh_tick    (time_t);
+static void hmh_owlbot_end (void*);
 
 
 enum { CMD_SCHEDULE, CMD_TIME, CMD_OWLBOT, CMD_OWL_Y, CMD_OWL_N, CMD_QA, CMD_LATEST };
@@ -30,7 +31,6 @@ const IRCModuleCtx irc_mod_ctx = {
 	.on_quit    = &hmh_quit,
 	.on_mod_msg = &hmh_mod_msg,
 	.on_ipc     = &hmh_ipc,
-	.on_tick    = &hmh_tick,
 	.commands = DEFINE_CMDS (
 		[CMD_SCHEDULE] = CMD("schedule"),
 		[CMD_TIME]     = CMD("tm") CMD("time") CMD("when"),
@@ -62,6 +62,7 @@ static time_t schedule_week;
 static char* tz_buf;
 
 static time_t owlbot_timer;
+static size_t owlbot_timer_id;
 static char** owlbot_voters;
 static int    owlbot_yea;
 static int    owlbot_nay;
@@ -73,7 +74,20 @@ static int irc_server;
 static time_t last_yt_fetch;
 static char*  latest_ep_str;
 
+static inso_http_req* schedule_req;
+static inso_http_req* latest_req;
+
+typedef struct {
+	int   cmd;
+	char* chan;
+	char* name;
+	char* arg;
+} HMHPendingCmd;
+
+static sb(HMHPendingCmd) pending_cmds;
+
 static const char* hmh_get_channel(void);
+static void hmh_run_pending(bool schedule_cmds, bool cancelled);
 
 #define CLEAR_SCHEDULE()({ if(schedule){ stb__sbn(schedule) = 0; } })
 
@@ -87,26 +101,9 @@ static time_t get_week_time(const struct tm* tm) {
 	return mktime(&tmp);
 }
 
-static bool update_schedule(void){
+static void parse_schedule(const char* data){
 
 	time_t now = time(0);
-	char* data = NULL;
-
-	CURL* curl = inso_curl_init(schedule_url, &data);
-
-	int curl_ret = curl_easy_perform(curl);
-	long http_code = 0;
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-	curl_easy_cleanup(curl);
-
-	sb_push(data, 0);
-
-	if(curl_ret != 0){
-		fprintf(stderr, "Error getting schedule: %s\n", curl_easy_strerror(curl_ret));
-		sb_free(data);
-		return false;
-	}
-
 	char* tz = tz_push(":US/Pacific");
 
 	// update schedule_week
@@ -158,9 +155,8 @@ static bool update_schedule(void){
 	}
 
 out:
+	yajl_tree_free(root);
 	tz_pop(tz);
-	sb_free(data);
-	return true;
 }
 
 static intptr_t check_alias_cb(intptr_t result, intptr_t arg){
@@ -208,13 +204,6 @@ static char* parse_timezone(const char* arg) {
 static void print_schedule(const char* chan, const char* name, const char* arg){
 	time_t now = time(0);
 
-	bool empty_sched = sb_count(schedule) == 0;
-
-	const long lim = empty_sched ? 30 : 1800;
-	if(now - last_schedule_update > lim && update_schedule()){
-		last_schedule_update = now;
-	}
-
 	// parse args (timezone and/or 'terse' for old-style day grouping)
 
 	bool terse = false;
@@ -365,15 +354,6 @@ static intptr_t twitch_callback(intptr_t result, intptr_t arg){
 static void print_time(const char* chan, const char* name, const char* arg){
 	time_t now = time(0);
 
-	// test for empty schedule, and attempt update
-	{
-		bool empty_sched = sb_count(schedule) == 0;
-		const long lim = empty_sched ? 30 : 1800;
-		if(now - last_schedule_update > lim && update_schedule()){
-			last_schedule_update = now;
-		}
-	}
-
 	enum { SCHED_UNKNOWN = 0, SCHED_OFF = (1 << 0), SCHED_OLD = (1 << 1) };
 
 	int stream_duration_mins;
@@ -541,17 +521,15 @@ static bool check_for_alias(const char* keys, const char* chan, const char* cc){
 static void hmh_owlbot_start(void){
 	owlbot_timer = time(0);
 	owlbot_yea = owlbot_nay = 0;
+
+	// a vote started over ipc while one is running restarts it.
+	ctx->cancel_timer(owlbot_timer_id);
+	owlbot_timer_id = ctx->add_timer(60 * 1000, 0, &hmh_owlbot_end, NULL);
 	HMH_MSG("(/o.o): Owl vote started. Use !owly or !owln to vote whether or not to light The Owl and notify Casey of something important.");
 }
 
-static void hmh_fetch_latest(void){
-	sb(char) data = NULL;
-	CURL* curl = inso_curl_init("https://www.youtube.com/feeds/videos.xml?channel_id=UCaTznQhurW5AaiYPbhEA-KA", &data);
-
-	curl_easy_setopt(curl, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
-	curl_easy_setopt(curl, CURLOPT_TIMEVALUE, last_yt_fetch);
-
-	long status = inso_curl_perform(curl, &data);
+static void hmh_latest_done(inso_http_req* req, long status, char* data){
+	latest_req = NULL;
 
 	if(status == 200){
 		uintptr_t* tokens = calloc(0x1000, sizeof(uintptr_t));
@@ -584,8 +562,38 @@ static void hmh_fetch_latest(void){
 		last_yt_fetch = time(0);
 	}
 
-	curl_easy_cleanup(curl);
-	sb_free(data);
+	hmh_run_pending(false, status == -CURLE_ABORTED_BY_CALLBACK);
+}
+
+static void hmh_fetch_latest(void){
+	if(latest_req) return;
+
+	latest_req = inso_http_new("https://www.youtube.com/feeds/videos.xml?channel_id=UCaTznQhurW5AaiYPbhEA-KA", &hmh_latest_done, NULL);
+
+	curl_easy_setopt(latest_req->curl, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
+	curl_easy_setopt(latest_req->curl, CURLOPT_TIMEVALUE, last_yt_fetch);
+
+	inso_http_send(ctx, latest_req);
+}
+
+static void hmh_schedule_done(inso_http_req* req, long status, char* data){
+	schedule_req = NULL;
+
+	if(status == 200){
+		parse_schedule(data);
+		last_schedule_update = time(0);
+	} else {
+		fprintf(stderr, "mod_hmh: error getting schedule: %ld\n", status);
+	}
+
+	hmh_run_pending(true, status == -CURLE_ABORTED_BY_CALLBACK);
+}
+
+static void hmh_fetch_schedule(void){
+	if(schedule_req) return;
+
+	schedule_req = inso_http_new(schedule_url, &hmh_schedule_done, NULL);
+	inso_http_send(ctx, schedule_req);
 }
 
 static const char* hmh_get_channel(void){
@@ -604,7 +612,7 @@ static void hmh_qa_msg(void){
 	}
 }
 
-static void hmh_cmd(const char* chan, const char* name, const char* arg, int cmd){
+static void hmh_do_cmd(const char* chan, const char* name, const char* arg, int cmd){
 
 	int* owl_vote = &owlbot_nay;
 
@@ -656,10 +664,6 @@ static void hmh_cmd(const char* chan, const char* name, const char* arg, int cmd
 		} break;
 
 		case CMD_LATEST: {
-			if(time(0) - last_yt_fetch > (30*60)){
-				hmh_fetch_latest();
-			}
-
 			if(latest_ep_str){
 				ctx->send_msg(chan, "\035Previously on Handmade Hero...\035 [#%s]", latest_ep_str);
 			} else {
@@ -669,32 +673,84 @@ static void hmh_cmd(const char* chan, const char* name, const char* arg, int cmd
 	}
 }
 
-static void hmh_tick(time_t now){
-	if(owlbot_timer && now > owlbot_timer + 60){
-		if((owlbot_nay + owlbot_yea) >= 3){
-			if(owlbot_yea > owlbot_nay){
-				HMH_MSG("(/o.o): The owl will now be signalled. (votes: [Yea: %d, Nay: %d])", owlbot_yea, owlbot_nay);
+static void hmh_run_pending(bool schedule_cmds, bool cancelled){
+	for(size_t i = 0; i < sb_count(pending_cmds); /**/){
+		HMHPendingCmd p = pending_cmds[i];
 
-				if(irc_server == SERV_HMN){
-					size_t id = ctx->send_msg("#hero", "@Owlbot: By popular demand, please become illuminated.");
-					MOD_MSG(ctx, "filter_permit", id, NULL, NULL);
-				}
+		if((p.cmd == CMD_LATEST) == schedule_cmds){
+			++i;
+			continue;
+		}
 
-			} else if(owlbot_nay > owlbot_yea){
-				HMH_MSG("(/x.x): The owl will not be lit. (votes: [Yea: %d, Nay: %d])", owlbot_yea, owlbot_nay);
-			} else {
-				HMH_MSG("(/o.o): It's a tie (%d votes each). The owl will remain unlit.", owlbot_yea);
+		sb_erase(pending_cmds, i);
+
+		if(!cancelled){
+			hmh_do_cmd(p.chan, p.name, p.arg, p.cmd);
+		}
+
+		free(p.chan);
+		free(p.name);
+		free(p.arg);
+	}
+}
+
+// the schedule & latest episode are fetched without blocking, the command waits in pending_cmds until they arrive.
+static void hmh_cmd(const char* chan, const char* name, const char* arg, int cmd){
+	bool fetching = false;
+
+	if(cmd == CMD_SCHEDULE || cmd == CMD_TIME){
+		const long lim = sb_count(schedule) == 0 ? 30 : 1800;
+		if(time(0) - last_schedule_update > lim){
+			hmh_fetch_schedule();
+			fetching = true;
+		}
+	} else if(cmd == CMD_LATEST){
+		if(time(0) - last_yt_fetch > (30*60)){
+			hmh_fetch_latest();
+			fetching = true;
+		}
+	}
+
+	if(fetching){
+		HMHPendingCmd p = {
+			.cmd  = cmd,
+			.chan = strdup(chan),
+			.name = strdup(name),
+			.arg  = strdup(arg),
+		};
+		sb_push(pending_cmds, p);
+	} else {
+		hmh_do_cmd(chan, name, arg, cmd);
+	}
+}
+
+static void hmh_owlbot_end(void* arg){
+	if(!owlbot_timer) return;
+
+	if((owlbot_nay + owlbot_yea) >= 3){
+		if(owlbot_yea > owlbot_nay){
+			HMH_MSG("(/o.o): The owl will now be signalled. (votes: [Yea: %d, Nay: %d])", owlbot_yea, owlbot_nay);
+
+			if(irc_server == SERV_HMN){
+				size_t id = ctx->send_msg("#hero", "@Owlbot: By popular demand, please become illuminated.");
+				MOD_MSG(ctx, "filter_permit", id, NULL, NULL);
 			}
+
+		} else if(owlbot_nay > owlbot_yea){
+			HMH_MSG("(/x.x): The owl will not be lit. (votes: [Yea: %d, Nay: %d])", owlbot_yea, owlbot_nay);
 		} else {
-			HMH_MSG("(/x.x): Not enough votes after 60 seconds. Owl signal cancelled.");
+			HMH_MSG("(/o.o): It's a tie (%d votes each). The owl will remain unlit.", owlbot_yea);
 		}
+	} else {
+		HMH_MSG("(/x.x): Not enough votes after 60 seconds. Owl signal cancelled.");
+	}
 
-		sb_each(v, owlbot_voters){
-			free(*v);
-		}
-		sb_free(owlbot_voters);
-		owlbot_timer = 0;
+	sb_each(v, owlbot_voters){
+		free(*v);
 	}
+	sb_free(owlbot_voters);
+	owlbot_timer = 0;
+	owlbot_timer_id = 0;
 }
 
 static int ftw_cb(const char* path, const struct stat* st, int type){
@@ -726,6 +782,9 @@ static bool hmh_init(const IRCCoreCtx* _ctx){
 }
 
 static void hmh_quit(void){
+	hmh_run_pending(true, true);
+	hmh_run_pending(false, true);
+	sb_free(pending_cmds);
 	sb_free(tz_buf);
 }
 
@@ -3,6 +3,7 @@
 #include "config.h"
 #include "inso_utils.h"
 #include "inso_xml.h"
+#include "inso_http.h"
 #include "stb_sb.h"
 #include <curl/curl.h>
 #include <regex.h>
@@ -13,7 +14,7 @@
 
 static bool hmnrss_init (const IRCCoreCtx*);
 static void hmnrss_quit (void);
-static void hmnrss_tick (time_t);
+static void hmnrss_check(void*);
 
 const IRCModuleCtx irc_mod_ctx = {
 	.name    = "hmnrss",
@@ -21,14 +22,12 @@ const IRCModuleCtx irc_mod_ctx = {
 	.flags   = IRC_MOD_GLOBAL,
 	.on_init = &hmnrss_init,
 	.on_quit = &hmnrss_quit,
-	.on_tick = &hmnrss_tick,
 };
 
 static const IRCCoreCtx* ctx;
-static CURL* curl;
+static inso_http_req* rss_req;
 static char* etag;
 static time_t latest_post;
-static time_t last_check;
 static regex_t url_regex;
 
 typedef struct {
@@ -59,11 +58,11 @@ static size_t etag_cb(char* buffer, size_t size, size_t nelem, void* arg){
 
 static bool hmnrss_init(const IRCCoreCtx* _ctx){
 	ctx = _ctx;
-	curl = curl_easy_init();
 #ifdef DEBUG_MODE
-	last_check = time(0) - 50;
+	ctx->add_timer(10 * 1000, 60 * 1000, &hmnrss_check, NULL);
 #else
-	last_check = latest_post = time(0) - (15*60);
+	latest_post = time(0) - (15*60);
+	ctx->add_timer(0, 60 * 1000, &hmnrss_check, NULL);
 #endif
 	regcomp(&url_regex, "https://([^\\.]*)\\.?handmade\\.network/.*/[0-9]+", REG_ICASE | REG_EXTENDED);
 
@@ -71,7 +70,6 @@ static bool hmnrss_init(const IRCCoreCtx* _ctx){
 }
 
 static void hmnrss_quit(void){
-	curl_easy_cleanup(curl);
 	free(etag);
 	regfree(&url_regex);
 
@@ -143,24 +141,10 @@ static bool hmnrss_check_spam(const char* msg, time_t post_time, const char* mem
 	return false;
 }
 
-static void hmnrss_tick(time_t now){
-	if(now - last_check < 60) return;
-	last_check = now;
-
-	char* data = NULL;
-	inso_curl_reset(curl, RSS_URL, &data);
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &etag_cb);
-	struct curl_slist* headers = NULL;
-
-	if(etag){
-		char buf[1024];
-		snprintf(buf, sizeof(buf), "If-None-Match: %s", etag);
-		headers = curl_slist_append(NULL, buf);
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-	}
+static void hmnrss_done(inso_http_req* req, long ret, char* data){
+	rss_req = NULL;
 
 	time_t new_latest_post = latest_post;
-	long ret = inso_curl_perform(curl, &data);
 
 #ifdef DEBUG_MODE
 	printf("hmnrss: doing check..., %ld, et=%s\n", ret, etag);
@@ -244,10 +228,19 @@ static void hmnrss_tick(time_t now){
 	}
 
 	latest_post = new_latest_post;
+}
+
+static void hmnrss_check(void* arg){
+	if(rss_req) return;
+
+	rss_req = inso_http_new(RSS_URL, &hmnrss_done, NULL);
+	curl_easy_setopt(rss_req->curl, CURLOPT_HEADERFUNCTION, &etag_cb);
 
-	if(headers){
-		curl_slist_free_all(headers);
+	if(etag){
+		char buf[1024];
+		snprintf(buf, sizeof(buf), "If-None-Match: %s", etag);
+		inso_http_header(rss_req, buf);
 	}
 
-	sb_free(data);
+	inso_http_send(ctx, rss_req);
 }
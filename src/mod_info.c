@@ -26,6 +26,15 @@ const IRCModuleCtx irc_mod_ctx = {
 };
 
 static const IRCCoreCtx* ctx;
+static void* curl_share;
+
+// the lookups run on a worker thread, the replies are collected here and sent by info_done.
+struct info_job {
+	char* chan;
+	char* nick;
+	char* arg;
+	sb(char*) replies;
+};
 
 enum { P_TYPE, P_ABSTEXT, P_ABSURL, P_RESULTS, P_RELATED, P_FIRSTURL, P_ANSWER, P_REDIRECT };
 
@@ -40,6 +49,27 @@ static const char* paths[][2] = {
 	[P_REDIRECT] = { "Redirect"     , NULL },
 };
 
+static void info_reply(struct info_job* job, const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+static void info_reply(struct info_job* job, const char* fmt, ...){
+	char* reply;
+	va_list va;
+
+	va_start(va, fmt);
+	if(vasprintf(&reply, fmt, va) != -1){
+		sb_push(job->replies, reply);
+	}
+	va_end(va);
+}
+
+// worker threads, so no signals. Also share the core's dns / tls session cache.
+static void info_curl_reset(CURL* curl, const char* url, char** data){
+	inso_curl_reset(curl, url, data);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	if(curl_share){
+		curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+	}
+}
+
 static char* info_trim(const char* text, int maxlen){
 	const char* p = text-1;
 	int len = 0;
@@ -54,7 +84,7 @@ static char* info_trim(const char* text, int maxlen){
 	return strndup(text, len);
 }
 
-static void info_fallback(const char* chan, const char* arg, CURL* curl){
+static void info_fallback(struct info_job* job, const char* arg, CURL* curl){
 	char* data = NULL;
 	char* url;
 
@@ -64,7 +94,7 @@ static void info_fallback(const char* chan, const char* arg, CURL* curl){
 		curl_free(query);
 	}
 
-	inso_curl_reset(curl, url, &data);
+	info_curl_reset(curl, url, &data);
 	inso_curl_perform(curl, &data);
 	free(url);
 	url = NULL;
@@ -95,10 +125,10 @@ static void info_fallback(const char* chan, const char* arg, CURL* curl){
 
 	if(url){
 		char* d = info_trim(desc, 175);
-		ctx->send_msg(chan, "%s %s", url, d);
+		info_reply(job, "%s %s", url, d);
 		free(d);
 	} else {
-		ctx->send_msg(chan, "Sorry, no information found for '%s'.", arg);
+		info_reply(job, "Sorry, no information found for '%s'.", arg);
 	}
 }
 
@@ -112,18 +142,10 @@ static const char* info_top_result(yajl_val results){
 	return NULL;
 }
 
-static void info_cmd(const char* chan, const char* nick, const char* arg, int cmd){
-	if(cmd != INFO_GET || !inso_is_wlist(ctx, nick)) return;
-
-	if(!*arg++){
-		ctx->send_msg(chan, "What would you like info about, %s?", nick);
-		return;
-	}
-
-	if(strcasecmp(arg, "insobot") == 0){
-		ctx->send_msg(chan, "I'm an IRC bot written in C99 by insofaras: https://github.com/baines/insobot");
-		return;
-	}
+static void info_work(void* _job){
+	struct info_job* job = _job;
+	const char* nick = job->nick;
+	const char* arg  = job->arg;
 
 	char* data = NULL;
 	char* url;
@@ -135,7 +157,7 @@ static void info_cmd(const char* chan, const char* nick, const char* arg, int cm
 		curl_free(query);
 	}
 
-	inso_curl_reset(curl, url, &data);
+	info_curl_reset(curl, url, &data);
 	curl_easy_perform(curl);
 	free(url);
 
@@ -152,14 +174,14 @@ static void info_cmd(const char* chan, const char* nick, const char* arg, int cm
 	sb_free(data);
 
 	if(!root || !type || !abstract || !abs_url || !results || !related){
-		ctx->send_msg(chan, "Sorry, something went wrong getting information...");
+		info_reply(job, "Sorry, something went wrong getting information...");
 		goto exit;
 	}
 
 	switch(*type->u.string){
 
 		case 0: {
-			info_fallback(chan, arg, curl);
+			info_fallback(job, arg, curl);
 		} break;
 
 		case 'D': {
@@ -185,7 +207,7 @@ static void info_cmd(const char* chan, const char* nick, const char* arg, int cm
 				}
 			}
 
-			ctx->send_msg(chan, "'%s' could refer to: %s.", arg, choices);
+			info_reply(job, "'%s' could refer to: %s.", arg, choices);
 		} break;
 
 		case 'E': {
@@ -194,11 +216,11 @@ static void info_cmd(const char* chan, const char* nick, const char* arg, int cm
 
 			if(ans && *ans->u.string){
 				char* str = info_trim(ans->u.string, 200);
-				ctx->send_msg(chan, "%s", str);
+				info_reply(job, "%s", str);
 				free(str);
 			} else if(redir && *redir->u.string){
 				char* location = NULL;
-				inso_curl_reset(curl, redir->u.string, &data);
+				info_curl_reset(curl, redir->u.string, &data);
 
 				curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
 				curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
@@ -209,18 +231,18 @@ static void info_cmd(const char* chan, const char* nick, const char* arg, int cm
 				curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &location);
 
 				if(location){
-					ctx->send_msg(chan, "%s: %s", nick, location);
+					info_reply(job, "%s: %s", nick, location);
 				} else {
-					ctx->send_msg(chan, "%s: %s", nick, redir->u.string);
+					info_reply(job, "%s: %s", nick, redir->u.string);
 				}
 			} else {
 				const char* link = info_top_result(results);
 				if(!link)	link = abs_url->u.string;
 
 				if(link){
-					ctx->send_msg(chan, "%s: %s", nick, link);
+					info_reply(job, "%s: %s", nick, link);
 				} else {
-					ctx->send_msg(chan, "Sorry, I don't have any information about '%s.'", arg);
+					info_reply(job, "Sorry, I don't have any information about '%s.'", arg);
 				}
 			}
 
@@ -231,7 +253,7 @@ static void info_cmd(const char* chan, const char* nick, const char* arg, int cm
 			const char* link = info_top_result(results);
 			if(!link)   link = abs_url->u.string;
 
-			ctx->send_msg(chan, "%s. %s", desc, link);
+			info_reply(job, "%s. %s", desc, link);
 			free(desc);
 		} break;
 	}
@@ -242,7 +264,44 @@ exit:
 
 }
 
+static void info_done(void* arg){
+	struct info_job* job = arg;
+
+	sb_each(r, job->replies){
+		ctx->send_msg(job->chan, "%s", *r);
+		free(*r);
+	}
+
+	sb_free(job->replies);
+	free(job->chan);
+	free(job->nick);
+	free(job->arg);
+	free(job);
+}
+
+static void info_cmd(const char* chan, const char* nick, const char* arg, int cmd){
+	if(cmd != INFO_GET || !inso_is_wlist(ctx, nick)) return;
+
+	if(!*arg++){
+		ctx->send_msg(chan, "What would you like info about, %s?", nick);
+		return;
+	}
+
+	if(strcasecmp(arg, "insobot") == 0){
+		ctx->send_msg(chan, "I'm an IRC bot written in C99 by insofaras: https://github.com/baines/insobot");
+		return;
+	}
+
+	struct info_job* job = calloc(1, sizeof(*job));
+	job->chan = strdup(chan);
+	job->nick = strdup(nick);
+	job->arg  = strdup(arg);
+
+	ctx->run_async(&info_work, &info_done, job);
+}
+
 static bool info_init(const IRCCoreCtx* _ctx){
 	ctx = _ctx;
+	curl_share = (void*)ctx->get_info(IRC_INFO_CURL_SHARE);
 	return true;
 }
@@ -5,17 +5,20 @@
 #include <time.h>
 #include "module.h"
 #include "stb_sb.h"
+#include "inso_ht.h"
 #include "inso_utils.h"
 
 static void karma_msg      (const char*, const char*, const char*);
 static void karma_cmd      (const char*, const char*, const char*, int);
 static void karma_nick     (const char*, const char*);
 static void karma_join     (const char*, const char*);
+static void karma_join_bulk(const char*, const char**, size_t);
 static bool karma_save     (FILE*);
 static bool karma_init     (const IRCCoreCtx*);
 static void karma_modified (void);
 static void karma_mod_msg  (const char*, const IRCModMsg*);
 static void karma_quit     (void);
+static void karma_journal  (uint32_t, const void*, size_t);
 
 enum { KARMA_SHOW, KARMA_TOP };
 
@@ -32,6 +35,8 @@ const IRCModuleCtx irc_mod_ctx = {
 	.on_save  = &karma_save,
 	.on_modified = &karma_modified,
 	.on_mod_msg  = &karma_mod_msg,
+	.on_journal  = &karma_journal,
+	.on_join_bulk = &karma_join_bulk,
 	.commands = DEFINE_CMDS (
 		[KARMA_SHOW] = CMD("karma"),
 		[KARMA_TOP]  = CMD("ktop")
@@ -53,6 +58,9 @@ typedef struct KEntry_ {
 
 static KEntry* klist;
 
+// journal record types
+enum { KARMA_REC_SET };
+
 static const int karma_cooldown = 0;
 
 static KEntry* karma_find(const char* name, bool adjust){
@@ -90,6 +98,24 @@ static KEntry* karma_add_name(const char* name){
 	return ret;
 }
 
+// journals an entry as a line in the same format as the data file.
+static void karma_record(KEntry* k){
+	char* line = NULL;
+
+	for(char** n = k->names; n < sb_end(k->names); ++n){
+		size_t len = strlen(*n);
+		memcpy(sb_add(line, len), *n, len);
+		sb_push(line, ':');
+	}
+
+	char score[32];
+	int len = snprintf(score, sizeof(score), " %d:%d", k->up, k->down);
+	memcpy(sb_add(line, len), score, len);
+
+	ctx->journal(KARMA_REC_SET, line, sb_count(line));
+	sb_free(line);
+}
+
 static bool karma_update(const char* chan, KEntry* actor, const char* target, bool upvote){
 	KEntry* k;
 
@@ -107,7 +133,9 @@ static bool karma_update(const char* chan, KEntry* actor, const char* target, bo
 
 		if(!upvote){
 			actor->down++;
+			karma_record(actor);
 		}
+		karma_record(k);
 
 		// for miblo... what were you smoking? :P
 
@@ -237,7 +265,6 @@ static void karma_check(const char* chan, KEntry* actor, const char* msg){
 
 	if(changes){
 		actor->last_give = time(0);
-		ctx->save_me();
 	}
 
 }
@@ -329,6 +356,67 @@ static void karma_join(const char* chan, const char* name){
 	karma_add_name(name);
 }
 
+// a set of every name in klist, only kept for the duration of karma_join_bulk
+typedef struct {
+	uint32_t hash;
+	uint32_t entry; // index into klist
+	uint32_t name;  // index into that entry's names
+} KNameKey;
+
+static size_t kname_hash(const void* arg){
+	return ((const KNameKey*)arg)->hash;
+}
+
+static bool kname_cmp(const void* elem, void* param){
+	const KNameKey* key = elem;
+	return strcasecmp(klist[key->entry].names[key->name], param) == 0;
+}
+
+// fills set with every name in klist, sized for extra more to be added.
+static void karma_names_init(inso_ht* set, size_t extra){
+	size_t total = extra;
+	sb_each(k, klist){
+		total += sb_count(k->names);
+	}
+
+	inso_ht_init(set, total * 2 + 16, sizeof(KNameKey), &kname_hash);
+
+	for(size_t i = 0; i < sb_count(klist); ++i){
+		for(size_t j = 0; j < sb_count(klist[i].names); ++j){
+			inso_ht_put(set, &(KNameKey){ inso_hash_nocase(klist[i].names[j], 0), i, j });
+		}
+	}
+}
+
+// same as karma_add_name for each name, but without a linear search & sort for every one of them.
+static void karma_join_bulk(const char* chan, const char** names, size_t count){
+	inso_ht set = {};
+	karma_names_init(&set, count);
+
+	bool added = false;
+
+	for(size_t i = 0; i < count; ++i){
+		uint32_t hash = inso_hash_nocase(names[i], 0);
+		KNameKey* key = inso_ht_get(&set, hash, &kname_cmp, (void*)names[i]);
+
+		if(key){
+			klist[key->entry].active_idx = key->name;
+		} else {
+			KEntry k = {};
+			sb_push(k.names, strdup(names[i]));
+			sb_push(klist, k);
+			inso_ht_put(&set, &(KNameKey){ hash, sb_count(klist) - 1, 0 });
+			added = true;
+		}
+	}
+
+	inso_ht_free(&set);
+
+	if(added){
+		qsort(klist, sb_count(klist), sizeof(*klist), &karma_sort);
+	}
+}
+
 static void karma_load(void){
 	char* names;
 	int up, down;
@@ -370,6 +458,72 @@ static bool karma_save(FILE* f){
 	return true;
 }
 
+// name lookups for karma_journal, built on the first record and freed once the core says replay is done.
+// klist is only appended to in between, so the indices stay valid, and it's sorted once at the end.
+static inso_ht journal_names; // of KNameKey
+
+static void karma_journal(uint32_t type, const void* data, size_t len){
+	if(type == IRC_JOURNAL_DONE){
+		if(journal_names.memory){
+			inso_ht_free(&journal_names);
+			qsort(klist, sb_count(klist), sizeof(*klist), &karma_sort);
+		}
+		return;
+	}
+
+	if(type != KARMA_REC_SET) return;
+
+	if(!journal_names.memory){
+		karma_names_init(&journal_names, 64);
+	}
+
+	char* line = strndup(data, len);
+	char* names;
+	int up, down;
+
+	if(sscanf(line, "%ms %d:%d", &names, &up, &down) == 3){
+		char** split = NULL;
+		char *state, *name;
+		KNameKey* key = NULL;
+
+		for(name = strtok_r(names, ":", &state); name; name = strtok_r(NULL, ":", &state)){
+			sb_push(split, name);
+			if(!key) key = inso_ht_get(&journal_names, inso_hash_nocase(name, 0), &kname_cmp, name);
+		}
+
+		if(!sb_count(split)){
+			goto out;
+		}
+
+		// an entry we already have keeps the name it's currently shown with.
+		size_t entry = key ? key->entry : sb_count(klist);
+		if(!key){
+			sb_push(klist, (KEntry){ .active_idx = -1 });
+		}
+
+		sb_each(n, split){
+			uint32_t hash = inso_hash_nocase(*n, 0);
+			if(!inso_ht_get(&journal_names, hash, &kname_cmp, *n)){
+				KEntry* k = klist + entry;
+				sb_push(k->names, strdup(*n));
+				inso_ht_put(&journal_names, &(KNameKey){ hash, entry, sb_count(k->names) - 1 });
+			}
+		}
+
+		KEntry* k = klist + entry;
+		k->up = up;
+		k->down = down;
+		if(k->active_idx == -1){
+			k->active_idx = sb_count(k->names) - 1;
+		}
+out:
+		sb_free(split);
+		free(names);
+	}
+
+	free(line);
+}
+
 static bool karma_init(const IRCCoreCtx* _ctx){
 	ctx = _ctx;
 	karma_load();
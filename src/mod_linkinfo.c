@@ -22,11 +22,23 @@ const IRCModuleCtx irc_mod_ctx = {
 	.flags    = IRC_MOD_DEFAULT,
 	.on_msg   = &linkinfo_msg,
 	.on_init  = &linkinfo_init,
-	.on_quit  = &linkinfo_quit
+	.on_quit  = &linkinfo_quit,
+	.prefilter = &(const IRCMsgPrefilter){ .has_url = true },
 };
 
 static const IRCCoreCtx* ctx;
 
+struct linkinfo_url {
+	char* url;
+	int   host_class;
+};
+
+struct linkinfo_job {
+	char* chan;
+	sb(struct linkinfo_url) urls; // the ones for sites we have handlers for, in message order
+	sb(char*) replies;
+};
+
 static regex_t yt_url_regex;
 static regex_t yt_title_regex;
 static regex_t yt_length_regex;
@@ -49,6 +61,8 @@ static regex_t github_url_regex;
 static regex_t twitch_vid_regex;
 static regex_t cinera_regex;
 
+static void* curl_share;
+
 static bool linkinfo_init(const IRCCoreCtx* _ctx){
 	ctx = _ctx;
 
@@ -156,6 +170,8 @@ static bool linkinfo_init(const IRCCoreCtx* _ctx){
 		fputs("mod_linkinfo: no twitter token, expanding tweets won't work.\n", stderr);
 	}
 
+	curl_share = (void*)ctx->get_info(IRC_INFO_CURL_SHARE);
+
 	yt_api_key = getenv("INSOBOT_YT_API_KEY");
 	if(!yt_api_key || !*yt_api_key){
 		fputs("mod_linkinfo: no youtube api key, no expanding of playlists.\n", stderr);
@@ -183,6 +199,30 @@ static void linkinfo_quit(void){
 	regfree(&cinera_regex);
 }
 
+// the do_*_info functions run on a worker thread, so they use this instead of ctx->send_msg.
+// the replies are sent afterwards by linkinfo_done on the main thread.
+static void linkinfo_reply(struct linkinfo_job* job, const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+static void linkinfo_reply(struct linkinfo_job* job, const char* fmt, ...){
+	char* reply;
+	va_list va;
+
+	va_start(va, fmt);
+	if(vasprintf(&reply, fmt, va) != -1){
+		sb_push(job->replies, reply);
+	}
+	va_end(va);
+}
+
+// these run on worker threads, so no signals. Also share the core's dns / tls session cache.
+static CURL* linkinfo_curl_init(const char* url, char** data){
+	CURL* curl = inso_curl_init(url, data);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	if(curl_share){
+		curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+	}
+	return curl;
+}
+
 typedef struct {
 	char *from, *to;
 	size_t from_len, to_len;
@@ -231,7 +271,7 @@ static void html_unescape(char* msg, size_t len){
 }
 
 #ifdef USE_LEGIT_YOUTUBE_API
-static void do_youtube_info(const char* chan, const char* msg, regmatch_t* matches){
+static void do_youtube_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 	regmatch_t* match = matches + 4;
 
 	if(!yt_api_key) return;
@@ -248,7 +288,7 @@ static void do_youtube_info(const char* chan, const char* msg, regmatch_t* match
 	);
 
 	char* data = NULL;
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 	free(url);
 
 	if(curl_easy_perform(curl) == 0){
@@ -270,7 +310,7 @@ static void do_youtube_info(const char* chan, const char* msg, regmatch_t* match
 		}
 
 		if(title && islive && strcmp(islive->u.string, "live") == 0){
-			ctx->send_msg(chan, "↑ YT Video: [%s] [LIVE]", title->u.string);
+			linkinfo_reply(job, "↑ YT Video: [%s] [LIVE]", title->u.string);
 		} else if(title && duration){
 			int h = 0, m = 0, s = 0;
 
@@ -291,9 +331,9 @@ static void do_youtube_info(const char* chan, const char* msg, regmatch_t* match
 				}
 
 				if(h){
-					ctx->send_msg(chan, "↑ YT Video: [%s] [%d:%02d:%02d]", title->u.string, h, m, s);
+					linkinfo_reply(job, "↑ YT Video: [%s] [%d:%02d:%02d]", title->u.string, h, m, s);
 				} else {
-					ctx->send_msg(chan, "↑ YT Video: [%s] [%02d:%02d]", title->u.string, m, s);
+					linkinfo_reply(job, "↑ YT Video: [%s] [%02d:%02d]", title->u.string, m, s);
 				}
 			}
 
@@ -305,7 +345,7 @@ static void do_youtube_info(const char* chan, const char* msg, regmatch_t* match
 	sb_free(data);
 }
 #else
-static void do_youtube_info(const char* chan, const char* msg, regmatch_t* matches){
+static void do_youtube_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 	regmatch_t* match = matches + 4;
 
 	if(match->rm_so == -1 || match->rm_eo == -1) return;
@@ -329,7 +369,7 @@ static void do_youtube_info(const char* chan, const char* msg, regmatch_t* match
 
 	fprintf(stderr, "linkinfo: Fetching [%s]\n", url);
 
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 	CURLcode result = curl_easy_perform(curl);
 	sb_push(data, 0);
 
@@ -373,13 +413,13 @@ static void do_youtube_info(const char* chan, const char* msg, regmatch_t* match
 			strcpy(length_str, "00:00");
 		}
 
-		ctx->send_msg(chan, "↑ YT Video: [%.*s] [%s]", outlen, str, length_str);
+		linkinfo_reply(job, "↑ YT Video: [%.*s] [%s]", outlen, str, length_str);
 
 		curl_free(str);
 	} else {
 		fprintf(stderr, "linkinfo: curl returned %d: %s\n", result, curl_easy_strerror(result));
 		fprintf(stderr, "data_len = %zu, so:%d eo:%d\n", strlen(data), title[1].rm_so, title[1].rm_eo);
-		ctx->send_msg(chan, "Error getting YT data. Blame insofaras.");
+		linkinfo_reply(job, "Error getting YT data. Blame insofaras.");
 	}
 
 	curl_easy_cleanup(curl);
@@ -388,7 +428,7 @@ static void do_youtube_info(const char* chan, const char* msg, regmatch_t* match
 }
 #endif
 
-void do_yt_playlist_info(const char* chan, const char* msg, regmatch_t* matches){
+void do_yt_playlist_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 	regmatch_t* id = matches + 1;
 	char url[1024];
 
@@ -410,7 +450,7 @@ void do_yt_playlist_info(const char* chan, const char* msg, regmatch_t* matches)
 	static const char* chant_path[] = { "snippet", "channelTitle", NULL };
 
 	char* data = NULL;
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 	if(curl_easy_perform(curl) == 0){
 		sb_push(data, 0);
 
@@ -423,7 +463,7 @@ void do_yt_playlist_info(const char* chan, const char* msg, regmatch_t* matches)
 			yajl_val chant = yajl_tree_get(obj, chant_path, yajl_t_string);
 
 			if(title && chant){
-				ctx->send_msg(chan, "↑ YT Playlist: [%s] by %s.", title->u.string, chant->u.string);
+				linkinfo_reply(job, "↑ YT Playlist: [%s] by %s.", title->u.string, chant->u.string);
 			}
 		}
 		yajl_tree_free(root);
@@ -434,7 +474,7 @@ void do_yt_playlist_info(const char* chan, const char* msg, regmatch_t* matches)
 
 char* do_download(const char* url){
 	char* data = NULL;
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 	CURLcode curl_ret = curl_easy_perform(curl);
 	sb_push(data, 0);
 	curl_easy_cleanup(curl);
@@ -447,7 +487,7 @@ char* do_download(const char* url){
 	}
 }
 
-void do_generic_info(const char* chan, const char* url, const char* tag){
+void do_generic_info(struct linkinfo_job* job, const char* url, const char* tag){
 	char* html;
 	regmatch_t title[2];
 	int title_len = 0;
@@ -460,13 +500,13 @@ void do_generic_info(const char* chan, const char* url, const char* tag){
 	){
 		char* title_str = strndupa(html + title[1].rm_so, title_len);
 		html_unescape(title_str, title_len);
-		ctx->send_msg(chan, "↑ %s: [%s]", tag, title_str);
+		linkinfo_reply(job, "↑ %s: [%s]", tag, title_str);
 	}
 
 	sb_free(html);
 }
 
-void do_ograph_info(const char* chan, const char* url, const char* tag){
+void do_ograph_info(struct linkinfo_job* job, const char* url, const char* tag){
 	char* html;
 	regmatch_t desc[2];
 
@@ -481,7 +521,7 @@ void do_ograph_info(const char* chan, const char* url, const char* tag){
 			len = p - desc_str;
 		}
 		html_unescape(desc_str, len);
-		ctx->send_msg(chan, "↑ %s: [%s]", tag, desc_str);
+		linkinfo_reply(job, "↑ %s: [%s]", tag, desc_str);
 	}
 
 	sb_free(html);
@@ -548,7 +588,7 @@ static int twitter_parse_entities(Replacement** out, yajl_val entity, bool is_me
 	return size;
 }
 
-static void do_twitter_info(const char* chan, const char* msg, regmatch_t* matches){
+static void do_twitter_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 
 	if(!twitter_token){
 		fputs("Can't fetch tweet, no twitter_token\n", stderr);
@@ -563,7 +603,7 @@ static void do_twitter_info(const char* chan, const char* msg, regmatch_t* match
 	asprintf_check(&auth_token, "Authorization: Bearer %s", twitter_token);
 	asprintf_check(&url, "https://api.twitter.com/1.1/statuses/show/%s.json?tweet_mode=extended", tweet_id);
 
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 
 	struct curl_slist* headers = curl_slist_append(NULL, auth_token);
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -641,7 +681,7 @@ static void do_twitter_info(const char* chan, const char* msg, regmatch_t* match
 	html_unescape(fixed_text, strlen(fixed_text));
 	sb_free(url_replacements);
 
-	ctx->send_msg(chan, "↑ Tweet by %s: [%s] [%s]", user->u.string, fixed_text, time_buf);
+	linkinfo_reply(job, "↑ Tweet by %s: [%s] [%s]", user->u.string, fixed_text, time_buf);
 
 out:
 	if(root){
@@ -651,7 +691,7 @@ out:
 	sb_free(data);
 }
 
-static void do_steam_info(const char* chan, const char* msg, regmatch_t* matches){
+static void do_steam_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 	const char* appid = strndupa(msg + matches[1].rm_so, matches[1].rm_eo - matches[1].rm_so);
 
 	char* url;
@@ -660,7 +700,7 @@ static void do_steam_info(const char* chan, const char* msg, regmatch_t* matches
 	char* data = NULL;
 	yajl_val root = NULL;
 
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 	CURLcode ret = curl_easy_perform(curl);
 	curl_easy_cleanup(curl);
 
@@ -714,10 +754,10 @@ static void do_steam_info(const char* chan, const char* msg, regmatch_t* matches
 
 	if(price){
 		int price_hi = price->u.number.i / 100, price_lo = price->u.number.i % 100;
-		ctx->send_msg(chan, "↑ Steam: [%s] [%s] [$%d.%02d]", title->u.string, plat_str, price_hi, price_lo);
+		linkinfo_reply(job, "↑ Steam: [%s] [%s] [$%d.%02d]", title->u.string, plat_str, price_hi, price_lo);
 	} else {
 		const char* status = YAJL_IS_TRUE(isfree) ? "[Free]" : YAJL_IS_TRUE(csoon) ? "[Coming Soon]" : "";
-		ctx->send_msg(chan, "↑ Steam: [%s] [%s] %s", title->u.string, plat_str, status);
+		linkinfo_reply(job, "↑ Steam: [%s] [%s] %s", title->u.string, plat_str, status);
 	}
 
 out:
@@ -725,7 +765,7 @@ out:
 	yajl_tree_free(root);
 }
 
-static void do_vimeo_info(const char* chan, const char* msg, regmatch_t* matches){
+static void do_vimeo_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 
 	char* data = NULL;
 	yajl_val root = NULL;
@@ -734,7 +774,7 @@ static void do_vimeo_info(const char* chan, const char* msg, regmatch_t* matches
 	char* url;
 	asprintf_check(&url, "https://vimeo.com/api/oembed.json?url=https%%3A%%2F%%2Fvimeo.com%%2F%s", id);
 
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 	int ret = curl_easy_perform(curl);
 	curl_easy_cleanup(curl);
 	free(url);
@@ -743,14 +783,14 @@ static void do_vimeo_info(const char* chan, const char* msg, regmatch_t* matches
 
 	if(ret != 0){
 		fprintf(stderr, "mod_linkinfo: vimeo curl err %s\n", curl_easy_strerror(ret));
-		ctx->send_msg(chan, "Error getting Vimeo data. Blame insofaras.");
+		linkinfo_reply(job, "Error getting Vimeo data. Blame insofaras.");
 		goto out;
 	}
 
 	root = yajl_tree_parse(data, NULL, 0);
 	if(!root){
 		fprintf(stderr, "mod_linkinfo: vimeo err getting root json\n");
-		ctx->send_msg(chan, "Error getting Vimeo data. Blame insofaras.");
+		linkinfo_reply(job, "Error getting Vimeo data. Blame insofaras.");
 		goto out;
 	}
 
@@ -762,7 +802,7 @@ static void do_vimeo_info(const char* chan, const char* msg, regmatch_t* matches
 
 	if(!title || !duration){
 		fprintf(stderr, "mod_linkinfo: vimeo err title/duration null\n");
-		ctx->send_msg(chan, "Error getting Vimeo data. Blame insofaras.");
+		linkinfo_reply(job, "Error getting Vimeo data. Blame insofaras.");
 		goto out;
 	}
 
@@ -781,21 +821,21 @@ static void do_vimeo_info(const char* chan, const char* msg, regmatch_t* matches
 	snprintf_chain(&ls_ptr, &ls_sz, "%02d:", secs / SEC_IN_MIN);
 	snprintf_chain(&ls_ptr, &ls_sz, "%02d", secs % SEC_IN_MIN);
 
-	ctx->send_msg(chan, "↑ Vimeo: [%s] [%s]", title->u.string, length_str);
+	linkinfo_reply(job, "↑ Vimeo: [%s] [%s]", title->u.string, length_str);
 
 out:
 	yajl_tree_free(root);
 	sb_free(data);
 }
 
-static void do_xkcd_info(const char* chan, const char* msg, regmatch_t* matches){
+static void do_xkcd_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 
 	const char* id = strndupa(msg + matches[2].rm_so, matches[2].rm_eo - matches[2].rm_so);
 	char* data = NULL;
 	char* url;
 	asprintf_check(&url, "https://xkcd.com/%s/info.0.json", id);
 
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 
 	CURLcode err;
 	if((err = curl_easy_perform(curl)) == CURLE_OK){
@@ -814,7 +854,7 @@ static void do_xkcd_info(const char* chan, const char* msg, regmatch_t* matches)
 			fprintf(stderr, "mod_linkinfo; xkcd expand failed\n");
 		} else {
 			const char* suffix = strlen(alt->u.string) > 200 ? "..." : "";
-			ctx->send_msg(chan, "↑ xkcd %s: \"%s\", [%s] [Alt: %.200s%s]", id, title->u.string, img->u.string, alt->u.string, suffix);
+			linkinfo_reply(job, "↑ xkcd %s: \"%s\", [%s] [Alt: %.200s%s]", id, title->u.string, img->u.string, alt->u.string, suffix);
 		}
 
 		yajl_tree_free(root);
@@ -827,7 +867,7 @@ static void do_xkcd_info(const char* chan, const char* msg, regmatch_t* matches)
 	free(url);
 }
 
-static void do_github_info(const char* chan, const char* msg, regmatch_t* matches){
+static void do_github_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 
 	char* url;
 	asprintf_check(
@@ -840,7 +880,7 @@ static void do_github_info(const char* chan, const char* msg, regmatch_t* matche
 	);
 
 	char* data = NULL;
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 	struct curl_slist* headers = curl_slist_append(NULL, "Accept: application/vnd.github.drax-preview+json");
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
@@ -853,9 +893,9 @@ static void do_github_info(const char* chan, const char* msg, regmatch_t* matche
 
 		if(desc && name && lang){
 			if(lsnc){
-				ctx->send_msg(chan, "↑ GitHub: %s [%s] [%s] [%s]", name->u.string, desc->u.string, lang->u.string, lsnc->u.string);
+				linkinfo_reply(job, "↑ GitHub: %s [%s] [%s] [%s]", name->u.string, desc->u.string, lang->u.string, lsnc->u.string);
 			} else {
-				ctx->send_msg(chan, "↑ GitHub: %s [%s] [%s]", name->u.string, desc->u.string, lang->u.string);
+				linkinfo_reply(job, "↑ GitHub: %s [%s] [%s]", name->u.string, desc->u.string, lang->u.string);
 			}
 		}
 
@@ -868,7 +908,7 @@ static void do_github_info(const char* chan, const char* msg, regmatch_t* matche
 	free(url);
 }
 
-static void do_twitch_vid_info(const char* chan, const char* msg, regmatch_t* matches){
+static void do_twitch_vid_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 	if(matches[2].rm_so == -1 || matches[2].rm_eo == -1) return;
 
 	char* url;
@@ -880,7 +920,7 @@ static void do_twitch_vid_info(const char* chan, const char* msg, regmatch_t* ma
 	);
 
 	char* data = NULL;
-	CURL* curl = inso_curl_init(url, &data);
+	CURL* curl = linkinfo_curl_init(url, &data);
 	struct curl_slist* headers = NULL;
 
 	const char* client_id = getenv("INSOBOT_TWITCH_CLIENT_ID");
@@ -906,7 +946,7 @@ static void do_twitch_vid_info(const char* chan, const char* msg, regmatch_t* ma
 				yajl_val duration = YAJL_GET(obj, yajl_t_string, ("duration"));
 
 				if(title && name){
-					ctx->send_msg(chan, "↑ Twitch VoD: [%s] [%s] by %s", title->u.string, duration->u.string, name->u.string);
+					linkinfo_reply(job, "↑ Twitch VoD: [%s] [%s] by %s", title->u.string, duration->u.string, name->u.string);
 				}
 			}
 		}
@@ -919,7 +959,7 @@ static void do_twitch_vid_info(const char* chan, const char* msg, regmatch_t* ma
 	curl_easy_cleanup(curl);
 }
 
-static void do_cinera_info(const char* chan, const char* msg, regmatch_t* matches) {
+static void do_cinera_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches) {
 
 	char* url = strndupa(msg + matches[0].rm_so, matches[0].rm_eo - matches[0].rm_so);
 	char* _auto_sb_free_ html = do_download(url);
@@ -975,71 +1015,125 @@ static void do_cinera_info(const char* chan, const char* msg, regmatch_t* matche
 	printf("type = %s\n", type);
 
 	if(is_entry && lineage) {
-		ctx->send_msg(chan, "↑ Indexed Video: [\0036%s\017 from \00312%s\017]", title, lineage);
+		linkinfo_reply(job, "↑ Indexed Video: [\0036%s\017 from \00312%s\017]", title, lineage);
 	} else if(is_entry && project) {
-		ctx->send_msg(chan, "↑ Indexed Video: [\0036%s\017 from \00312%s\017]", title, project);
+		linkinfo_reply(job, "↑ Indexed Video: [\0036%s\017 from \00312%s\017]", title, project);
 	} else if(lineage) {
-		ctx->send_msg(chan, "↑ Indexed %s: [\0036%s\017]", thing, lineage);
+		linkinfo_reply(job, "↑ Indexed %s: [\0036%s\017]", thing, lineage);
 	} else {
-		ctx->send_msg(chan, "↑ Indexed %s: [\0036%s\017]", thing, title);
+		linkinfo_reply(job, "↑ Indexed %s: [\0036%s\017]", thing, title);
 	}
 }
 
-static void linkinfo_msg(const char* chan, const char* name, const char* msg){
+static void do_hmn_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
+	char url[512];
+	if(msg[matches->rm_eo] != '-'){
+		snprintf(url, sizeof(url), "https://%.*s", matches->rm_eo - matches->rm_so, msg + matches->rm_so);
+		do_generic_info(job, url, "HMN");
+	}
+}
 
-	regmatch_t matches[5] = {};
-	regmatch_t* m = matches;
+static void do_hmn_og_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
 	char url[512];
+	snprintf(url, sizeof(url), "https://%.*s", matches->rm_eo - matches->rm_so, msg + matches->rm_so);
+	do_ograph_info(job, url, "HMN");
+}
 
-	if(regexec(&yt_url_regex, msg, 5, matches, 0) == 0){
-		do_youtube_info(chan, msg, matches);
-	}
+static void do_msdn_info(struct linkinfo_job* job, const char* msg, regmatch_t* matches){
+	char url[512];
+	snprintf(url, sizeof(url), "https://%.*s", matches->rm_eo - matches->rm_so, msg + matches->rm_so);
+	do_generic_info(job, url, "MSDN");
+}
+
+// the core works out which site a url is for, then only these entries for that site are tried, in order.
+// the regexes pull the ids etc. out of the url, the first one that matches is used.
+static const struct linkinfo_handler {
+	int      host_class;
+	regex_t* regex;
+	size_t   nmatch;
+	void   (*fn)(struct linkinfo_job*, const char*, regmatch_t*);
+} handlers[] = {
+	{ IRC_HOST_YOUTUBE, &yt_url_regex,      5, &do_youtube_info     },
+	{ IRC_HOST_YOUTUBE, &yt_playlist_regex, 2, &do_yt_playlist_info },
+	{ IRC_HOST_HMN,     &hmn_url_regex,     1, &do_hmn_info         },
+	{ IRC_HOST_HMN,     &hmn_og_regex,      1, &do_hmn_og_info      },
+	{ IRC_HOST_MSDN,    &msdn_url_regex,    1, &do_msdn_info        },
+	{ IRC_HOST_TWITTER, &twitter_url_regex, 2, &do_twitter_info     },
+	{ IRC_HOST_STEAM,   &steam_url_regex,   2, &do_steam_info       },
+	{ IRC_HOST_VIMEO,   &vimeo_url_regex,   2, &do_vimeo_info       },
+	{ IRC_HOST_XKCD,    &xkcd_url_regex,    3, &do_xkcd_info        },
+	{ IRC_HOST_GITHUB,  &github_url_regex,  5, &do_github_info      },
+	{ IRC_HOST_TWITCH,  &twitch_vid_regex,  3, &do_twitch_vid_info  },
+	{ IRC_HOST_CINERA,  &cinera_regex,      2, &do_cinera_info      },
+};
 
-	else if(regexec(&yt_playlist_regex, msg, 2, matches, 0) == 0){
-		do_yt_playlist_info(chan, msg, matches);
+static bool linkinfo_handled(int host_class){
+	for(size_t i = 0; i < ARRAY_SIZE(handlers); ++i){
+		if(handlers[i].host_class == host_class) return true;
 	}
+	return false;
+}
+
+// the first url that one of its site's regexes matches is looked up, like the whole message cascade used to.
+static void linkinfo_work(void* arg){
+	struct linkinfo_job* job = arg;
 
-	else if(regexec(&hmn_url_regex, msg, 1, matches, 0) == 0){
-		if(msg[m->rm_eo] != '-'){
-			snprintf(url, sizeof(url), "https://%.*s", m->rm_eo - m->rm_so, msg + m->rm_so);
-			do_generic_info(chan, url, "HMN");
+	regmatch_t matches[5] = {};
+
+	sb_each(u, job->urls){
+		for(size_t i = 0; i < ARRAY_SIZE(handlers); ++i){
+			const struct linkinfo_handler* h = handlers + i;
+			if(h->host_class != u->host_class) continue;
+
+			if(regexec(h->regex, u->url, h->nmatch, matches, 0) == 0){
+				h->fn(job, u->url, matches);
+				return;
+			}
 		}
-	} else if(regexec(&hmn_og_regex, msg, 1, matches, 0) == 0){
-		snprintf(url, sizeof(url), "https://%.*s", m->rm_eo - m->rm_so, msg + m->rm_so);
-		do_ograph_info(chan, url, "HMN");
 	}
+}
 
-	else if(regexec(&msdn_url_regex, msg, 1, matches, 0) == 0){
-		snprintf(url, sizeof(url), "https://%.*s", m->rm_eo - m->rm_so, msg + m->rm_so);
-		do_generic_info(chan, url, "MSDN");
-	}
+static void linkinfo_done(void* arg){
+	struct linkinfo_job* job = arg;
 
-	else if(regexec(&twitter_url_regex, msg, 2, matches, 0) == 0){
-		do_twitter_info(chan, msg, matches);
+	sb_each(r, job->replies){
+		ctx->send_msg(job->chan, "%s", *r);
+		free(*r);
 	}
 
-	else if(regexec(&steam_url_regex, msg, 2, matches, 0) == 0){
-		do_steam_info(chan, msg, matches);
+	sb_each(u, job->urls){
+		free(u->url);
 	}
 
-	else if(regexec(&vimeo_url_regex, msg, 2, matches, 0) == 0){
-		do_vimeo_info(chan, msg, matches);
-	}
+	sb_free(job->urls);
+	sb_free(job->replies);
+	free(job->chan);
+	free(job);
+}
 
-	else if(regexec(&xkcd_url_regex, msg, 3, matches, 0) == 0){
-		do_xkcd_info(chan, msg, matches);
-	}
+static void linkinfo_msg(const char* chan, const char* name, const char* msg){
+	const IRCMsgView* view = ctx->get_msg_view();
 
-	else if(regexec(&github_url_regex, msg, 5, matches, 0) == 0){
-		do_github_info(chan, msg, matches);
-	}
+	struct linkinfo_job* job = NULL;
 
-	else if(regexec(&twitch_vid_regex, msg, 3, matches, 0) == 0){
-		do_twitch_vid_info(chan, msg, matches);
-	}
+	// only urls for sites we know about, don't bother a worker thread if there aren't any.
+	for(size_t i = 0; i < view->num_urls; ++i){
+		const IRCMsgUrl* url = view->urls + i;
+		if(!linkinfo_handled(url->host_class)) continue;
+
+		if(!job){
+			job = calloc(1, sizeof(*job));
+			job->chan = strdup(chan);
+		}
 
-	else if(regexec(&cinera_regex, msg, 2, matches, 0) == 0) {
-		do_cinera_info(chan, msg, matches);
+		struct linkinfo_url u = {
+			.url        = strndup(view->plain + url->span.off, url->span.len),
+			.host_class = url->host_class,
+		};
+		sb_push(job->urls, u);
 	}
 
+	if(job){
+		ctx->run_async(&linkinfo_work, &linkinfo_done, job);
+	}
 }
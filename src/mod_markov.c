@@ -4,7 +4,6 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <assert.h>
-#include <regex.h>
 #include <zlib.h>
 #include "module.h"
 #include "inso_utils.h"
@@ -14,26 +13,32 @@
 static bool markov_init (const IRCCoreCtx*);
 static void markov_quit (void);
 static void markov_join (const char*, const char*);
+static void markov_join_bulk(const char*, const char**, size_t);
 static void markov_cmd  (const char*, const char*, const char*, int);
 static void markov_msg  (const char*, const char*, const char*);
 static void markov_mod_msg(const char* sender, const IRCModMsg* msg);
 static bool markov_save (FILE*);
 static void markov_stdin(const char* msg);
+static void* markov_handoff(uint32_t* version);
+static bool  markov_adopt  (const IRCCoreCtx*, void*, uint32_t);
 
 enum { MARKOV_SAY, MARKOV_ASK, MARKOV_INTERVAL, MARKOV_LENGTH, MARKOV_STATUS, MARKOV_SAVE };
 
 const IRCModuleCtx irc_mod_ctx = {
 	.name     = "markov",
 	.desc     = "Says incomprehensible stuff",
-	.flags    = IRC_MOD_DEFAULT,
+	.flags    = IRC_MOD_DEFAULT | IRC_MOD_FORK_SAVE,
 	.on_init  = &markov_init,
 	.on_quit  = &markov_quit,
 	.on_cmd   = &markov_cmd,
 	.on_msg   = &markov_msg,
 	.on_join  = &markov_join,
+	.on_join_bulk = &markov_join_bulk,
 	.on_save  = &markov_save,
 	.on_stdin = &markov_stdin,
 	.on_mod_msg = &markov_mod_msg,
+	.on_handoff = &markov_handoff,
+	.on_adopt   = &markov_adopt,
 	.commands = DEFINE_CMDS (
 		[MARKOV_SAY]      = CMD("say"),
 		[MARKOV_ASK]      = CMD("ask"),
@@ -110,8 +115,6 @@ static MarkovLinkVal* chain_vals;
 static char rng_state_mem[256];
 static struct random_data rng_state;
 
-static regex_t url_regex;
-
 static size_t max_chain_len = 16;
 static size_t msg_chance = 150;
 
@@ -685,9 +688,7 @@ fail:
 
 // IRC Callbacks {{{
 
-static bool markov_init(const IRCCoreCtx* _ctx){
-	ctx = _ctx;
-
+static void markov_seed(void){
 	unsigned int seed = rand();
 
 	int fd = open("/dev/urandom", O_RDONLY);
@@ -700,11 +701,10 @@ static bool markov_init(const IRCCoreCtx* _ctx){
 
 	initstate_r(seed, rng_state_mem, sizeof(rng_state_mem), &rng_state);
 	setstate_r(rng_state_mem, &rng_state);
+}
 
-	sbmm_push(word_mem, 0);
-
-	regcomp(&url_regex, "(www\\.|https?:\\/\\/|\\.com|\\.[a-zA-Z]\\/)", REG_ICASE | REG_EXTENDED | REG_NOSUB);
-
+// (re)sets the function pointers in the hash tables, they point into this .so
+static void markov_ht_setup(void){
 	chain_keys_ht.hash_fn   = &chain_key_hash;
 	chain_keys_ht.elem_size = sizeof(MarkovLinkKey);
 	chain_keys_ht.alloc_fn  = &ht_alloc;
@@ -714,6 +714,16 @@ static bool markov_init(const IRCCoreCtx* _ctx){
 	word_ht.elem_size = sizeof(WordInfo);
 	word_ht.alloc_fn  = &ht_alloc;
 	word_ht.free_fn   = &ht_free;
+}
+
+static bool markov_init(const IRCCoreCtx* _ctx){
+	ctx = _ctx;
+
+	markov_seed();
+
+	sbmm_push(word_mem, 0);
+
+	markov_ht_setup();
 
 	if(!markov_load()){
 		if(chain_keys_ht.memory) ht_free(chain_keys_ht.memory, chain_keys_ht.capacity);
@@ -754,8 +764,83 @@ static void markov_quit(void){
 
 	inso_ht_free(&chain_keys_ht);
 	inso_ht_free(&word_ht);
+}
+
+// Everything that needs to survive a reload of the .so without going through markov_save / markov_load.
+// Bump MARKOV_HANDOFF_VERSION if this or any of the types / hash functions it depends on change.
 
-	regfree(&url_regex);
+#define MARKOV_HANDOFF_VERSION 2
+
+typedef struct {
+	char*          word_mem;
+	MarkovLinkVal* chain_vals;
+	inso_ht        chain_keys_ht;
+	inso_ht        word_ht;
+	char**         markov_nicks;
+	size_t         max_chain_len;
+	size_t         msg_chance;
+	word_idx_t     start_sym_idx;
+	word_idx_t     end_sym_idx;
+	uint32_t       recent_hashes[128];
+	size_t         recent_hash_idx;
+	int            dict_fd;
+	size_t         dict_fd_size;
+	uint64_t       grand_total;
+} MarkovHandoff;
+
+// static, so it isn't leaked when the new instance doesn't adopt it. It's only read in on_adopt, before we're unloaded.
+static MarkovHandoff handoff;
+
+static void* markov_handoff(uint32_t* version){
+	MarkovHandoff* h = &handoff;
+
+	*h = (MarkovHandoff){
+		.word_mem        = word_mem,
+		.chain_vals      = chain_vals,
+		.chain_keys_ht   = chain_keys_ht,
+		.word_ht         = word_ht,
+		.markov_nicks    = markov_nicks,
+		.max_chain_len   = max_chain_len,
+		.msg_chance      = msg_chance,
+		.start_sym_idx   = start_sym_idx,
+		.end_sym_idx     = end_sym_idx,
+		.recent_hash_idx = recent_hash_idx,
+		.dict_fd         = dict_fd,
+		.dict_fd_size    = dict_fd_size,
+		.grand_total     = grand_total,
+	};
+	memcpy(h->recent_hashes, recent_hashes, sizeof(recent_hashes));
+
+	*version = MARKOV_HANDOFF_VERSION;
+	return h;
+}
+
+static bool markov_adopt(const IRCCoreCtx* _ctx, void* state, uint32_t version){
+	if(version != MARKOV_HANDOFF_VERSION) return false;
+
+	MarkovHandoff* h = state;
+	ctx = _ctx;
+
+	markov_seed();
+
+	word_mem        = h->word_mem;
+	chain_vals      = h->chain_vals;
+	chain_keys_ht   = h->chain_keys_ht;
+	word_ht         = h->word_ht;
+	markov_nicks    = h->markov_nicks;
+	max_chain_len   = h->max_chain_len;
+	msg_chance      = h->msg_chance;
+	start_sym_idx   = h->start_sym_idx;
+	end_sym_idx     = h->end_sym_idx;
+	recent_hash_idx = h->recent_hash_idx;
+	dict_fd         = h->dict_fd;
+	dict_fd_size    = h->dict_fd_size;
+	grand_total     = h->grand_total;
+	memcpy(recent_hashes, h->recent_hashes, sizeof(recent_hashes));
+
+	markov_ht_setup();
+
+	return true;
 }
 
 static void markov_cmd(const char* chan, const char* name, const char* arg, int cmd){
@@ -836,12 +921,20 @@ static void markov_cmd(const char* chan, const char* name, const char* arg, int
 				break;
 
 			ctx->save_me();
-			ctx->send_msg(chan, "%s: save complete.", name);
+			ctx->send_msg(chan, "%s: saving in the background.", name);
 		} break;
 	}
 
 }
 
+// the view's urls include any dotted word with a 2+ letter tld, but lines with node.js or file.txt in them should
+// still be learned. only skip ones with a scheme, www., or a host the core knows is a site.
+static bool markov_is_link(const IRCMsgView* view, const IRCMsgUrl* url){
+	return url->host.off > url->span.off
+	    || url->host_class != IRC_HOST_OTHER
+	    || (url->host.len > 4 && memcmp(view->lower + url->host.off, "www.", 4) == 0);
+}
+
 static void markov_msg(const char* chan, const char* name, const char* _msg){
 
 	markov_join(chan, name);
@@ -851,9 +944,13 @@ static void markov_msg(const char* chan, const char* name, const char* _msg){
 		return;
 	}
 
-	if(regexec(&url_regex, _msg, 0, NULL, 0) == 0){
-		puts("skipping url.");
-		return;
+	const IRCMsgView* view = ctx->get_msg_view();
+
+	for(size_t i = 0; i < view->num_urls; ++i){
+		if(markov_is_link(view, view->urls + i)){
+			puts("skipping url.");
+			return;
+		}
 	}
 
 	for(const char** n = ignores; *n; ++n){
@@ -862,15 +959,9 @@ static void markov_msg(const char* chan, const char* name, const char* _msg){
 		}
 	}
 
-	size_t msg_len = strlen(_msg);
+	// the core has already stripped colors & lowercased it.
 	char* msg = NULL;
-	memcpy(sb_add(msg, msg_len + 1), _msg, msg_len + 1);
-
-	ctx->strip_colors(msg);
-
-	for(char* c = msg; c < sb_end(msg); ++c){
-		*c = tolower(*c);
-	}
+	memcpy(sb_add(msg, view->plain_len + 1), view->lower, view->plain_len + 1);
 
 	// check for mentions, and reply
 	{
@@ -1040,6 +1131,43 @@ static void markov_join(const char* chan, const char* name){
 	sb_push(markov_nicks, strdup(name));
 }
 
+// a set of markov_nicks, only kept for the duration of markov_join_bulk
+typedef struct {
+	uint32_t hash;
+	uint32_t idx;
+} MarkovNickKey;
+
+static size_t nick_key_hash(const void* arg){
+	return ((const MarkovNickKey*)arg)->hash;
+}
+
+static bool nick_key_cmp(const void* elem, void* param){
+	return strcasecmp(markov_nicks[((const MarkovNickKey*)elem)->idx], param) == 0;
+}
+
+static void markov_join_bulk(const char* chan, const char** names, size_t count){
+	const char* self = ctx->get_username();
+
+	inso_ht set = {};
+	inso_ht_init(&set, (sb_count(markov_nicks) + count) * 2, sizeof(MarkovNickKey), &nick_key_hash);
+
+	for(size_t i = 0; i < sb_count(markov_nicks); ++i){
+		inso_ht_put(&set, &(MarkovNickKey){ inso_hash_nocase(markov_nicks[i], 0), i });
+	}
+
+	for(size_t i = 0; i < count; ++i){
+		if(strcasecmp(names[i], self) == 0) continue;
+
+		uint32_t hash = inso_hash_nocase(names[i], 0);
+		if(inso_ht_get(&set, hash, &nick_key_cmp, (void*)names[i])) continue;
+
+		sb_push(markov_nicks, strdup(names[i]));
+		inso_ht_put(&set, &(MarkovNickKey){ hash, sb_count(markov_nicks) - 1 });
+	}
+
+	inso_ht_free(&set);
+}
+
 static void markov_mod_msg(const char* sender, const IRCModMsg* msg){
 	if(strcmp(msg->cmd, "markov_gen") == 0){
 		size_t prev_len = max_chain_len;
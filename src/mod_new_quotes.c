@@ -4,6 +4,7 @@
 #include "module.h"
 #include "stb_sb.h"
 #include "inso_utils.h"
+#include "inso_http.h"
 #include <curl/curl.h>
 
 static bool quotes_init     (const IRCCoreCtx*);
@@ -62,9 +63,22 @@ typedef struct Quote {
 
 static QChan*  channels;
 static Quote** chan_quotes;
-static CURL* curl;
 static const char* quotes_auth;
 
+// the quote_www_* requests don't block, this holds what's needed to finish the command when they're done.
+enum { QUOTES_IPC_ADD = -1 };
+
+typedef struct QuoteReq {
+	int      cmd;      // which command to reply to, or QUOTES_IPC_ADD
+	size_t   chan_idx; // index into channels, which only grows
+	uint32_t id;
+	char*    chan;     // where to reply
+	char*    name;
+	char*    text;
+	ssize_t  new_time;
+	bool     same_chan;
+} QuoteReq;
+
 static bool quote_parse(const char* line, Quote* out){
 	size_t epoch;
 
@@ -96,13 +110,15 @@ static bool quotes_init(const IRCCoreCtx* _ctx){
 
 	time_t now = time(0);
 	char* data = NULL;
-	curl = inso_curl_init(QUOTES_URL "/.raw", &data);
+	CURL* curl = inso_curl_init(QUOTES_URL "/.raw", &data);
 
 	long err;
 	if((err = inso_curl_perform(curl, &data)) != 200){
 		printf("mod_quotes: initial curl error: %ld, exiting\n", err);
 	}
 
+	curl_easy_cleanup(curl);
+
 	int idx = -1;
 	char* state;
 
@@ -195,47 +211,168 @@ static QChan* quotes_get_chan(const char* default_chan, const char** arg, bool*
 	return result;
 }
 
-static Quote* quote_www_get(QChan* chan, uint32_t id){
-
-	char url[512];
-	snprintf(url, sizeof(url), QUOTES_URL "/%s/%d.raw", chan->name+1, id);
+static QuoteReq* quote_req_new(int cmd, QChan* qc, uint32_t id, const char* chan, const char* name){
+	QuoteReq* r = calloc(1, sizeof(*r));
+	r->cmd      = cmd;
+	r->chan_idx = qc - channels;
+	r->id       = id;
+	r->chan     = strdup(chan);
+	r->name     = strdup(name);
+	return r;
+}
 
-	char* data = NULL;
-	inso_curl_reset(curl, url, &data);
-	curl_easy_setopt(curl, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
-	curl_easy_setopt(curl, CURLOPT_TIMEVALUE    , chan->last_mod);
+static void quote_req_free(QuoteReq* r){
+	free(r->chan);
+	free(r->name);
+	free(r->text);
+	free(r);
+}
 
-	Quote* quote = NULL;
+static Quote* quote_find(QChan* chan, uint32_t id){
 	sb_each(q, chan_quotes[chan - channels]){
 		if(q->id == id){
-			quote = q;
+			return q;
+		}
+	}
+	return NULL;
+}
+
+static char quote_date_buf[64];
+static const char* quote_strtime(Quote* q){
+	struct tm* date_tm = gmtime(&q->timestamp);
+	strftime(quote_date_buf, sizeof(quote_date_buf), "%F", date_tm);
+	return quote_date_buf;
+}
+
+static void quotes_notify(const char* chan, const char* name, Quote* q){
+
+	bool known_channel = false;
+	for(const char** c = ctx->get_channels(); *c; ++c){
+		if(strcasecmp(*c, chan) == 0){
+			known_channel = true;
 			break;
 		}
 	}
 
-	long ret = inso_curl_perform(curl, &data);
+	if(known_channel && q){
+		ctx->send_msg(chan, "%s added quote %d: \"%s\".", name, q->id, q->text);
+	}
+}
+
+static void quote_www_get_done(inso_http_req* req, long ret, char* data){
+	QuoteReq* r = req->arg;
+	if(ret == -CURLE_ABORTED_BY_CALLBACK) goto out;
+
+	QChan* chan = channels + r->chan_idx;
+	Quote* quote = quote_find(chan, r->id);
+
 	if(ret == 200){
 		chan->last_mod = time(0);
 
 		if(quote){
 			quote_parse(data, quote);
 		} else {
-			quote = quote_add(data, chan_quotes + (chan - channels));
+			quote = quote_add(data, chan_quotes + r->chan_idx);
 		}
 	} else if(ret == 404 && quote){ //delete quote if exists
 		free(quote->text);
-		Quote** base = chan_quotes + (chan - channels);
+		Quote** base = chan_quotes + r->chan_idx;
 		sb_erase(*base, quote - *base);
 		quote = NULL;
 	}
 
-	return quote;
+	switch(r->cmd){
+		case GET_QUOTE: {
+			if(quote){
+				ctx->send_msg(r->chan, "Quote %d: \"%s\" ―%s %s", r->id, quote->text, chan->name+1, quote_strtime(quote));
+			} else {
+				ctx->send_msg(r->chan, "%s: Can't find that quote.", r->name);
+			}
+		} break;
+
+		case FIX_QUOTE: {
+			if(quote){
+				ctx->send_msg(r->chan, "%s: Updated quote %d.", r->name, r->id);
+			} else {
+				ctx->send_msg(r->chan, "%s: Can't find that quote.", r->name);
+			}
+		} break;
+
+		case FIX_TIME: {
+			if(quote){
+				ctx->send_msg(r->chan, "%s: Updated quote %d's timestamp successfully.", r->name, r->id);
+			} else {
+				ctx->send_msg(r->chan, "%s: Can't find that quote.", r->name);
+			}
+		} break;
+
+		case QUOTES_IPC_ADD: {
+			quotes_notify(r->chan, r->name, quote);
+		} break;
+	}
+
+out:
+	quote_req_free(r);
+}
+
+static void quote_www_get(QuoteReq* r){
+	QChan* chan = channels + r->chan_idx;
+
+	char url[512];
+	snprintf(url, sizeof(url), QUOTES_URL "/%s/%d.raw", chan->name+1, r->id);
+
+	inso_http_req* req = inso_http_new(url, &quote_www_get_done, r);
+	curl_easy_setopt(req->curl, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
+	curl_easy_setopt(req->curl, CURLOPT_TIMEVALUE    , chan->last_mod);
+
+	inso_http_send(ctx, req);
 }
 
+static void quote_www_post_done(inso_http_req* req, long ret, char* data){
+	QuoteReq* r = req->arg;
+	if(ret == -CURLE_ABORTED_BY_CALLBACK) goto out;
+
+	QChan* chan = channels + r->chan_idx;
+	Quote* quote = NULL;
+
+	if(ret == 200){
+		Quote q = {};
+
+		size_t epoch;
+		if(sscanf(data, "%d,%zu", &q.id, &epoch) == 2){
+			q.text = r->text;
+			q.timestamp = epoch;
+			r->text = NULL;
 
-static Quote* quote_www_post(QChan* chan, const char* text){
+			sb_push(chan_quotes[r->chan_idx], q);
+			quote = &sb_last(chan_quotes[r->chan_idx]);
+		}
+	}
+
+	if(!quote){
+		ctx->send_msg(r->chan, "%s: I'm not adding an empty quote...", r->name);
+		goto out;
+	}
+
+	ctx->send_msg(r->chan, "%s: Added as quote %d.", r->name, quote->id);
+
+	// if adding to another channel, send a message to that channel.
+	if(!r->same_chan){
+		quotes_notify(chan->name, r->name, quote);
+	}
+
+	// notify other instances so they can also send messages to the affected channel
+	char ipc_buf[256];
+	int ipc_len = snprintf(ipc_buf, sizeof(ipc_buf), "ADD %d %s %s", quote->id, chan->name, r->name);
+	ctx->send_ipc(0, ipc_buf, ipc_len + 1);
+
+out:
+	quote_req_free(r);
+}
+
+static bool quote_www_post(QuoteReq* r, const char* text){
 	size_t len = strlen(text);
-	if(len == 0) return NULL;
+	if(len == 0) return false;
 
 	// remove redundant quotation marks.
 	if(len >= 2 && *text == '"' && text[len-1] == '"' && !memchr(text+1, '"', len-2)){
@@ -243,42 +380,64 @@ static Quote* quote_www_post(QChan* chan, const char* text){
 		len -= 2;
 	}
 
-	char* data = NULL;
-	char* url  = NULL;
-	asprintf_check(&url, QUOTES_URL "/%s", chan->name+1);
-	inso_curl_reset(curl, url, &data);
-	curl_easy_setopt(curl, CURLOPT_USERPWD, quotes_auth);
+	r->text = strndup(text, len);
+
+	char* url = NULL;
+	asprintf_check(&url, QUOTES_URL "/%s", channels[r->chan_idx].name+1);
+	inso_http_req* req = inso_http_new(url, &quote_www_post_done, r);
+	curl_easy_setopt(req->curl, CURLOPT_USERPWD, quotes_auth);
 	free(url);
 
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS   , text);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
+	curl_easy_setopt(req->curl, CURLOPT_POSTFIELDS   , r->text);
+	curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE, len);
 
-	Quote* quote = NULL;
-	if(inso_curl_perform(curl, &data) == 200){
-		Quote q = {
-			.text = strndup(text, len),
-		};
+	inso_http_send(ctx, req);
+	return true;
+}
 
-		size_t epoch;
-		if(sscanf(data, "%d,%zu", &q.id, &epoch) == 2){
-			q.timestamp = epoch;
-			sb_push(chan_quotes[chan - channels], q);
-			quote =  &sb_last(chan_quotes[chan - channels]);
-		} else {
-			free(q.text);
-		}
+static void quote_www_modify_done(inso_http_req* req, long ret, char* data){
+	QuoteReq* r = req->arg;
+	if(ret == -CURLE_ABORTED_BY_CALLBACK){
+		quote_req_free(r);
+		return;
+	}
+
+	if(ret != 200){
+		ctx->send_msg(r->chan, "%s: Can't find that quote.", r->name);
+		quote_req_free(r);
+		return;
+	}
+
+	Quote* quote = quote_find(channels + r->chan_idx, r->id);
+	if(!quote){
+		// we don't have it yet, get the whole thing. That replies to the command instead.
+		quote_www_get(r);
+		return;
+	}
+
+	if(r->text){
+		free(quote->text);
+		quote->text = r->text;
+		r->text = NULL;
+	}
+	if(r->new_time >= 0){
+		quote->timestamp = r->new_time;
 	}
 
-	sb_free(data);
-	return quote;
+	if(r->cmd == FIX_QUOTE){
+		ctx->send_msg(r->chan, "%s: Updated quote %d.", r->name, r->id);
+	} else {
+		ctx->send_msg(r->chan, "%s: Updated quote %d's timestamp successfully.", r->name, r->id);
+	}
+
+	quote_req_free(r);
 }
 
-static Quote* quote_www_modify(QChan* chan, uint32_t id, const char* new_txt, ssize_t new_time){
-	char* data = NULL;
-	char* url  = NULL;
-	asprintf_check(&url, QUOTES_URL "/%s/%u", chan->name+1, id);
-	inso_curl_reset(curl, url, &data);
-	curl_easy_setopt(curl, CURLOPT_USERPWD, quotes_auth);
+static void quote_www_modify(QuoteReq* r, const char* new_txt, ssize_t new_time){
+	char* url = NULL;
+	asprintf_check(&url, QUOTES_URL "/%s/%u", channels[r->chan_idx].name+1, r->id);
+	inso_http_req* req = inso_http_new(url, &quote_www_modify_done, r);
+	curl_easy_setopt(req->curl, CURLOPT_USERPWD, quotes_auth);
 	free(url);
 
 	char send_buf[1024];
@@ -293,85 +452,49 @@ static Quote* quote_www_modify(QChan* chan, uint32_t id, const char* new_txt, ss
 
 	if(new_txt){
 		inso_strcat(send_buf, sizeof(send_buf), new_txt);
+		r->text = strdup(new_txt);
 	}
+	r->new_time = new_time;
 
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, send_buf);
-
-	Quote* quote = NULL;
-	if(inso_curl_perform(curl, &data) == 200){
-		sb_each(q, chan_quotes[chan - channels]){
-			if(q->id == id){
-				quote = q;
-				break;
-			}
-		}
+	curl_easy_setopt(req->curl, CURLOPT_COPYPOSTFIELDS, send_buf);
 
-		if(quote){
-			if(new_txt){
-				free(quote->text);
-				quote->text = strdup(new_txt);
-			}
-			if(new_time >= 0){
-				quote->timestamp = new_time;
-			}
-		} else {
-			quote = quote_www_get(chan, id);
-		}
-	}
-
-	sb_free(data);
-	return quote;
+	inso_http_send(ctx, req);
 }
 
-static bool quote_www_delete(QChan* chan, uint32_t id){
-	char* data = NULL;
-	char* url  = NULL;
-	asprintf_check(&url, QUOTES_URL "/%s/%u", chan->name+1, id);
-	inso_curl_reset(curl, url, &data);
-	curl_easy_setopt(curl, CURLOPT_USERPWD, quotes_auth);
-	free(url);
-
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+static void quote_www_delete_done(inso_http_req* req, long ret, char* data){
+	QuoteReq* r = req->arg;
+	if(ret == -CURLE_ABORTED_BY_CALLBACK) goto out;
 
-	bool ret = false;
-	if(inso_curl_perform(curl, &data) == 200){
-		ret = true;
-
-		Quote** base = chan_quotes + (chan - channels);
+	if(ret == 200){
+		Quote** base = chan_quotes + r->chan_idx;
 		sb_each(q, *base){
-			if(q->id == id){
+			if(q->id == r->id){
+				free(q->text);
 				sb_erase(*base, q - *base);
 				break;
 			}
 		}
+
+		ctx->send_msg(r->chan, "%s: Deleted quote %d", r->name, r->id);
+	} else {
+		ctx->send_msg(r->chan, "%s: Can't find that quote.", r->name);
 	}
 
-	sb_free(data);
-	return ret;
+out:
+	quote_req_free(r);
 }
 
-static char quote_date_buf[64];
-static const char* quote_strtime(Quote* q){
-	struct tm* date_tm = gmtime(&q->timestamp);
-	strftime(quote_date_buf, sizeof(quote_date_buf), "%F", date_tm);
-	return quote_date_buf;
-}
-
-static void quotes_notify(const char* chan, const char* name, Quote* q){
+static void quote_www_delete(QuoteReq* r){
+	char* url = NULL;
+	asprintf_check(&url, QUOTES_URL "/%s/%u", channels[r->chan_idx].name+1, r->id);
+	inso_http_req* req = inso_http_new(url, &quote_www_delete_done, r);
+	curl_easy_setopt(req->curl, CURLOPT_USERPWD, quotes_auth);
+	free(url);
 
-	bool known_channel = false;
-	for(const char** c = ctx->get_channels(); *c; ++c){
-		if(strcasecmp(*c, chan) == 0){
-			known_channel = true;
-			break;
-		}
-	}
+	curl_easy_setopt(req->curl, CURLOPT_CUSTOMREQUEST, "DELETE");
 
-	if(known_channel && q){
-		ctx->send_msg(chan, "%s added quote %d: \"%s\".", name, q->id, q->text);
-	}
+	inso_http_send(ctx, req);
 }
-
 static bool quotes_ratelimit(const char* chan){
 	QChan* qc = quotes_get_chan(chan, NULL, NULL);
 	time_t now = time(0);
@@ -420,12 +543,7 @@ static void quotes_cmd(const char* chan, const char* name, const char* arg, int
 					break;
 				}
 
-				Quote* q = quote_www_get(quote_chan, id);
-				if(q){
-					ctx->send_msg(chan, "Quote %d: \"%s\" ―%s %s", id, q->text, quote_chan->name+1, quote_strtime(q));
-				} else {
-					ctx->send_msg(chan, "%s: Can't find that quote.", name);
-				}
+				quote_www_get(quote_req_new(GET_QUOTE, quote_chan, id, chan, name));
 				break;
 			}
 		} // fall-through
@@ -456,23 +574,13 @@ static void quotes_cmd(const char* chan, const char* name, const char* arg, int
 				break;
 			}
 
-			Quote* q = quote_www_post(quote_chan, arg);
-			if(!q){
-				ctx->send_msg(chan, "%s: I'm not adding an empty quote...", name);
-				break;
-			}
+			QuoteReq* r = quote_req_new(ADD_QUOTE, quote_chan, 0, chan, name);
+			r->same_chan = same_chan;
 
-			ctx->send_msg(chan, "%s: Added as quote %d.", name, q->id);
-
-			// if adding to another channel, send a message to that channel.
-			if(!same_chan){
-				quotes_notify(quote_chan->name, name, q);
+			if(!quote_www_post(r, arg)){
+				ctx->send_msg(chan, "%s: I'm not adding an empty quote...", name);
+				quote_req_free(r);
 			}
-
-			// notify other instances so they can also send messages to the affected channel
-			char ipc_buf[256];
-			int ipc_len = snprintf(ipc_buf, sizeof(ipc_buf), "ADD %d %s %s", q->id, quote_chan->name, name);
-			ctx->send_ipc(0, ipc_buf, ipc_len + 1);
 		} break;
 
 		case DEL_QUOTE: {
@@ -494,11 +602,7 @@ static void quotes_cmd(const char* chan, const char* name, const char* arg, int
 				break;
 			}
 
-			if(quote_www_delete(quote_chan, id)){
-				ctx->send_msg(chan, "%s: Deleted quote %d", name, id);
-			} else {
-				ctx->send_msg(chan, "%s: Can't find that quote.", name);
-			}
+			quote_www_delete(quote_req_new(DEL_QUOTE, quote_chan, id, chan, name));
 		} break;
 
 		case FIX_QUOTE: {
@@ -524,12 +628,7 @@ static void quotes_cmd(const char* chan, const char* name, const char* arg, int
 				break;
 			}
 
-			Quote* q = quote_www_modify(quote_chan, id, arg2+1, -1);
-			if(q){
-				ctx->send_msg(chan, "%s: Updated quote %d.", name, id);
-			} else {
-				ctx->send_msg(chan, "%s: Can't find that quote.", name);
-			}
+			quote_www_modify(quote_req_new(FIX_QUOTE, quote_chan, id, chan, name), arg2+1, -1);
 		} break;
 
 		case FIX_TIME: {
@@ -563,12 +662,7 @@ static void quotes_cmd(const char* chan, const char* name, const char* arg, int
 			}
 			ssize_t t = timegm(&timestamp);
 
-			Quote* q = quote_www_modify(quote_chan, id, NULL, t);
-			if(q){
-				ctx->send_msg(chan, "%s: Updated quote %d's timestamp successfully.", name, id);
-			} else {
-				ctx->send_msg(chan, "%s: Can't find that quote.", name);
-			}
+			quote_www_modify(quote_req_new(FIX_TIME, quote_chan, id, chan, name), NULL, t);
 		} break;
 
 		case LIST_QUOTES: {
@@ -657,7 +751,7 @@ static void quotes_ipc(int sender, const uint8_t* data, size_t data_len){
 		const char* c = chan;
 		QChan* qc = quotes_get_chan(NULL, &c, NULL);
 		if(qc){
-			quotes_notify(chan, data + name_offset, quote_www_get(qc, id));
+			quote_www_get(quote_req_new(QUOTES_IPC_ADD, qc, id, chan, data + name_offset));
 		}
 	}
 
@@ -13,10 +13,14 @@ static bool psa_init   (const IRCCoreCtx*);
 static void psa_cmd    (const char*, const char*, const char*, int);
 static void psa_msg    (const char*, const char*, const char*);
 static void psa_pm     (const char*, const char*);
-static void psa_tick   (time_t);
 static bool psa_save   (FILE*);
 static void psa_quit   (void);
 static void psa_reload (void);
+static void psa_tick   (void*);
+static void psa_update_prefilter(void);
+
+// triggered PSAs are the only reason to look at messages, so only channels that have one are let through.
+static IRCMsgPrefilter psa_prefilter;
 
 enum { PSA_ADD, PSA_DEL, PSA_LIST };
 
@@ -27,10 +31,10 @@ const IRCModuleCtx irc_mod_ctx = {
 	.on_cmd   = &psa_cmd,
 	.on_msg   = &psa_msg,
 	.on_pm    = &psa_pm,
-	.on_tick  = &psa_tick,
 	.on_save  = &psa_save,
 	.on_quit  = &psa_quit,
 	.on_modified = &psa_reload,
+	.prefilter   = &psa_prefilter,
 	.commands = DEFINE_CMDS (
 		[PSA_ADD]  = CMD("psa+"),
 		[PSA_DEL]  = CMD("psa-"),
@@ -60,7 +64,6 @@ typedef struct {
 } PSAData;
 
 static PSAData* psa_data;
-static time_t psa_last_update;
 
 static void psa_reload(void){
 	FILE* file = fopen(ctx->get_datafile(), "r");
@@ -80,22 +83,53 @@ static void psa_reload(void){
 static bool psa_init(const IRCCoreCtx* _ctx){
 	ctx = _ctx;
 	psa_reload();
+	psa_update_prefilter();
+	ctx->add_timer(60 * 1000, 60 * 1000, &psa_tick, NULL);
 	return true;
 }
 
+static void psa_free(PSAData* p){
+	free(p->channel);
+	free(p->message);
+	free(p->id);
+	free(p->trigger);
+	regfree(&p->trig_rx);
+	free(p->cmdline);
+}
+
+static void psa_update_prefilter(void){
+	const char** chans = (const char**)psa_prefilter.chans;
+	sb_free(chans);
+
+	sb_each(p, psa_data){
+		if(!p->trigger) continue;
+
+		bool found = false;
+		sb_each(c, chans){
+			if(strcmp(*c, p->channel) == 0){
+				found = true;
+				break;
+			}
+		}
+
+		if(!found){
+			sb_push(chans, p->channel);
+		}
+	}
+
+	sb_push(chans, NULL);
+	psa_prefilter.chans = chans;
+}
+
 static bool psa_delete(const char* chan, const char* id){
 	sb_each(p, psa_data){
 		if(strcmp(p->channel, chan) != 0 || strcmp(p->id, id) != 0){
 			continue;
 		}
 
-		free(p->channel);
-		free(p->message);
-		free(p->id);
-		free(p->trigger);
-		regfree(&p->trig_rx);
-		free(p->cmdline);
+		psa_free(p);
 		sb_erase(psa_data, p - psa_data);
+		psa_update_prefilter();
 
 		return true;
 	}
@@ -253,6 +287,7 @@ static void psa_add(const char* chan, const char* arg, bool silent){
 		}
 
 		sb_push(psa_data, psa);
+		psa_update_prefilter();
 
 	} else {
 		free(psa.id);
@@ -398,9 +433,9 @@ static void psa_msg(const char* chan, const char* name, const char* msg){
 
 }
 
-static void psa_tick(time_t now){
-	if(now - psa_last_update < 60) return;
-	psa_last_update = now;
+// a timer once a minute, posting at most one PSA each time.
+static void psa_tick(void* arg){
+	time_t now = time(0);
 
 	sb_each(p, psa_data){
 		if(now - p->last_posted > p->freq_mins * 60 && !p->trigger){
@@ -426,14 +461,13 @@ static bool psa_save(FILE* file){
 
 static void psa_quit(void){
 	sb_each(p, psa_data){
-		free(p->channel);
-		free(p->id);
-		free(p->message);
-		free(p->trigger);
-		free(p->cmdline);
-		regfree(&p->trig_rx);
+		psa_free(p);
 	}
 	sb_free(psa_data);
+
+	const char** chans = (const char**)psa_prefilter.chans;
+	sb_free(chans);
+	psa_prefilter.chans = NULL;
 }
 
 static void psa_pm(const char* name, const char* msg) {
@@ -20,7 +20,6 @@
 
 static bool sched_init (const IRCCoreCtx*);
 static void sched_cmd  (const char*, const char*, const char*, int);
-static void sched_tick (time_t);
 static void sched_quit (void);
 static void sched_mod_msg (const char*, const IRCModMsg*);
 
@@ -31,7 +30,6 @@ const IRCModuleCtx irc_mod_ctx = {
 	.desc        = "Stores stream schedules",
 	.on_init     = &sched_init,
 	.on_cmd      = &sched_cmd,
-	.on_tick     = &sched_tick,
 	.on_quit     = &sched_quit,
 	.on_mod_msg  = &sched_mod_msg,
 	.commands    = DEFINE_CMDS (
@@ -83,6 +81,7 @@ static const char*  sched_url_api;
 
 static SchedOffset* sched_offsets;
 static time_t       offset_expiry;
+static size_t       offset_timer;
 
 static const char* days[] = { "mon", "tue", "wed", "thu", "fri", "sat", "sun" };
 
@@ -123,6 +122,20 @@ static int sched_off_cmp(const void* a, const void* b){
 	return ((SchedOffset*)a)->offset - ((SchedOffset*)b)->offset;
 }
 
+static void sched_offsets_update(void);
+
+static void sched_offsets_expired(void* arg){
+	offset_timer = 0;
+
+	// the timer is only set up to a day ahead, so this might not be the real expiry yet.
+	if(time(0) >= offset_expiry){
+		sched_offsets_update();
+	} else {
+		time_t secs = INSO_MIN(offset_expiry - time(0), (time_t)(24*60*60));
+		offset_timer = ctx->add_timer(secs * 1000, 0, &sched_offsets_expired, NULL);
+	}
+}
+
 static void sched_offsets_update(void){
 	sb_free(sched_offsets);
 
@@ -167,6 +180,9 @@ static void sched_offsets_update(void){
 
 	offset_expiry = week_start + (7*24*60*60);
 	qsort(sched_offsets, sb_count(sched_offsets), sizeof(SchedOffset), &sched_off_cmp);
+
+	ctx->cancel_timer(offset_timer);
+	sched_offsets_expired(NULL);
 }
 
 static bool sched_reload(void){
@@ -1015,12 +1031,6 @@ static void sched_cmd(const char* chan, const char* name, const char* arg, int c
 	}
 }
 
-static void sched_tick(time_t now){
-	if(now >= offset_expiry){
-		sched_offsets_update();
-	}
-}
-
 static void sched_quit(void){
 	sched_free();
 	sb_free(sched_offsets);
@@ -6,7 +6,6 @@
 
 static bool timer_init (const IRCCoreCtx*);
 static void timer_cmd  (const char* chan, const char* name, const char* arg, int cmd);
-static void timer_tick (time_t);
 static bool timer_save (FILE*);
 
 enum { TIMER_INFO, TIMER_ADD, TIMER_DEL, TIMER_LIST };
@@ -16,7 +15,6 @@ const IRCModuleCtx irc_mod_ctx = {
 	.desc     = "create timers",
 	.on_init  = &timer_init,
 	.on_cmd   = &timer_cmd,
-	.on_tick  = &timer_tick,
 	.on_save  = &timer_save,
 	.flags    = IRC_MOD_GLOBAL,
 	.commands = DEFINE_CMDS (
@@ -40,16 +38,54 @@ struct timer {
 	char* id;
 	char* msg;
 	time_t expiry;
+	size_t core_timer;
 };
 
-static sb(struct timer) timers;
+// pointers, since the core timers hold on to them
+static sb(struct timer*) timers;
 
 static void timer_free(struct timer* t) {
+	ctx->cancel_timer(t->core_timer);
 	free(t->chan);
 	free(t->id);
 	free(t->msg);
 	t->chan = t->id = t->msg = NULL;
 	t->expiry = 0;
+	t->core_timer = 0;
+}
+
+static void timer_schedule(struct timer* t);
+
+static void timer_expired(void* arg) {
+	struct timer* t = arg;
+
+	// long timers are scheduled a day at a time
+	if(time(0) < t->expiry) {
+		timer_schedule(t);
+		return;
+	}
+
+	ctx->send_msg(t->chan, "⏰ Timer [%s] expired! %s", t->id, t->msg ?: "");
+
+	t->core_timer = 0;
+	timer_free(t);
+
+	sb_each(p, timers) {
+		if(*p == t) {
+			sb_erase(timers, p - timers);
+			break;
+		}
+	}
+	free(t);
+
+	ctx->save_me();
+}
+
+static void timer_schedule(struct timer* t) {
+	time_t now = time(0);
+	time_t secs = INSO_MIN(t->expiry - now, (time_t)(24*60*60));
+	uint32_t delay_ms = secs > 0 ? secs * 1000 : 0;
+	t->core_timer = ctx->add_timer(delay_ms, 0, &timer_expired, t);
 }
 
 static void timer_load(void) {
@@ -65,15 +101,21 @@ static void timer_load(void) {
 			timer_free(&t);
 		} else {
 			t.expiry = expiry;
-			sb_push(timers, t);
+
+			struct timer* p = malloc(sizeof(*p));
+			*p = t;
+			timer_schedule(p);
+			sb_push(timers, p);
 		}
+		memset(&t, 0, sizeof(t));
 	}
 
 	fclose(f);
 }
 
 static bool timer_save(FILE* f) {
-	sb_each(t, timers) {
+	sb_each(p, timers) {
+		struct timer* t = *p;
 		intmax_t expiry = t->expiry;
 		fprintf(f, "%s %s %" PRIiMAX " %s\n", t->chan, t->id, expiry, t->msg ?: "");
 	}
@@ -81,7 +123,8 @@ static bool timer_save(FILE* f) {
 }
 
 static struct timer* timer_get(const char* chan, const char* id) {
-	sb_each(t, timers) {
+	sb_each(p, timers) {
+		struct timer* t = *p;
 		if(strcmp(chan, t->chan) == 0 && strcasecmp(t->id, id) == 0)
 			return t;
 	}
@@ -218,13 +261,15 @@ static void timer_cmd(const char* chan, const char* name, const char* arg, int c
 			if(t) {
 				timer_free(t);
 			} else {
-				t = sb_add(timers, 1);
+				t = calloc(1, sizeof(*t));
+				sb_push(timers, t);
 			}
 
 			t->chan = strdup(chan);
 			t->id = strdup(id);
 			t->msg = msg ? strdup(msg) : NULL;
 			t->expiry = expiry;
+			timer_schedule(t);
 
 			ctx->send_msg(chan, "%s: Timer %s created/updated.", nick, id);
 			ctx->save_me();
@@ -243,7 +288,13 @@ static void timer_cmd(const char* chan, const char* name, const char* arg, int c
 			}
 
 			timer_free(t);
-			sb_erase(timers, t - timers);
+			sb_each(p, timers) {
+				if(*p == t) {
+					sb_erase(timers, p - timers);
+					break;
+				}
+			}
+			free(t);
 
 			ctx->send_msg(chan, "%s: timer deleted.", nick);
 			ctx->save_me();
@@ -255,11 +306,11 @@ static void timer_cmd(const char* chan, const char* name, const char* arg, int c
 			size_t sz = sizeof(buf);
 
 			sb_each(t, timers) {
-				if(strcmp(t->chan, chan) != 0)
+				if(strcmp((*t)->chan, chan) != 0)
 					continue;
 
-				const char* fmt = t == timers ? "%s" : ", %s";
-				snprintf_chain(&p, &sz, fmt, t->id);
+				const char* fmt = p == buf ? "%s" : ", %s";
+				snprintf_chain(&p, &sz, fmt, (*t)->id);
 			}
 
 			if(!*buf)
@@ -269,15 +320,3 @@ static void timer_cmd(const char* chan, const char* name, const char* arg, int c
 		} break;
 	}
 }
-
-static void timer_tick(time_t now) {
-	sb_each(t, timers) {
-		if(now < t->expiry)
-			continue;
-
-		ctx->send_msg(t->chan, "⏰ Timer [%s] expired! %s", t->id, t->msg ?: "");
-
-		sb_erase(timers, t - timers);
-		--t;
-	}
-}
@@ -7,7 +7,7 @@
 static bool topic_init    (const IRCCoreCtx*);
 static void topic_cmd     (const char* chan, const char* name, const char* arg, int cmd);
 static void topic_msg     (const char* chan, const char* name, const char* msg);
-static void topic_tick    (time_t);
+static void topic_ask     (void*);
 static bool topic_save    (FILE*);
 static void topic_mod_msg (const char*, const IRCModMsg*);
 
@@ -19,7 +19,6 @@ const IRCModuleCtx irc_mod_ctx = {
 	.on_init    = &topic_init,
 	.on_cmd     = &topic_cmd,
 	.on_msg     = &topic_msg,
-	.on_tick    = &topic_tick,
 	.on_save    = &topic_save,
 	.on_mod_msg = &topic_mod_msg,
 	.commands = DEFINE_CMDS (
@@ -41,16 +40,18 @@ struct chan {
 	char   topic[512];
 	time_t ask_time;
 	bool   waiting;
+	uintptr_t ask_id; // passed to topic_ask, since topic_chans can move
 };
 
 static sb(struct chan) topic_chans;
+static uintptr_t topic_last_ask_id;
 
 static void topic_load(void){
 	sb_free(topic_chans);
 
 	FILE* f = fopen(ctx->get_datafile(), "r");
 
-	struct chan c;
+	struct chan c = {};
 	unsigned long tmp_time;
 	time_t now = time(0);
 
@@ -152,13 +153,22 @@ static void topic_cmd(const char* chan, const char* name, const char* arg, int c
 	}
 }
 
-static void topic_tick(time_t now){
-	sb_each(c, topic_chans){
-		if(!*c->topic && c->ask_time && c->ask_time < now && !c->waiting){
-			ctx->send_msg(c->name, "What is the topic for today?");
-			c->waiting = true;
+static void topic_ask(void* arg){
+	struct chan* c = NULL;
+	sb_each(t, topic_chans){
+		if(t->ask_id == (uintptr_t)arg){
+			c = t;
+			break;
 		}
 	}
+
+	// a newer timer replaced this one, or the chan was reloaded.
+	if(!c) return;
+
+	if(!*c->topic && c->ask_time && c->ask_time <= time(0) && !c->waiting){
+		ctx->send_msg(c->name, "What is the topic for today?");
+		c->waiting = true;
+	}
 }
 
 static intptr_t topic_enabled_check(intptr_t result, bool* arg){
@@ -181,6 +191,8 @@ static void topic_mod_msg(const char* sender, const IRCModMsg* msg){
 			memset(c->topic, 0, sizeof(c->topic));
 			c->ask_time = time(0) + 90;
 			c->waiting = false;
+			c->ask_id = ++topic_last_ask_id;
+			ctx->add_timer(90 * 1000, 0, &topic_ask, (void*)c->ask_id);
 		}
 	}
 }
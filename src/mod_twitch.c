@@ -13,7 +13,6 @@
 
 static bool twitch_init    (const IRCCoreCtx*);
 static void twitch_cmd     (const char*, const char*, const char*, int);
-static void twitch_tick    (time_t);
 static bool twitch_save    (FILE*);
 static void twitch_quit    (void);
 static void twitch_mod_msg (const char* sender, const IRCModMsg* msg);
@@ -21,6 +20,9 @@ static void twitch_unknown (const char*, const char*, const char**, size_t);
 static void twitch_modified(void);
 static void twitch_ipc     (int, const uint8_t*, size_t);
 
+static void twitch_tracker_timer  (void*);
+static void twitch_follower_timer (void*);
+
 enum { FOLLOW_NOTIFY, UPTIME, TWITCH_VOD, TWITCH_TRACKER, TWITCH_TITLE };
 
 const IRCModuleCtx irc_mod_ctx = {
@@ -28,7 +30,6 @@ const IRCModuleCtx irc_mod_ctx = {
 	.desc     = "Functionality specific to twitch.tv",
 	.on_init  = twitch_init,
 	.on_cmd   = &twitch_cmd,
-	.on_tick  = &twitch_tick,
 	.on_save  = &twitch_save,
 	.on_quit  = &twitch_quit,
 	.on_mod_msg = &twitch_mod_msg,
@@ -59,7 +60,6 @@ static const long tracker_update_interval = 50;
 
 static time_t last_uptime_check;
 static time_t last_follower_check;
-static time_t last_tracker_update;
 
 static CURL* curl;
 static struct curl_slist* twitch_headers;
@@ -267,7 +267,6 @@ static bool twitch_init(const IRCCoreCtx* _ctx){
 	time_t now = time(0);
 	last_uptime_check = now;
 	last_follower_check = now;
-	last_tracker_update = now - 50;
 
 	FILE* f = fopen(ctx->get_datafile(), "r");
 	twitch_load(f);
@@ -277,6 +276,9 @@ static bool twitch_init(const IRCCoreCtx* _ctx){
 
 	twitch_headers = twitch_headers_new(NULL);
 
+	ctx->add_timer(1000, tracker_update_interval * 1000, &twitch_tracker_timer, NULL);
+	ctx->add_timer(follower_check_interval * 1000, follower_check_interval * 1000, &twitch_follower_timer, NULL);
+
 	return true;
 }
 
@@ -542,22 +544,18 @@ static uint32_t twitch_check_live32(size_t* indices, size_t count) {
 }
 
 static const char* twitch_display_name(const char* fallback){
-	int i = 0;
-	const char *k, *v;
 	static char caps_buffer[256];
+	const char* v = ctx->get_tag_by_name("display-name");
 
-	while(ctx->get_tag(i++, &k, &v)){
-		if(strcmp(k, "display-name") == 0){
-			if(*v) return v;
-			else { // When twitch returns an empty tag, the web UI shows the first char capitalized.
-				strncpy(caps_buffer, fallback, 255);
-				caps_buffer[0] = toupper(caps_buffer[0]);
-				return caps_buffer;
-			}
-		}
+	if(!v){
+		return fallback;
+	} else if(*v){
+		return v;
+	} else { // When twitch returns an empty tag, the web UI shows the first char capitalized.
+		strncpy(caps_buffer, fallback, 255);
+		caps_buffer[0] = toupper(caps_buffer[0]);
+		return caps_buffer;
 	}
-
-	return fallback;
 }
 
 static intptr_t check_alias_cb(intptr_t result, intptr_t arg){
@@ -1350,20 +1348,17 @@ out:
 	if(root) yajl_tree_free(root);
 }
 
-static void twitch_tick(time_t now){
-
-	if(now - last_tracker_update > tracker_update_interval){
-//		puts("mod_twitch: tracker update...");
-		twitch_tracker_update();
-		last_tracker_update = now;
-	}
+static void twitch_tracker_timer(void* arg){
+//	puts("mod_twitch: tracker update...");
+	twitch_tracker_update();
+}
 
-	if(sb_count(twitch_keys) && (now - last_follower_check > follower_check_interval)){
-//		puts("mod_twitch: checking new followers...");
-		twitch_check_followers();
-		last_follower_check = now;
-	}
+static void twitch_follower_timer(void* arg){
+	if(!sb_count(twitch_keys)) return;
 
+//	puts("mod_twitch: checking new followers...");
+	twitch_check_followers();
+	last_follower_check = time(0);
 }
 
 static bool twitch_save(FILE* f){
@@ -1524,18 +1519,14 @@ static void twitch_mod_msg(const char* sender, const IRCModMsg* msg){
 static void twitch_unknown(const char* ev, const char* origin, const char** params, size_t nparams){
 	if(nparams < 2 || strcmp(ev, "USERNOTICE") != 0) return;
 	const char* chan = params[0];
-	const char* name = NULL;
-
-	size_t i = 0;
-	const char *k, *v;
-	while(ctx->get_tag(i++, &k, &v)){
-		if(strcmp(k, "msg-id") == 0 && strcmp(v, "ritual") != 0) return;
-		if(strcmp(k, "msg-param-ritual-name") == 0 && strcmp(v, "new_chatter") != 0) return;
-		if(strcmp(k, "display-name") == 0){
-			name = v;
-		}
-	}
 
+	const char* msg_id = ctx->get_tag_by_name("msg-id");
+	if(msg_id && strcmp(msg_id, "ritual") != 0) return;
+
+	const char* ritual = ctx->get_tag_by_name("msg-param-ritual-name");
+	if(ritual && strcmp(ritual, "new_chatter") != 0) return;
+
+	const char* name = ctx->get_tag_by_name("display-name");
 	if(name){
 		ctx->send_msg(chan, "@%s: Welcome! VoHiYo", name);
 	}
@@ -17,7 +17,7 @@
 // TODO: add a command to add/remove links at runtime
 
 static bool twitter_init (const IRCCoreCtx*);
-static void twitter_tick (time_t);
+static void twitter_check(void*);
 static void twitter_quit (void);
 static bool twitter_save (FILE*);
 
@@ -26,13 +26,11 @@ const IRCModuleCtx irc_mod_ctx = {
 	.desc    = "Get stream schedules from twitter",
 	.flags   = IRC_MOD_GLOBAL,
 	.on_init = &twitter_init,
-	.on_tick = &twitter_tick,
 	.on_quit = &twitter_quit,
 	.on_save = &twitter_save
 };
 
 static const IRCCoreCtx* ctx;
-static time_t last_update;
 static CURL* curl;
 static struct curl_slist* twitter_headers;
 static uint64_t twitter_since_id;
@@ -67,7 +65,7 @@ static bool twitter_init(const IRCCoreCtx* _ctx){
 		free(h);
 	}
 
-	last_update = time(0) - (14*60+40);
+	ctx->add_timer(20 * 1000, 15 * 60 * 1000, &twitter_check, NULL);
 
 	FILE* f = fopen(ctx->get_datafile(), "r");
 	TwitterSchedule ts = {};
@@ -326,10 +324,7 @@ static bool twitter_sched_parse(const TwitterSchedule* ts, const char* msg, yajl
 	return modified;
 }
 
-static void twitter_tick(time_t now){
-	if(now - last_update < (15*60)) return;
-	last_update = now;
-
+static void twitter_check(void* arg){
 	if(!sb_count(schedules)) return;
 
 	char* url;
@@ -8,10 +8,10 @@
 #include "stb_sb.h"
 #include "inso_utils.h"
 #include "inso_json.h"
+#include "inso_http.h"
 
 static bool twitter_newsfeed_init (const IRCCoreCtx*);
 static void twitter_newsfeed_quit (void);
-static void twitter_newsfeed_tick (time_t);
 static void twitter_newsfeed_cmd  (const char* chan, const char* name, const char* arg, int cmd);
 static bool twitter_newsfeed_save (FILE* file);
 
@@ -22,7 +22,6 @@ const IRCModuleCtx irc_mod_ctx = {
 	.desc     = "get news from twitter",
 	.on_init  = &twitter_newsfeed_init,
 	.on_quit  = &twitter_newsfeed_quit,
-	.on_tick  = &twitter_newsfeed_tick,
 	.on_cmd   = &twitter_newsfeed_cmd,
 	.on_save  = &twitter_newsfeed_save,
 	.commands = DEFINE_CMDS (
@@ -31,7 +30,6 @@ const IRCModuleCtx irc_mod_ctx = {
 };
 
 static const IRCCoreCtx* ctx;
-static CURLM* curl_multi;
 static sb(char) msgbuf;
 struct uj_parser uj;
 static char* auth_header;
@@ -39,12 +37,7 @@ static char* auth_header;
 static char* channels;
 static size_t channels_len;
 
-struct curl_req {
-	CURL* handle;
-	struct curl_slist* headers;
-};
-
-static struct curl_req* curl_req;
+static inso_http_req* stream_req;
 
 static void str_replace(sb(char)* msg, const char* from, const char* to){
 	size_t from_len = strlen(from);
@@ -367,36 +360,33 @@ static size_t curl_callback(char* ptr, size_t sz, size_t nmemb, void* data) {
 	return total;
 }
 
-static struct curl_req* curl_req_new(void) {
-	struct curl_req* req = calloc(1, sizeof(*req));
-	req->handle = curl_easy_init();
+static void stream_start(void* arg);
+
+static void stream_done(inso_http_req* req, long status, char* data) {
+	printf("TNF connection ended (%ld)\n", status);
+	stream_req = NULL;
+	stb__sbn(msgbuf) = 0;
+
+	// give it a few seconds before reconnecting, so we don't hammer twitter if it's refusing us.
+	ctx->add_timer(5000, 0, &stream_start, NULL);
+}
+
+static void stream_start(void* arg) {
+	printf("TNF connection (re)started\n");
 
 	const char* url = "https://api.twitter.com/2/tweets/search/stream"
 		"?expansions=attachments.media_keys,author_id,referenced_tweets.id"
 		"&media.fields=url,variants"
 		"&tweet.fields=attachments,author_id,text,entities,created_at,referenced_tweets";
 
-	req->headers = curl_slist_append(req->headers, auth_header);
+	stream_req = inso_http_new(url, &stream_done, NULL);
+	inso_http_header(stream_req, auth_header);
 
-	curl_easy_setopt(req->handle, CURLOPT_HTTPHEADER, req->headers);
-	curl_easy_setopt(req->handle, CURLOPT_URL, url);
-	curl_easy_setopt(req->handle, CURLOPT_WRITEFUNCTION, &curl_callback);
-	curl_easy_setopt(req->handle, CURLOPT_ACCEPT_ENCODING, "");
-	curl_easy_setopt(req->handle, CURLOPT_USERAGENT, "insobot");
+	// it's a stream, so the data is handled as it comes in, and it shouldn't time out.
+	curl_easy_setopt(stream_req->curl, CURLOPT_WRITEFUNCTION, &curl_callback);
+	curl_easy_setopt(stream_req->curl, CURLOPT_TIMEOUT, 0L);
 
-	return req;
-}
-
-static void curl_req_free(struct curl_req* req) {
-	if(!req) {
-		return;
-	}
-
-	curl_multi_remove_handle(curl_multi, req);
-	curl_easy_cleanup(req);
-
-	curl_slist_free_all(req->headers);
-	free(req);
+	inso_http_send(ctx, stream_req);
 }
 
 static bool twitter_newsfeed_save(FILE* file) {
@@ -410,11 +400,6 @@ static bool twitter_newsfeed_save(FILE* file) {
 static bool twitter_newsfeed_init(const IRCCoreCtx* _ctx){
 	ctx = _ctx;
 
-	curl_multi = curl_multi_init();
-	if(!curl_multi) {
-		return false;
-	}
-
 	const char* twitter_token = getenv("INSOBOT_TWITTER_TOKEN");
 	if(!twitter_token) {
 		return NULL;
@@ -434,40 +419,15 @@ static bool twitter_newsfeed_init(const IRCCoreCtx* _ctx){
 
 	asprintf_check(&auth_header, "Authorization: Bearer %s", twitter_token);
 
+	stream_start(NULL);
+
 	return true;
 }
 
 static void twitter_newsfeed_quit(void) {
-	curl_req_free(curl_req);
 	free(auth_header);
 	sb_free(msgbuf);
 	free(channels);
-	curl_multi_cleanup(curl_multi);
-}
-
-static void twitter_newsfeed_tick(time_t now) {
-
-	if(!curl_req) {
-		curl_req = curl_req_new();
-		curl_multi_add_handle(curl_multi, curl_req->handle);
-		printf("TNF connection (re)started\n");
-	}
-
-	curl_multi_wait(curl_multi, NULL, 0, 0, NULL);
-
-	int msgq = 0;
-	curl_multi_perform(curl_multi, &msgq);
-
-	do {
-		CURLMsg* msg = curl_multi_info_read(curl_multi, &msgq);
-
-		if(msg && msg->msg == CURLMSG_DONE) {
-			printf("TNF connection ended\n");
-			curl_req_free(curl_req);
-			curl_req = NULL;
-		}
-
-	} while(msgq > 0);
 }
 
 static char* chan_find(const char* input) {
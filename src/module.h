@@ -9,6 +9,58 @@
 typedef struct IRCCoreCtx_ IRCCoreCtx;
 typedef struct IRCModMsg_ IRCModMsg;
 
+// cheap checks the core makes once per channel message before calling a module's on_msg / on_action.
+// every field that's set must match for the callback to be made. on_cmd isn't affected.
+typedef struct IRCMsgPrefilter_ {
+	const char*  first_chars; // the message starts with one of these
+	const char** substrs;     // null-terminated, the message contains one of these (ignoring case)
+	bool         has_url;     // the message has a URL (IRCMsgView.num_urls isn't 0)
+	const char** chans;       // null-terminated, the message is in one of these. the module may change it at any time,
+	                          // an empty list means no channels.
+} IRCMsgPrefilter;
+
+// part of an IRCMsgView's text, the offset & length are the same in plain and lower.
+typedef struct IRCMsgSpan_ {
+	uint32_t off;
+	uint32_t len;
+} IRCMsgSpan;
+
+// kinds of site recognised by the core's URL scanner, for IRCMsgUrl.host_class
+enum {
+	IRC_HOST_OTHER,
+	IRC_HOST_YOUTUBE, // youtube.com, youtu.be, y2u.be, youtube-nocookie.com
+	IRC_HOST_TWITTER,
+	IRC_HOST_TWITCH,
+	IRC_HOST_GITHUB,
+	IRC_HOST_STEAM,   // store.steampowered.com
+	IRC_HOST_VIMEO,
+	IRC_HOST_XKCD,
+	IRC_HOST_MSDN,    // msdn.microsoft.com
+	IRC_HOST_HMN,     // handmade.network
+	IRC_HOST_CINERA,  // guide.handmadehero.org etc.
+};
+
+// a URL, or something with a host name in it, in an IRCMsgView's plain text. Surrounding punctuation isn't included.
+typedef struct IRCMsgUrl_ {
+	IRCMsgSpan span;
+	IRCMsgSpan host;       // without any scheme, user or port
+	int        host_class; // IRC_HOST_*, subdomains of the sites listed count as them too
+} IRCMsgUrl;
+
+// see IRCCoreCtx.get_msg_view
+typedef struct IRCMsgView_ {
+	const char*       text;      // the message as given to the callback
+	size_t            len;
+	const char*       plain;     // text with mIRC colors / formatting removed
+	size_t            plain_len;
+	const char*       lower;     // plain with ASCII letters lowercased
+	const IRCMsgSpan* words;     // space-separated words of plain
+	size_t            num_words;
+	const IRCMsgUrl*  urls;      // URLs found in plain
+	size_t            num_urls;
+	size_t            num_tags;  // IRCv3 tags the message has, for get_tag
+} IRCMsgView;
+
 // defined by a module to provide info & callbacks to the core.
 typedef struct IRCModuleCtx_ {
 
@@ -40,12 +92,13 @@ typedef struct IRCModuleCtx_ {
 	void (*on_modified)(void);
 
 	// called before other callbacks to allow per-channel modules
+	// the results are cached by the core, see IRCCoreCtx.invalidate_meta
 	bool (*on_meta)    (const char* modname, const char* chan, int callback_id);
 
 	// simple inter-module communication callback
 	void (*on_mod_msg) (const char* sender, const IRCModMsg* msg);
 
-	// called atleast once every ~250ms
+	// called every ~250ms (TICK_INTERVAL_MS in config.h). Prefer ctx->add_timer if you only need to do something later.
 	void (*on_tick)    (time_t now);
 
 	// called if something was written to stdin
@@ -71,16 +124,50 @@ typedef struct IRCModuleCtx_ {
 	// link to online guide / documentation for this module
 	const char* help_url;
 
+	// called when an fd added with ctx->add_fd is ready, events is a mask of IRC_FD_* values.
+	void (*on_fd)      (int fd, uint32_t events);
+
+	// called with each record the module added with ctx->journal since its data was last saved, after on_init
+	// (or on_modified) has loaded the data file. If there were any, it's called once more with IRC_JOURNAL_DONE
+	// and no data after the last one, so work that only needs doing once (sorting etc.) can be left until then.
+	void (*on_journal) (uint32_t type, const void* data, size_t len);
+
+	// optional, used instead of on_save + on_quit / on_init when the module's .so is reloaded.
+	// on_handoff returns the old instance's state (or NULL to reload normally) with a version in *version, and must
+	// leave everything intact: if the new instance's on_adopt returns false, the old one is saved & quit as usual.
+	// The state is only read during on_adopt (the old .so is still loaded then, so it can be a static there) and is
+	// never freed by the core. What it points to must be heap / mmap'd memory, since the old .so is unloaded after.
+	// on_adopt takes the place of on_init, so it must set up ctx, timers, fds etc. again.
+	void* (*on_handoff)(uint32_t* version);
+	bool  (*on_adopt)  (const IRCCoreCtx* ctx, void* state, uint32_t version);
+
+	// called instead of on_join when many names are in a channel at once (NAMES replies, after a reload).
+	// if a module doesn't set it, on_join is called once per name as before.
+	void (*on_join_bulk)(const char* chan, const char** names, size_t count);
+
+	// optional, lets the core skip on_msg / on_action for messages the module doesn't care about. See above.
+	const IRCMsgPrefilter* prefilter;
+
 } IRCModuleCtx;
 
 // incremented when new functions are added to IRCCoreCtx
-#define INSO_CORE_API_VERSION 3
+#define INSO_CORE_API_VERSION 13
 
 // API version history:
 // 1: Initial version.
 // 2: send_msg and send_raw now return an ID for the message.
 //    This will be passed to the filter function of IRCModuleCtx.
 // 3: Added gen_event function
+// 4: Added run_async function
+// 5: Added http_request function
+// 6: Added add_timer / cancel_timer functions
+// 7: Added add_fd / mod_fd / del_fd functions
+// 8: Added invalidate_meta function
+// 9: Added IRC_INFO_CMDS_QUEUED / IRC_INFO_CMDS_DROPPED for get_info
+// 10: Added get_tag_by_name function
+// 11: Added journal function
+// 12: Added IRC_INFO_CONN_ID / IRC_INFO_CONN_COUNT for get_info
+// 13: Added get_msg_view function
 
 // passed to modules to provide functions for them to use.
 struct IRCCoreCtx_ {
@@ -103,7 +190,7 @@ struct IRCCoreCtx_ {
 	size_t         (*send_raw)     (const char* raw);
 	void           (*send_ipc)     (int target, const void* data, size_t data_len); // target 0 == broadcast
 	void           (*send_mod_msg) (IRCModMsg* msg);
-	void           (*save_me)      (void);
+	void           (*save_me)      (void); // marks the module's data dirty, on_save is called a little later (SAVE_DELAY_MS)
 	void           (*log)          (const char* fmt, ...) __attribute__ ((format (printf, 1, 2)));
 	void           (*strip_colors) (char* msg);
 	bool           (*responded)    (void); // true if send_msg was called for the current msg already
@@ -114,11 +201,67 @@ struct IRCCoreCtx_ {
 	// The variadic args should be the same as for the corresponding on_ callback in IRCModuleCtx.
 	// Supported callbacks are in the enum below.
 	void           (*gen_event)    (int which, ...);
+
+	// === Since API v4 ===
+	// Calls work(arg) on one of the core's worker threads, then done(arg) back on the main thread when it finishes.
+	// Use this for anything that might block (e.g. curl_easy_perform) so the rest of the bot isn't held up.
+	// work must NOT call any of these IRCCoreCtx functions or touch state that the module's other callbacks use.
+	// done can be NULL. Outstanding jobs are waited for before the module is saved & unloaded.
+	void           (*run_async)    (void (*work)(void* arg), void (*done)(void* arg), void* arg);
+
+	// === Since API v5 ===
+	// Performs a curl easy handle on the core's curl multi handle, without blocking. The core owns the handle until
+	// cb is called on the main thread with the CURLcode result, after that it's up to the module to clean it up.
+	// Requests still running when the module is unloaded get cb called with CURLE_ABORTED_BY_CALLBACK.
+	// See inso_http.h for an easier interface.
+	void           (*http_request) (void* curl, void (*cb)(void* curl, int result, void* arg), void* arg);
+
+	// === Since API v6 ===
+	// Calls cb(arg) after delay_ms, then every interval_ms after that if it's non-zero.
+	// Returns an id for cancel_timer, or 0 if the core has run out of timers (cancelling 0 does nothing).
+	// A one-shot timer's id is invalid once its cb has been called.
+	// Timers are cancelled automatically when the module is unloaded.
+	size_t         (*add_timer)    (uint32_t delay_ms, uint32_t interval_ms, void (*cb)(void* arg), void* arg);
+	void           (*cancel_timer) (size_t id);
+
+	// === Since API v7 ===
+	// Adds an fd to the set the core waits on, so the module's on_fd is called when it's ready for any of the
+	// IRC_FD_* events given. The fd isn't closed by the core, but it is removed when the module is unloaded.
+	bool           (*add_fd)       (int fd, uint32_t events);
+	bool           (*mod_fd)       (int fd, uint32_t events);
+	void           (*del_fd)       (int fd);
+
+	// === Since API v8 ===
+	// The core caches the answers from on_meta per channel. Modules with on_meta must call this whenever their
+	// answers for chan might change, or with NULL if it could be any channel.
+	void           (*invalidate_meta) (const char* chan);
+
+	// === Since API v10 ===
+	// Returns the (unescaped) value of the current message's IRCv3 tag named key, or NULL if it doesn't have one.
+	// Cheaper than looping over get_tag when you only want a few.
+	const char*    (*get_tag_by_name) (const char* key);
+
+	// === Since API v11 ===
+	// Appends a record to the module's journal, for saving a small change without rewriting the whole data file.
+	// The records are given back to on_journal on the next load, until on_save has written a file containing them.
+	// Records may be replayed twice after a crash, so store the new state of something rather than a difference.
+	// The core calls on_save by itself when the journal gets big compared to the data file.
+	void           (*journal)      (uint32_t type, const void* data, size_t len);
+
+	// === Since API v13 ===
+	// Returns things about the message being handled by on_msg / on_action / on_cmd / on_pm, worked out by the core
+	// the first time any module asks for them, or NULL outside of those callbacks. Only valid until it returns.
+	const IRCMsgView* (*get_msg_view) (void);
 };
 
 enum {
 	IRC_INFO_CAN_PARSE_TAGS, // bool
 	IRC_INFO_NEXT_CMD_ID,    // size_t
+	IRC_INFO_CURL_SHARE,     // CURLSH*, (since API v5) shares DNS / TLS sessions with the core, safe to use from worker threads
+	IRC_INFO_CMDS_QUEUED,    // size_t, (since API v9) messages / commands waiting to be sent
+	IRC_INFO_CMDS_DROPPED,   // size_t, (since API v9) messages / commands dropped because their queue was full
+	IRC_INFO_CONN_ID,        // int, (since API v12) which server connection the current event came from
+	IRC_INFO_CONN_COUNT,     // size_t, (since API v12) number of server connections, see IRC_CONNECTIONS
 };
 
 // used for on_meta callback & gen_event.
@@ -132,12 +275,23 @@ enum  {
 	IRC_CB_PM,
 };
 
+// used for add_fd / mod_fd / on_fd
+enum {
+	IRC_FD_READ  = 1,
+	IRC_FD_WRITE = 2,
+	IRC_FD_ERROR = 4, // error or hangup, always reported
+};
+
 // used for the flags field of IRCModuleCtx
 enum {
-	IRC_MOD_GLOBAL  = 1, // not a module that can be enabled / disabled per channel
-	IRC_MOD_DEFAULT = 2, // enabled by default when joining new channels
+	IRC_MOD_GLOBAL    = 1, // not a module that can be enabled / disabled per channel
+	IRC_MOD_DEFAULT   = 2, // enabled by default when joining new channels
+	IRC_MOD_FORK_SAVE = 4, // save_me runs on_save in a forked child (copy-on-write snapshot), any changes it makes are lost
 };
 
+// type on_journal gets after the last replayed record, don't use it for your own records
+#define IRC_JOURNAL_DONE UINT32_MAX
+
 // used for inter-module communication messages
 struct IRCModMsg_ {
 	const char* cmd;
@@ -0,0 +1,515 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../../src/stb_sb.h"
+
+// ibfake: a stand-in IRC / twitch server on localhost for benchmarking insobot end-to-end.
+// it invites the bot into N channels, fills them with chatter, and measures how long the bot takes to answer
+// the commands mixed into it.
+
+static const char usage[] =
+	"Usage: %s [options]\n"
+	"  -p port   port to listen on (6667)\n"
+	"  -n num    number of channels to invite the bot to (4)\n"
+	"  -r rate   chat messages per second, per channel (2)\n"
+	"  -c cmd    command the bot answers, mixed into the chat (\"!m\")\n"
+	"  -f frac   fraction of chat messages that are the command (0.1)\n"
+	"  -a nick   nick that sends the commands, e.g. the bot's IRC_ADMIN (\"admin\")\n"
+	"  -m text   only count bot lines containing text as replies, one per occurrence (any line counts as one)\n"
+	"  -u num    users in each channel's NAMES reply (500)\n"
+	"  -i secs   seconds between PINGs to the bot (30)\n"
+	"  -d secs   stop and report after this long, otherwise on ^C (0)\n"
+	"  -o file   log every line the bot sends, with a timestamp\n"
+	"  -t        act like twitch: IRCv3 tags, CAP ACK, USERSTATE\n";
+
+struct chan {
+	char*    name;
+	bool     joined;
+	double   next_msg;
+	double*  pending; // times commands were sent that haven't been answered yet
+};
+
+static struct {
+	int      port;
+	int      num_chans;
+	double   rate;
+	char*    cmd;
+	double   cmd_frac;
+	char*    admin;
+	char*    reply_match;
+	int      num_users;
+	double   ping_secs;
+	double   duration;
+	bool     twitch;
+	FILE*    log;
+} opt = {
+	.port      = 6667,
+	.num_chans = 4,
+	.rate      = 2.0,
+	.cmd       = "!m",
+	.cmd_frac  = 0.1,
+	.admin     = "admin",
+	.num_users = 500,
+	.ping_secs = 30.0,
+};
+
+static volatile sig_atomic_t running = 1;
+
+static int   client = -1;
+static char* bot_nick;
+static bool  registered;
+static char* in_buf;
+static char* out_buf;
+
+static sb(struct chan) chans;
+
+static double start_time;
+static double next_ping;
+static double ping_sent_at = -1;
+
+static sb(double) latencies;
+static sb(double) ping_rtts;
+static size_t     num_sent;     // lines we sent as chatter
+static size_t     num_cmds;     // of which were the command
+static size_t     num_bot_msgs; // PRIVMSGs from the bot
+static size_t     num_connects;
+
+static double now_secs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double rand_exp(double rate){
+	return -log(1.0 - (rand() / (RAND_MAX + 1.0))) / rate;
+}
+
+static void on_sig(int sig){
+	(void)sig;
+	running = 0;
+}
+
+static void send_line(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+static void send_line(const char* fmt, ...){
+	char buf[1024];
+	va_list va;
+
+	va_start(va, fmt);
+	int n = vsnprintf(buf, sizeof(buf) - 2, fmt, va);
+	va_end(va);
+
+	if(n < 0) return;
+	if(n > (int)sizeof(buf) - 3) n = sizeof(buf) - 3;
+
+	buf[n++] = '\r';
+	buf[n++] = '\n';
+	memcpy(sb_add(out_buf, n), buf, n);
+}
+
+static struct chan* chan_find(const char* name){
+	sb_each(c, chans){
+		if(strcasecmp(c->name, name) == 0) return c;
+	}
+	return NULL;
+}
+
+static void send_chat(struct chan* c, const char* nick, const char* msg){
+	if(opt.twitch){
+		static unsigned id;
+		++id;
+		send_line(
+			"@badge-info=;badges=;color=#1E90FF;display-name=%s;emotes=;flags=;id=%08x-0000-0000-0000-000000000000;"
+			"mod=0;room-id=1;subscriber=0;tmi-sent-ts=%ld;turbo=0;user-id=%u;user-type= "
+			":%s!%s@%s.tmi.twitch.tv PRIVMSG %s :%s",
+			nick, id, (long)time(0) * 1000, id, nick, nick, nick, c->name, msg
+		);
+	} else {
+		send_line(":%s!%s@fake.host PRIVMSG %s :%s", nick, nick, c->name, msg);
+	}
+	++num_sent;
+}
+
+static void do_chatter(double now){
+	static const char* words[] = {
+		"hello", "what", "is", "this", "stream", "about", "the", "code", "looks", "good", "bad", "why",
+		"compile", "it", "again", "lol", "nice", "memory", "pointer", "cache", "miss", "today", "yes", "no",
+	};
+
+	sb_each(c, chans){
+		if(!c->joined) continue;
+
+		while(c->next_msg <= now){
+			c->next_msg += rand_exp(opt.rate);
+
+			if(rand() / (RAND_MAX + 1.0) < opt.cmd_frac){
+				send_chat(c, opt.admin, opt.cmd);
+				sb_push(c->pending, now);
+				++num_cmds;
+			} else {
+				char nick[32], msg[256];
+				snprintf(nick, sizeof(nick), "user%d", rand() % opt.num_users);
+
+				int len = 0, nwords = 1 + rand() % 12;
+				for(int i = 0; i < nwords; ++i){
+					len += snprintf(msg + len, sizeof(msg) - len, "%s%s", i ? " " : "", words[rand() % (sizeof(words)/sizeof(*words))]);
+				}
+
+				send_chat(c, nick, msg);
+			}
+		}
+	}
+}
+
+static void send_names(struct chan* c){
+	char line[512];
+	int len = 0;
+
+	for(int i = 0; i < opt.num_users; ++i){
+		if(len > 400){
+			send_line(":fake.server 353 %s = %s :%s", bot_nick, c->name, line);
+			len = 0;
+		}
+		len += snprintf(line + len, sizeof(line) - len, "%suser%d", len ? " " : "", i);
+	}
+
+	if(len){
+		send_line(":fake.server 353 %s = %s :%s", bot_nick, c->name, line);
+	}
+	send_line(":fake.server 366 %s %s :End of /NAMES list", bot_nick, c->name);
+}
+
+static void on_bot_line(char* line, double now){
+	if(opt.log){
+		fprintf(opt.log, "%.6f %s\n", now - start_time, line);
+	}
+
+	// skip any tags / prefix the bot might send
+	if(*line == '@' || *line == ':'){
+		line = strchr(line, ' ');
+		if(!line) return;
+		++line;
+	}
+
+	char* cmd = strsep(&line, " ");
+	char* arg = line ? strsep(&line, " ") : NULL;
+	char* trailing = line && *line == ':' ? line + 1 : line;
+
+	if(strcasecmp(cmd, "NICK") == 0 && arg){
+		free(bot_nick);
+		bot_nick = strdup(*arg == ':' ? arg + 1 : arg);
+
+	} else if(strcasecmp(cmd, "USER") == 0 && !registered){
+		registered = true;
+		send_line(":fake.server 001 %s :Welcome to ibfake", bot_nick);
+		send_line(":fake.server 376 %s :End of /MOTD command", bot_nick);
+
+		for(int i = 0; i < opt.num_chans; ++i){
+			char name[32];
+			snprintf(name, sizeof(name), "#chan%d", i);
+			if(!chan_find(name)){
+				struct chan c = { .name = strdup(name) };
+				sb_push(chans, c);
+			}
+			send_line(":%s!%s@fake.host INVITE %s :%s", opt.admin, opt.admin, bot_nick, name);
+		}
+
+	} else if(strcasecmp(cmd, "CAP") == 0 && arg && strcasecmp(arg, "REQ") == 0){
+		send_line(":fake.server CAP * %s :%s", opt.twitch ? "ACK" : "NAK", trailing ? trailing : "");
+
+	} else if(strcasecmp(cmd, "PING") == 0){
+		send_line(":fake.server PONG fake.server :%s", arg ? (*arg == ':' ? arg + 1 : arg) : "");
+
+	} else if(strcasecmp(cmd, "PONG") == 0){
+		if(ping_sent_at >= 0){
+			sb_push(ping_rtts, now - ping_sent_at);
+			ping_sent_at = -1;
+		}
+
+	} else if(strcasecmp(cmd, "JOIN") == 0 && arg){
+		for(char* name; (name = strsep(&arg, ","));){
+			struct chan* c = chan_find(name);
+			if(!c){
+				struct chan new_chan = { .name = strdup(name) };
+				sb_push(chans, new_chan);
+				c = &sb_last(chans);
+			}
+
+			if(!c->joined){
+				c->joined = true;
+				c->next_msg = now + rand_exp(opt.rate);
+			}
+
+			send_line(":%s!%s@fake.host JOIN %s", bot_nick, bot_nick, c->name);
+			send_names(c);
+
+			if(opt.twitch){
+				send_line("@badge-info=;badges=;color=;display-name=%s;emote-sets=0;mod=0;subscriber=0;user-type= "
+				          ":tmi.twitch.tv USERSTATE %s", bot_nick, c->name);
+			}
+		}
+
+	} else if(strcasecmp(cmd, "PART") == 0 && arg){
+		for(char* name; (name = strsep(&arg, ","));){
+			struct chan* c = chan_find(name);
+			if(c && c->joined){
+				c->joined = false;
+				sb_free(c->pending);
+				send_line(":%s!%s@fake.host PART %s", bot_nick, bot_nick, c->name);
+			}
+		}
+
+	} else if(strcasecmp(cmd, "PRIVMSG") == 0 && arg){
+		++num_bot_msgs;
+
+		// with -m, a line can answer several commands if the bot merged replies together (CMD_COALESCE_SEP).
+		size_t answers = 1;
+		if(opt.reply_match){
+			answers = 0;
+			for(const char* p = trailing; p && (p = strstr(p, opt.reply_match)); p += strlen(opt.reply_match)){
+				++answers;
+			}
+		}
+
+		// assume replies come in order, so the oldest unanswered commands are the ones being answered
+		struct chan* c = chan_find(arg);
+		while(c && answers-- && sb_count(c->pending)){
+			sb_push(latencies, now - c->pending[0]);
+			sb_erase(c->pending, 0);
+		}
+	}
+}
+
+static void client_close(void){
+	close(client);
+	client = -1;
+	registered = false;
+	sb_free(in_buf);
+	sb_free(out_buf);
+
+	sb_each(c, chans){
+		c->joined = false;
+		sb_free(c->pending);
+	}
+
+	puts("ibfake: bot disconnected");
+}
+
+static bool client_read(double now){
+	char buf[4096];
+	ssize_t n = read(client, buf, sizeof(buf));
+
+	if(n == -1 && (errno == EAGAIN || errno == EINTR)){
+		return true;
+	} else if(n <= 0){
+		return false;
+	}
+
+	memcpy(sb_add(in_buf, n), buf, n);
+
+	char* start = in_buf;
+	char* end = in_buf + sb_count(in_buf);
+	char* nl;
+
+	while((nl = memchr(start, '\n', end - start))){
+		*nl = '\0';
+		if(nl > start && nl[-1] == '\r') nl[-1] = '\0';
+		on_bot_line(start, now);
+		start = nl + 1;
+	}
+
+	size_t left = end - start;
+	memmove(in_buf, start, left);
+	stb__sbn(in_buf) = left;
+
+	return true;
+}
+
+static bool client_write(void){
+	if(!sb_count(out_buf)) return true;
+
+	ssize_t n = write(client, out_buf, sb_count(out_buf));
+	if(n == -1){
+		return errno == EAGAIN || errno == EINTR;
+	}
+
+	memmove(out_buf, out_buf + n, sb_count(out_buf) - n);
+	stb__sbn(out_buf) -= n;
+
+	return true;
+}
+
+static int cmp_double(const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void print_percentiles(const char* what, double* vals){
+	size_t n = sb_count(vals);
+	if(!n){
+		printf("%-24s no samples\n", what);
+		return;
+	}
+
+	qsort(vals, n, sizeof(*vals), &cmp_double);
+
+	#define PCT(p) (vals[(size_t)((n - 1) * (p))] * 1000.0)
+	printf("%-24s n=%-8zu p50 %8.2fms  p90 %8.2fms  p99 %8.2fms  max %8.2fms\n",
+	       what, n, PCT(0.5), PCT(0.9), PCT(0.99), vals[n-1] * 1000.0);
+	#undef PCT
+}
+
+static void report(double now){
+	double secs = now - start_time;
+	size_t unanswered = 0;
+
+	sb_each(c, chans){
+		unanswered += sb_count(c->pending);
+	}
+
+	printf("\n--- ibfake report: %.1fs, %zu connection(s), %zu channels ---\n", secs, num_connects, sb_count(chans));
+	printf("chat lines sent         %zu (%.1f/s), of which commands %zu\n", num_sent, num_sent / secs, num_cmds);
+	printf("bot messages received   %zu (%.2f/s)\n", num_bot_msgs, num_bot_msgs / secs);
+	printf("commands unanswered     %zu\n", unanswered);
+	print_percentiles("command -> reply", latencies);
+	print_percentiles("PING -> PONG", ping_rtts);
+}
+
+int main(int argc, char** argv){
+	int c;
+	while((c = getopt(argc, argv, "p:n:r:c:f:a:m:u:i:d:o:th")) != -1){
+		switch(c){
+			case 'p': opt.port      = atoi(optarg); break;
+			case 'n': opt.num_chans = atoi(optarg); break;
+			case 'r': opt.rate      = atof(optarg); break;
+			case 'c': opt.cmd       = optarg;       break;
+			case 'f': opt.cmd_frac  = atof(optarg); break;
+			case 'a': opt.admin     = optarg;       break;
+			case 'm': opt.reply_match = optarg;     break;
+			case 'u': opt.num_users = atoi(optarg); break;
+			case 'i': opt.ping_secs = atof(optarg); break;
+			case 'd': opt.duration  = atof(optarg); break;
+			case 't': opt.twitch    = true;         break;
+			case 'o': {
+				if(!(opt.log = fopen(optarg, "w"))){
+					perror(optarg);
+					return 1;
+				}
+			} break;
+			default: {
+				fprintf(stderr, usage, argv[0]);
+				return c != 'h';
+			}
+		}
+	}
+
+	if(opt.rate <= 0 || opt.num_users <= 0){
+		fprintf(stderr, usage, argv[0]);
+		return 1;
+	}
+
+	signal(SIGINT, &on_sig);
+	signal(SIGTERM, &on_sig);
+	signal(SIGPIPE, SIG_IGN);
+
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &(int){ 1 }, sizeof(int));
+
+	struct sockaddr_in addr = {
+		.sin_family      = AF_INET,
+		.sin_port        = htons(opt.port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+
+	if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(sock, 1) == -1){
+		perror("bind / listen");
+		return 1;
+	}
+
+	printf("ibfake: listening on 127.0.0.1:%d, run insobot with IRC_SERV=127.0.0.1 IRC_PORT=%d%s\n",
+	       opt.port, opt.port, opt.twitch ? " IRC_IS_TWITCH=1" : "");
+
+	srand(time(0));
+	start_time = now_secs();
+	bot_nick = strdup("*");
+
+	while(running){
+		double now = now_secs();
+
+		if(opt.duration > 0 && now - start_time >= opt.duration){
+			break;
+		}
+
+		if(client != -1 && registered){
+			do_chatter(now);
+
+			if(now >= next_ping){
+				if(ping_sent_at < 0){
+					send_line("PING :fake.server");
+					ping_sent_at = now;
+				}
+				next_ping = now + opt.ping_secs;
+			}
+		}
+
+		struct pollfd fds[] = {
+			{ .fd = client == -1 ? sock : client, .events = POLLIN | (sb_count(out_buf) ? POLLOUT : 0) },
+		};
+
+		// wake up for the next chat message at the latest
+		double wait = 1.0;
+		sb_each(ch, chans){
+			if(ch->joined && ch->next_msg - now < wait) wait = ch->next_msg - now;
+		}
+
+		if(poll(fds, 1, wait > 0 ? (int)(wait * 1000.0) + 1 : 0) <= 0){
+			continue;
+		}
+
+		now = now_secs();
+
+		if(client == -1){
+			client = accept(sock, NULL, NULL);
+			if(client != -1){
+				fcntl(client, F_SETFL, O_NONBLOCK);
+				setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &(int){ 1 }, sizeof(int));
+				next_ping = now + opt.ping_secs;
+				ping_sent_at = -1;
+				++num_connects;
+				puts("ibfake: bot connected");
+			}
+			continue;
+		}
+
+		if((fds[0].revents & (POLLIN | POLLERR | POLLHUP)) && !client_read(now)){
+			client_close();
+			continue;
+		}
+
+		if((fds[0].revents & POLLOUT) && !client_write()){
+			client_close();
+		}
+	}
+
+	report(now_secs());
+
+	if(opt.log){
+		fclose(opt.log);
+	}
+
+	return 0;
+}